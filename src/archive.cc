@@ -5,6 +5,7 @@
 
 #include "src/exception.h"
 #include "src/archive.h"
+#include "src/profile.h"
 
 namespace
 {
@@ -33,6 +34,7 @@ namespace
 ZIPArchive::ZIPArchive(const char* filename)
     : archive_filename(filename)
 {
+    PROFILE_SPAN_DETAIL(span, "pk3_open", filename);
     int r;
     m_archive = zip_open(filename, 0, &r);
     if (m_archive == nullptr) {
@@ -49,11 +51,13 @@ ZIPArchive::~ZIPArchive() noexcept
 
 bool ZIPArchive::file_exists(const char* filename) const
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     return zip_name_locate(m_archive, filename, ZIP_FL_NOCASE) != -1;
 }
 
 ZIPArchive::optional_data_t ZIPArchive::read_file(const char* filename) const
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     struct zip_stat stat;
     if (zip_stat(m_archive, filename, ZIP_FL_NOCASE, &stat) == -1) {
         throwf("ZIPArchive: zip_stat: %s: %s", filename, zip_strerror(m_archive));
@@ -81,6 +85,23 @@ ZIPArchive::optional_data_t ZIPArchive::read_file(const char* filename) const
     return v;
 }
 
+bool ZIPArchive::stat_file(const char* filename, std::uint32_t* crc,
+        std::uint64_t* size) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    struct zip_stat stat;
+    if (zip_stat(m_archive, filename, ZIP_FL_NOCASE, &stat) == -1) {
+        return false;
+    }
+    if ((stat.valid & (ZIP_STAT_CRC | ZIP_STAT_SIZE)) !=
+            (ZIP_STAT_CRC | ZIP_STAT_SIZE)) {
+        throwf("ZIPArchive: zip_stat: %s: ZIP_STAT_CRC not set", filename);
+    }
+    *crc = stat.crc;
+    *size = stat.size;
+    return true;
+}
+
 PAK3Archive::PAK3Archive(const char* path, const int max_pak_files)
 {
     std::string cpath(path);
@@ -103,7 +124,8 @@ PAK3Archive::PAK3Archive(const char* path, const int max_pak_files)
     }
 }
 
-PAK3Archive::optional_data_t PAK3Archive::read_file(const char* filename) const
+// Later pk3 files override earlier ones.
+const ZIPArchive* PAK3Archive::find_file(const char* filename) const
 {
     const ZIPArchive* best = nullptr;
     for (auto&& p : m_zip_files) {
@@ -111,11 +133,33 @@ PAK3Archive::optional_data_t PAK3Archive::read_file(const char* filename) const
             best = &p;
         }
     }
+    return best;
+}
+
+PAK3Archive::optional_data_t PAK3Archive::read_file(const char* filename) const
+{
+    PROFILE_SPAN_DETAIL(span, "read_file", filename);
+    const ZIPArchive* const best = find_file(filename);
     if (best == nullptr) {
         return optional_data_t();
     }
 
-    std::cerr << "PAK3Archive: reading: " << best->archive_filename << ": " <<
-        filename << std::endl;
-    return best->read_file(filename);
+    // One write per line, as files may be read from several threads.
+    std::cerr << "PAK3Archive: reading: " + best->archive_filename + ": " +
+        filename + "\n";
+    auto maybe_data = best->read_file(filename);
+    if (maybe_data) {
+        PROFILE_SPAN_ARG(span, "bytes", maybe_data.value().size());
+    }
+    return maybe_data;
+}
+
+bool PAK3Archive::stat_file(const char* filename, FileInfo* info) const
+{
+    const ZIPArchive* const best = find_file(filename);
+    if (best == nullptr) {
+        return false;
+    }
+    info->archive_filename = best->archive_filename;
+    return best->stat_file(filename, &info->crc, &info->size);
 }
@@ -4,11 +4,14 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <mutex>
 #include <cstdint>
 #include <experimental/optional>
 
 #include <zip.h>
 
+// libzip handles may not be used from several threads at once, so access
+// to the archive is serialized.
 class ZIPArchive
 {
     public:
@@ -26,28 +29,45 @@ class ZIPArchive
         bool file_exists(const char*) const;
         optional_data_t read_file(const char*) const;
 
+        // Gets the CRC-32 and uncompressed size the directory records for
+        // the file, or returns false if there is no such file.
+        bool stat_file(const char*, std::uint32_t*, std::uint64_t*) const;
+
     private:
-        struct zip* m_archive;
+        struct zip*         m_archive;
+        mutable std::mutex  m_mutex;
 };
 
 // =======================================================================
 // =======================================================================
 
+// Safe to read from several threads.
 class PAK3Archive
 {
     public:
         using data_t = ZIPArchive::data_t;
         using optional_data_t = ZIPArchive::optional_data_t;
 
+        // The entry read_file() would read.
+        struct FileInfo
+        {
+            std::string     archive_filename;
+            std::uint32_t   crc;
+            std::uint64_t   size;
+        };
+
         explicit PAK3Archive(const char*, const int = 10);
 
         PAK3Archive(const PAK3Archive&) = delete;
         void operator=(const PAK3Archive&) = delete;
 
         optional_data_t read_file(const char*) const;
+        bool stat_file(const char*, FileInfo*) const;
 
     private:
         std::list<ZIPArchive> m_zip_files;
+
+        const ZIPArchive* find_file(const char*) const;
 };
 
 #endif
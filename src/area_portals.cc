@@ -0,0 +1,108 @@
+#include <algorithm>
+
+#include "src/area_portals.h"
+#include "src/exception.h"
+
+AreaPortals::AreaPortals()
+    : m_num_areas(0)
+{}
+
+void AreaPortals::reset(const std::int32_t num_areas)
+{
+    m_num_areas = std::max(num_areas, 0);
+    m_portals.clear();
+    flood();
+}
+
+std::size_t AreaPortals::add_portal(const std::int32_t a, const std::int32_t b)
+{
+    if (a < 0 || a >= m_num_areas || b < 0 || b >= m_num_areas) {
+        throwf("Area portal between areas %d and %d out of range", a, b);
+    }
+    m_portals.push_back(Portal{{a, b}, true});
+    flood();
+    return m_portals.size() - 1;
+}
+
+void AreaPortals::set_portal_open(const std::size_t portal, const bool open)
+{
+    Portal& p = m_portals.at(portal);
+    if (p.open != open) {
+        p.open = open;
+        flood();
+    }
+}
+
+void AreaPortals::set_all_open(const bool open)
+{
+    for (auto&& portal : m_portals) {
+        portal.open = open;
+    }
+    flood();
+}
+
+bool AreaPortals::are_connected(const std::int32_t a,
+        const std::int32_t b) const
+{
+    if (a < 0 || b < 0 || a >= m_num_areas || b >= m_num_areas) {
+        return true;
+    }
+    return m_floods[static_cast<std::size_t>(a)] ==
+        m_floods[static_cast<std::size_t>(b)];
+}
+
+void AreaPortals::write_area_bits(const std::int32_t area,
+        std::vector<std::uint8_t>* bits) const
+{
+    const auto num_bytes = static_cast<std::size_t>((m_num_areas + 7) / 8);
+    if (area < 0 || area >= m_num_areas) {
+        bits->assign(num_bytes, 0xff);
+        return;
+    }
+    bits->assign(num_bytes, 0);
+    const std::int32_t flood = m_floods[static_cast<std::size_t>(area)];
+    for (std::int32_t i = 0; i < m_num_areas; ++i) {
+        if (m_floods[static_cast<std::size_t>(i)] == flood) {
+            (*bits)[static_cast<std::size_t>(i >> 3)] |=
+                static_cast<std::uint8_t>(1 << (i & 7));
+        }
+    }
+}
+
+// Numbers the connected components by flooding from each area not reached
+// yet through the open portals.
+void AreaPortals::flood()
+{
+    const auto num_areas = static_cast<std::size_t>(m_num_areas);
+    m_floods.assign(num_areas, -1);
+    std::vector<std::int32_t> stack;
+    std::int32_t num_floods = 0;
+    for (std::size_t start = 0; start < num_areas; ++start) {
+        if (m_floods[start] >= 0) {
+            continue;
+        }
+        m_floods[start] = num_floods;
+        stack.push_back(static_cast<std::int32_t>(start));
+        while (!stack.empty()) {
+            const std::int32_t area = stack.back();
+            stack.pop_back();
+            for (auto&& portal : m_portals) {
+                if (!portal.open) {
+                    continue;
+                }
+                for (int side = 0; side < 2; ++side) {
+                    if (portal.areas[side] != area) {
+                        continue;
+                    }
+                    const auto other =
+                        static_cast<std::size_t>(portal.areas[side ^ 1]);
+                    if (m_floods[other] < 0) {
+                        m_floods[other] = num_floods;
+                        stack.push_back(portal.areas[side ^ 1]);
+                    }
+                }
+            }
+        }
+        ++num_floods;
+    }
+}
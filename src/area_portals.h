@@ -0,0 +1,65 @@
+#ifndef Q3BSP__AREA_PORTALS_H
+#define Q3BSP__AREA_PORTALS_H
+
+#include <vector>
+#include <cstdint>
+
+// Connectivity of the map's areas, the regions doors divide it into, as in
+// Quake III's cm_areaportals. Each portal joins the two areas on either
+// side of a door and is open or closed; areas joined by open portals,
+// directly or not, are connected.
+class AreaPortals
+{
+    public:
+        AreaPortals();
+
+        AreaPortals(const AreaPortals&) = delete;
+        void operator=(const AreaPortals&) = delete;
+
+        // Drops all portals.
+        void reset(const std::int32_t);
+
+        // Adds an open portal between two areas and returns its index.
+        std::size_t add_portal(const std::int32_t, const std::int32_t);
+
+        void set_portal_open(const std::size_t, const bool);
+        void set_all_open(const bool);
+
+        std::int32_t get_num_areas() const
+        {
+            return m_num_areas;
+        }
+
+        std::size_t get_num_portals() const
+        {
+            return m_portals.size();
+        }
+
+        bool is_portal_open(const std::size_t portal) const
+        {
+            return m_portals.at(portal).open;
+        }
+
+        bool are_connected(const std::int32_t, const std::int32_t) const;
+
+        // Writes one bit per area, set for the areas connected to `area`
+        // (CM_WriteAreaBits). All bits are set for a negative area, i.e. a
+        // point outside the map.
+        void write_area_bits(const std::int32_t,
+                std::vector<std::uint8_t>*) const;
+
+    private:
+        struct Portal
+        {
+            std::int32_t    areas[2];
+            bool            open;
+        };
+
+        std::int32_t                m_num_areas;
+        std::vector<Portal>         m_portals;
+        std::vector<std::int32_t>   m_floods;   // Component of each area.
+
+        void flood();
+};
+
+#endif
@@ -0,0 +1,970 @@
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <iomanip>
+#include <thread>
+#include <cstdint>
+
+#include <GL/glu.h>
+
+#include "src/bench.h"
+#include "src/bsp.h"
+#include "src/cluster_vis.h"
+#include "src/exception.h"
+#include "src/image.h"
+#include "src/mipmap.h"
+#include "src/stats.h"
+#include "src/thread_pool.h"
+#include "src/texture.h"
+#include "src/texture_loader.h"
+#include "src/time.h"
+#include "src/math/util.h"
+
+namespace
+{
+    // Runs `func` in batches of at least `min_ticks` and returns the ticks
+    // per call of the fastest of three batches.
+    template <class F>
+    double ticks_per_call(F&& func, const std::int64_t min_ticks =
+            TICKS_PER_SECOND / 10)
+    {
+        double best = 0.0;
+        for (int batch = 0; batch < 3; ++batch) {
+            std::uint64_t calls = 0;
+            const std::int64_t start = get_ticks();
+            std::int64_t elapsed;
+            do {
+                func();
+                ++calls;
+                elapsed = get_ticks() - start;
+            } while (elapsed < min_ticks);
+            const double t = elapsed / double(calls);
+            if (batch == 0 || t < best) {
+                best = t;
+            }
+        }
+        return best;
+    }
+
+    double ticks_to_nsec(const double ticks)
+    {
+        return ticks * (1000000000.0 / TICKS_PER_SECOND);
+    }
+
+    void leaf_aabb(const DLeaf_t& leaf, vec3* min, vec3* max)
+    {
+        *min = vec3(leaf.mins[0], leaf.mins[1], leaf.mins[2]);
+        *max = vec3(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2]);
+    }
+
+    // Keeps the optimizer from discarding benchmark results.
+    volatile std::uint64_t g_sink;
+}
+
+void MapBench::run(std::ostream& os) const
+{
+    os << std::fixed << std::setprecision(2);
+    bench_dedupe(os);
+    bench_visibility(os);
+    bench_pvs(os);
+    bench_find_leaf(os);
+    bench_frustum(os);
+    bench_cull_views(os);
+    bench_face_cull(os);
+    bench_occlusion(os);
+    bench_static_batches(os);
+    bench_textures(os);
+    bench_tga(os);
+    bench_mipmaps(os);
+    bench_lightmaps(os);
+}
+
+// Removing duplicate faces from the leaf face lists of a cluster's PVS, with
+// sort + unique versus per-face frame stamps.
+void MapBench::bench_dedupe(std::ostream& os) const
+{
+    using face_index_vec_t = MapBSP46::face_index_vec_t;
+
+    const std::int32_t num_clusters = m_map.m_vis_data.num_bitsets;
+    const std::int32_t step = std::max(num_clusters / 64, 1);
+    std::vector<face_index_vec_t> inputs;
+    std::size_t total_faces = 0;
+    for (std::int32_t cluster = 0; cluster < num_clusters; cluster += step) {
+        const ClusterVisSet vis = m_map.build_cluster_vis(cluster);
+        inputs.emplace_back(vis.faces.cbegin(), vis.faces.cend());
+        total_faces += vis.faces.size();
+    }
+    if (total_faces == 0) {
+        os << "dedupe: no visible faces" << std::endl;
+        return;
+    }
+
+    face_index_vec_t scratch;
+    const double sort_ticks = ticks_per_call([&]() {
+        for (auto&& input : inputs) {
+            scratch.assign(input.cbegin(), input.cend());
+            std::sort(scratch.begin(), scratch.end());
+            auto end = std::unique(scratch.begin(), scratch.end());
+            g_sink = g_sink + static_cast<std::uint64_t>(end - scratch.begin());
+        }
+    });
+
+    std::vector<std::uint32_t> stamps(m_map.m_faces.size(), 0);
+    std::uint32_t stamp = 0;
+    const double stamp_ticks = ticks_per_call([&]() {
+        for (auto&& input : inputs) {
+            scratch.clear();
+            if (++stamp == 0) {
+                std::fill(stamps.begin(), stamps.end(), 0);
+                stamp = 1;
+            }
+            for (auto face_index : input) {
+                if (stamps[face_index] != stamp) {
+                    stamps[face_index] = stamp;
+                    scratch.push_back(face_index);
+                }
+            }
+            g_sink = g_sink + scratch.size();
+        }
+    });
+
+    os << "dedupe: " << inputs.size() << " clusters, " <<
+        total_faces / inputs.size() << " leaf faces per cluster" << std::endl;
+    os << "  sort + unique: " << ticks_to_nsec(sort_ticks) / total_faces <<
+        " ns/face" << std::endl;
+    os << "  frame stamps:  " << ticks_to_nsec(stamp_ticks) / total_faces <<
+        " ns/face (" << sort_ticks / stamp_ticks << "x)" << std::endl;
+}
+
+// Getting the visible leaves and faces of the camera's cluster each frame,
+// built from the PVS every time versus looked up in a ClusterVisCache of
+// the size the map uses, with the cameras cycling through the clusters of
+// make_cameras(). The faces of each set are walked to keep both honest.
+void MapBench::bench_pvs(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty() || m_map.m_vis_bitset.empty()) {
+        os << "pvs: no clusters with faces" << std::endl;
+        return;
+    }
+    const auto walk = [](const ClusterVisSet& vis) {
+        std::uint64_t sum = vis.leaves.size();
+        for (auto face_index : vis.faces) {
+            sum += face_index;
+        }
+        g_sink = g_sink + sum;
+        return vis.faces.size();
+    };
+
+    std::size_t total_faces = 0;
+    const double build_ticks = ticks_per_call([&]() {
+        total_faces = 0;
+        for (auto&& camera : cameras) {
+            total_faces += walk(m_map.build_cluster_vis(camera.cluster));
+        }
+    });
+
+    ClusterVisCache cache(m_map.m_cluster_vis_cache.get_capacity());
+    const double cache_ticks = ticks_per_call([&]() {
+        for (auto&& camera : cameras) {
+            const ClusterVisSet* vis = cache.find(camera.cluster);
+            if (!vis) {
+                vis = &cache.insert(camera.cluster,
+                        m_map.build_cluster_vis(camera.cluster));
+            }
+            walk(*vis);
+        }
+    });
+
+    const std::uint64_t lookups = cache.get_hits() + cache.get_misses();
+    os << "pvs: " << cameras.size() << " cameras, " <<
+        total_faces / cameras.size() << " leaf faces/camera" << std::endl;
+    os << "  built per frame: " <<
+        ticks_to_nsec(build_ticks) / cameras.size() << " ns/camera" <<
+        std::endl;
+    os << "  cached:          " <<
+        ticks_to_nsec(cache_ticks) / cameras.size() << " ns/camera (" <<
+        build_ticks / cache_ticks << "x), " <<
+        100.0 * cache.get_hits() / std::max<std::uint64_t>(lookups, 1) <<
+        "% hits" << std::endl;
+}
+
+// Cameras looking in four directions from the center of a sample of the
+// clusters with faces, with the projection of the viewer's window.
+std::vector<MapBench::Camera> MapBench::make_cameras() const
+{
+    mat4 projection;
+    mat4_perspective(projection, 75.0f, 1440.0f / 800.0f, 4.0f, 15000.0f);
+
+    std::vector<Camera> cameras;
+    const auto num_clusters =
+        static_cast<std::int32_t>(m_map.m_clusters.size());
+    const std::int32_t step = std::max(num_clusters / 64, 1);
+    for (std::int32_t cluster = 0; cluster < num_clusters; cluster += step) {
+        const auto& c = m_map.m_clusters[static_cast<std::size_t>(cluster)];
+        if (c.num_leaves == 0 || c.mins.x > c.maxs.x) {
+            continue;
+        }
+        const vec3 center = (c.mins + c.maxs) * 0.5f;
+        for (int i = 0; i < 4; ++i) {
+            mat4 mdir;
+            mat4_rotate_y(mdir, 90.0f * i);
+            mat4 mat;
+            mat4_translate(mat, -center.x, -center.y, -center.z);
+            cameras.push_back(Camera{cluster, center,
+                    Frustum<float>(projection, mat * mdir)});
+        }
+    }
+    return cameras;
+}
+
+// Gathering the potentially visible leaves of a camera and testing them
+// against its frustum, one leaf at a time in file order (the layout before
+// leaves were sorted by cluster) versus cluster ranges behind a test of the
+// cluster bounds.
+void MapBench::bench_visibility(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty() || m_map.m_vis_bitset.empty()) {
+        os << "visibility: no clusters with faces" << std::endl;
+        return;
+    }
+    const auto num_clusters =
+        static_cast<std::int32_t>(m_map.m_clusters.size());
+
+    const auto is_visible = [this](const std::int32_t from,
+            const std::int32_t to) {
+        const auto n = static_cast<std::size_t>(from *
+                m_map.m_vis_data.bytes_per_cluster + (to >> 3));
+        return (m_map.m_vis_bitset[n] & (1 << (to & 7))) != 0;
+    };
+
+    vec3 box_min, box_max;
+    std::uint64_t leaf_visible = 0;
+    const double leaf_ticks = ticks_per_call([&]() {
+        leaf_visible = 0;
+        for (auto&& camera : cameras) {
+            for (auto leaf_index : m_map.m_leaf_remap) {
+                const DLeaf_t& leaf = m_map.m_leaves[leaf_index];
+                if (leaf.num_leaf_faces == 0 || leaf.cluster < 0 ||
+                        !is_visible(camera.cluster, leaf.cluster)) {
+                    continue;
+                }
+                leaf_aabb(leaf, &box_min, &box_max);
+                if (camera.frustum.is_aabb_visible(box_min, box_max)) {
+                    ++leaf_visible;
+                }
+            }
+        }
+        g_sink = g_sink + leaf_visible;
+    });
+
+    std::uint64_t cluster_visible = 0;
+    const double cluster_ticks = ticks_per_call([&]() {
+        cluster_visible = 0;
+        for (auto&& camera : cameras) {
+            for (std::int32_t i = 0; i < num_clusters; ++i) {
+                const auto& c = m_map.m_clusters[static_cast<std::size_t>(i)];
+                if (!is_visible(camera.cluster, i) ||
+                        !camera.frustum.is_aabb_visible(c.mins, c.maxs)) {
+                    continue;
+                }
+                for (auto j = c.first_leaf; j < c.first_leaf + c.num_leaves;
+                        ++j) {
+                    const DLeaf_t& leaf = m_map.m_leaves[j];
+                    if (leaf.num_leaf_faces == 0) {
+                        continue;
+                    }
+                    leaf_aabb(leaf, &box_min, &box_max);
+                    if (camera.frustum.is_aabb_visible(box_min, box_max)) {
+                        ++cluster_visible;
+                    }
+                }
+            }
+        }
+        g_sink = g_sink + cluster_visible;
+    });
+
+    os << "visibility: " << cameras.size() << " cameras, " <<
+        m_map.m_leaves.size() << " leaves, " << num_clusters << " clusters" <<
+        std::endl;
+    os << "  per leaf:    " << ticks_to_nsec(leaf_ticks) / cameras.size() <<
+        " ns/camera, " << leaf_visible / cameras.size() <<
+        " visible leaves/camera" << std::endl;
+    os << "  per cluster: " << ticks_to_nsec(cluster_ticks) / cameras.size() <<
+        " ns/camera, " << cluster_visible / cameras.size() <<
+        " visible leaves/camera (" << leaf_ticks / cluster_ticks << "x)" <<
+        std::endl;
+}
+
+// Point location with the node and plane lumps as loaded versus the
+// compiled depth-first nodes, for random points within the world bounds.
+void MapBench::bench_find_leaf(std::ostream& os) const
+{
+    const std::size_t num_queries = 1000000;
+    if (m_map.m_node_bounds.empty()) {
+        os << "find_leaf: no nodes" << std::endl;
+        return;
+    }
+
+    const auto& world = m_map.m_node_bounds.front();
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> x(world.mins.x, world.maxs.x);
+    std::uniform_real_distribution<float> y(world.mins.y, world.maxs.y);
+    std::uniform_real_distribution<float> z(world.mins.z, world.maxs.z);
+    std::vector<vec3> points;
+    points.reserve(num_queries);
+    for (std::size_t i = 0; i < num_queries; ++i) {
+        points.emplace_back(x(rng), y(rng), z(rng));
+    }
+
+    std::vector<const DLeaf_t*> lump_leaves(num_queries);
+    const double lump_ticks = ticks_per_call([&]() {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            std::int32_t index = 0;
+            while (index >= 0) {
+                const DNode_t& node = m_map.m_nodes[
+                    static_cast<std::size_t>(index)];
+                const DPlane_t& plane = m_map.m_planes[
+                    static_cast<std::size_t>(node.plane)];
+                vec3 v(plane.normal[0], plane.normal[1], plane.normal[2]);
+                index = v.dot(points[i]) - plane.dist >= 0.0f ?
+                    node.front : node.back;
+            }
+            lump_leaves[i] = &m_map.m_leaves[static_cast<std::size_t>(~index)];
+        }
+    });
+
+    std::vector<const DLeaf_t*> compiled_leaves(num_queries);
+    const double compiled_ticks = ticks_per_call([&]() {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            compiled_leaves[i] = &m_map.find_leaf(points[i]);
+        }
+    });
+
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < num_queries; ++i) {
+        if (lump_leaves[i] != compiled_leaves[i]) {
+            ++mismatches;
+        }
+    }
+
+    os << "find_leaf: " << num_queries << " random points, " <<
+        m_map.m_nodes.size() << " nodes, " << mismatches << " mismatches" <<
+        std::endl;
+    os << "  lump nodes:     " << ticks_to_nsec(lump_ticks) / num_queries <<
+        " ns/query" << std::endl;
+    os << "  compiled nodes: " << ticks_to_nsec(compiled_ticks) / num_queries <<
+        " ns/query (" << lump_ticks / compiled_ticks << "x)" << std::endl;
+}
+
+// Frustum tests of every node and leaf box, eight corners per plane versus
+// the p-vertex test, and how many of the tests a full traversal of the node
+// tree skips by passing plane masks down.
+void MapBench::bench_frustum(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty()) {
+        os << "frustum: no clusters with faces" << std::endl;
+        return;
+    }
+
+    std::vector<vec3> boxes;
+    for (auto&& bounds : m_map.m_node_bounds) {
+        boxes.push_back(bounds.mins);
+        boxes.push_back(bounds.maxs);
+    }
+    vec3 box_min, box_max;
+    for (auto&& leaf : m_map.m_leaves) {
+        leaf_aabb(leaf, &box_min, &box_max);
+        boxes.push_back(box_min);
+        boxes.push_back(box_max);
+    }
+    const std::size_t num_boxes = boxes.size() / 2;
+    const double num_tests = double(num_boxes) * cameras.size();
+
+    std::uint64_t corner_visible = 0;
+    const double corner_ticks = ticks_per_call([&]() {
+        corner_visible = 0;
+        for (auto&& camera : cameras) {
+            for (std::size_t i = 0; i < boxes.size(); i += 2) {
+                if (camera.frustum.is_aabb_visible(boxes[i], boxes[i + 1])) {
+                    ++corner_visible;
+                }
+            }
+        }
+        g_sink = g_sink + corner_visible;
+    });
+
+    std::uint64_t pvertex_visible = 0;
+    const double pvertex_ticks = ticks_per_call([&]() {
+        pvertex_visible = 0;
+        for (auto&& camera : cameras) {
+            for (std::size_t i = 0; i < boxes.size(); i += 2) {
+                unsigned plane_mask = frustum_all_planes;
+                if (camera.frustum.is_aabb_visible(boxes[i], boxes[i + 1],
+                            &plane_mask)) {
+                    ++pvertex_visible;
+                }
+            }
+        }
+        g_sink = g_sink + pvertex_visible;
+    });
+
+    // Walks the tree down to the leaves, counting the boxes reached and the
+    // ones that still needed a test.
+    std::uint64_t reached = 0;
+    std::uint64_t tested = 0;
+    std::vector<std::pair<std::int32_t, unsigned>> stack;
+    for (auto&& camera : cameras) {
+        stack.emplace_back(0, frustum_all_planes);
+        while (!stack.empty()) {
+            const std::int32_t index = stack.back().first;
+            unsigned plane_mask = stack.back().second;
+            stack.pop_back();
+            ++reached;
+            tested += plane_mask != 0;
+            if (index < 0) {
+                continue;
+            }
+            const auto& bounds =
+                m_map.m_node_bounds[static_cast<std::size_t>(index)];
+            if (camera.frustum.is_aabb_visible(bounds.mins, bounds.maxs,
+                        &plane_mask)) {
+                const auto& node =
+                    m_map.m_traversal_nodes[static_cast<std::size_t>(index)];
+                stack.emplace_back(node.children[1], plane_mask);
+                stack.emplace_back(node.children[0], plane_mask);
+            }
+        }
+    }
+
+    const double corner_rate = num_tests / ticks_to_nsec(corner_ticks) * 1000.0;
+    const double pvertex_rate =
+        num_tests / ticks_to_nsec(pvertex_ticks) * 1000.0;
+    os << "frustum: " << cameras.size() << " cameras, " << num_boxes <<
+        " boxes" << std::endl;
+    os << "  8 corners: " << corner_rate << " M boxes/sec, " <<
+        corner_visible << " visible" << std::endl;
+    os << "  p-vertex:  " << pvertex_rate << " M boxes/sec, " <<
+        pvertex_visible << " visible (" << corner_ticks / pvertex_ticks <<
+        "x)" << std::endl;
+    os << "  traversal: " << reached / cameras.size() <<
+        " boxes reached/camera, " << tested / cameras.size() <<
+        " tested with plane masks" << std::endl;
+}
+
+// Culling the six faces of a cube map around each camera position, with one
+// traversal per face versus a single traversal for all of them.
+void MapBench::bench_cull_views(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty()) {
+        os << "cull_views: no clusters with faces" << std::endl;
+        return;
+    }
+
+    mat4 projection;
+    mat4_perspective(projection, 90.0f, 1.0f, 4.0f, 15000.0f);
+    static const float face_angles[6][2] = {
+        { 0.0f, 0.0f }, { 90.0f, 0.0f }, { 180.0f, 0.0f }, { 270.0f, 0.0f },
+        { 0.0f, 90.0f }, { 0.0f, -90.0f }
+    };
+    std::vector<std::vector<Frustum<float>>> cube_maps;
+    for (std::size_t i = 0; i < cameras.size(); i += 4) {
+        const vec3& position = cameras[i].position;
+        std::vector<Frustum<float>> faces;
+        for (auto&& angles : face_angles) {
+            mat4 mdir;
+            mat4_rotate_y(mdir, angles[0]);
+            mat4_rotate_x(mdir, angles[1]);
+            mat4 mat;
+            mat4_translate(mat, -position.x, -position.y, -position.z);
+            faces.emplace_back(projection, mat * mdir);
+        }
+        cube_maps.push_back(std::move(faces));
+    }
+
+    std::vector<MapBSP46::leaf_ptr_vec_t> leaf_ptrs;
+    std::vector<MapBSP46::leaf_ptr_vec_t> face_leaf_ptrs;
+    std::vector<Frustum<float>> face;
+    std::uint64_t separate_leaves = 0;
+    const double separate_ticks = ticks_per_call([&]() {
+        separate_leaves = 0;
+        for (auto&& faces : cube_maps) {
+            for (auto&& frustum : faces) {
+                face.assign(1, frustum);
+                m_map.cull_views(face, &face_leaf_ptrs);
+                separate_leaves += face_leaf_ptrs[0].size();
+            }
+        }
+        g_sink = g_sink + separate_leaves;
+    });
+
+    std::uint64_t shared_leaves = 0;
+    const double shared_ticks = ticks_per_call([&]() {
+        shared_leaves = 0;
+        for (auto&& faces : cube_maps) {
+            m_map.cull_views(faces, &leaf_ptrs);
+            for (auto&& view_leaf_ptrs : leaf_ptrs) {
+                shared_leaves += view_leaf_ptrs.size();
+            }
+        }
+        g_sink = g_sink + shared_leaves;
+    });
+
+    os << "cull_views: " << cube_maps.size() << " cube maps" << std::endl;
+    os << "  one traversal per face: " <<
+        ticks_to_nsec(separate_ticks) / 1000.0 / cube_maps.size() <<
+        " usec/cube map, " << separate_leaves / cube_maps.size() <<
+        " leaves" << std::endl;
+    os << "  one traversal in all:   " <<
+        ticks_to_nsec(shared_ticks) / 1000.0 / cube_maps.size() <<
+        " usec/cube map, " << shared_leaves / cube_maps.size() <<
+        " leaves (" << separate_ticks / shared_ticks << "x)" << std::endl;
+}
+
+// Faces of the visible leaves that per-face frustum and normal cone tests
+// remove before submission, and what the tests cost.
+void MapBench::bench_face_cull(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty() || m_map.m_vis_bitset.empty()) {
+        os << "face_cull: no clusters with faces" << std::endl;
+        return;
+    }
+
+    std::vector<MapBSP46::face_index_vec_t> queues;
+    for (auto&& camera : cameras) {
+        FrameStats stats;
+        m_map.begin_face_queue();
+        m_map.queue_cluster_vis(m_map.get_cluster_vis(camera.cluster),
+                camera.frustum, nullptr, nullptr, &stats);
+        queues.push_back(m_map.m_draw_queue);
+    }
+
+    FrameStats stats;
+    std::size_t queued = 0;
+    const double cull_ticks = ticks_per_call([&]() {
+        stats = FrameStats();
+        queued = 0;
+        for (std::size_t i = 0; i < cameras.size(); ++i) {
+            m_map.m_draw_queue = queues[i];
+            queued += queues[i].size();
+            m_map.cull_queued_faces(cameras[i].position, cameras[i].frustum,
+                    &stats);
+        }
+    });
+
+    const std::uint64_t culled = stats.get(STAT_FACES_CULLED);
+    const std::uint64_t backfacing = stats.get(STAT_FACES_BACKFACING);
+    os << "face_cull: " << cameras.size() << " cameras, " <<
+        queued / cameras.size() << " faces in visible leaves/camera" <<
+        std::endl;
+    os << "  outside frustum: " << culled / cameras.size() << "/camera" <<
+        std::endl;
+    os << "  backfacing:      " << backfacing / cameras.size() << "/camera" <<
+        std::endl;
+    os << "  submitted:       " <<
+        (queued - culled - backfacing) / cameras.size() << "/camera (" <<
+        100.0 * (queued - culled - backfacing) / queued << "%), " <<
+        ticks_to_nsec(cull_ticks) / queued << " ns/face" << std::endl;
+}
+
+// Occlusion culling of the leaves in each camera's frustum: the cost of
+// picking and rasterizing the occluders on one thread and on all of them,
+// and the share of leaves and faces it removes.
+void MapBench::bench_occlusion(std::ostream& os) const
+{
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty() || m_map.m_vis_bitset.empty()) {
+        os << "occlusion: no clusters with faces" << std::endl;
+        return;
+    }
+
+    ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    ThreadPool* const pools[2] = { nullptr, &pool };
+    double render_ticks[2];
+    for (int i = 0; i < 2; ++i) {
+        render_ticks[i] = ticks_per_call([&]() {
+            FrameStats stats;
+            for (auto&& camera : cameras) {
+                m_map.render_occluders(camera.position,
+                        m_map.get_cluster_vis(camera.cluster), camera.frustum,
+                        pools[i], &stats);
+            }
+        });
+    }
+
+    FrameStats plain, culled;
+    std::size_t plain_faces = 0;
+    std::size_t culled_faces = 0;
+    for (auto&& camera : cameras) {
+        const ClusterVisSet& vis = m_map.get_cluster_vis(camera.cluster);
+        m_map.begin_face_queue();
+        m_map.queue_cluster_vis(vis, camera.frustum, nullptr, nullptr,
+                &plain);
+        plain_faces += m_map.m_draw_queue.size();
+
+        const OcclusionBuffer* occlusion = m_map.render_occluders(
+                camera.position, vis, camera.frustum, &pool, &culled);
+        m_map.begin_face_queue();
+        m_map.queue_cluster_vis(vis, camera.frustum, nullptr, occlusion,
+                &culled);
+        culled_faces += m_map.m_draw_queue.size();
+        plain.add(STAT_LEAVES_IN_PVS, vis.leaves.size());
+    }
+
+    const std::uint64_t in_frustum = plain.get(STAT_LEAVES_IN_PVS) -
+        plain.get(STAT_LEAVES_CULLED);
+    const std::uint64_t occluded = culled.get(STAT_LEAVES_OCCLUDED);
+    os << "occlusion: " << cameras.size() << " cameras, " <<
+        culled.get(STAT_OCCLUDERS) / cameras.size() << " occluders/camera" <<
+        std::endl;
+    os << "  occluders, 1 thread:  " <<
+        ticks_to_nsec(render_ticks[0]) / 1000.0 / cameras.size() <<
+        " us/camera" << std::endl;
+    os << "  occluders, " << pool.get_num_threads() << " threads: " <<
+        ticks_to_nsec(render_ticks[1]) / 1000.0 / cameras.size() <<
+        " us/camera" << std::endl;
+    os << "  leaves occluded:      " << occluded << "/" << in_frustum <<
+        " in frustum (" << (in_frustum ? 100.0 * occluded / in_frustum :
+                0.0) << "%), " << culled.get(STAT_CLUSTERS_OCCLUDED) <<
+        " whole clusters" << std::endl;
+    os << "  faces queued:         " << culled_faces / cameras.size() <<
+        "/camera, down from " << plain_faces / cameras.size() << std::endl;
+}
+
+// Each camera's view from the static batches versus face by face: the cost
+// of culling either way, the draw calls and state changes they lead to, and
+// the memory the batches take.
+void MapBench::bench_static_batches(std::ostream& os) const
+{
+    const MapBSP46::StaticBatches& sb = m_map.m_static_batches;
+    if (sb.list_offsets.empty()) {
+        os << "static_batches: not built (run with -S -B)" << std::endl;
+        return;
+    }
+    const std::vector<Camera> cameras = make_cameras();
+    if (cameras.empty() || m_map.m_vis_bitset.empty()) {
+        os << "static_batches: no clusters with faces" << std::endl;
+        return;
+    }
+
+    const auto cull_faces = [this](const Camera& camera) {
+        FrameStats stats;
+        m_map.begin_face_queue();
+        m_map.queue_cluster_vis(m_map.get_cluster_vis(camera.cluster),
+                camera.frustum, nullptr, nullptr, &stats);
+        m_map.cull_queued_faces(camera.position, camera.frustum, &stats);
+        m_map.group_queued_faces();
+    };
+    MapBSP46::DrawList list;
+    const auto cull_batches = [this, &list](const Camera& camera) {
+        list.batch_runs.clear();
+        list.batch_counts.clear();
+        list.batch_offsets.clear();
+        list.stats = FrameStats();
+        m_map.begin_face_queue();
+        m_map.queue_static_batches(camera.cluster, camera.frustum, nullptr,
+                nullptr, &list);
+        m_map.cull_queued_faces(camera.position, camera.frustum, &list.stats);
+        m_map.group_queued_faces();
+    };
+
+    const double face_ticks = ticks_per_call([&]() {
+        for (auto&& camera : cameras) {
+            cull_faces(camera);
+        }
+    });
+    const double batch_ticks = ticks_per_call([&]() {
+        for (auto&& camera : cameras) {
+            cull_batches(camera);
+        }
+    });
+
+    std::uint64_t face_calls = 0, face_states = 0;
+    std::uint64_t batch_calls = 0, batch_states = 0, batches = 0;
+    for (auto&& camera : cameras) {
+        cull_faces(camera);
+        face_calls += m_map.m_draw_queue.size();
+        face_states += m_map.m_batch_offsets.size();
+        cull_batches(camera);
+        batch_calls += list.batch_runs.size() + m_map.m_draw_queue.size();
+        batch_states += list.batch_runs.size() +
+            m_map.m_batch_offsets.size();
+        batches += list.batch_counts.size();
+    }
+
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    os << "static_batches: " << cameras.size() << " cameras, " <<
+        sb.batches.size() << " batches, " <<
+        m_map.m_vertices.size() * sizeof(DVertex_t) * mb << " MB vertices + " <<
+        sb.num_indices * sizeof(GLuint) * mb << " MB indices + " <<
+        sb.get_list_bytes() * mb << " MB lists" << std::endl;
+    os << "  face by face: " << ticks_to_nsec(face_ticks) / 1000.0 /
+        cameras.size() << " us/camera, " << face_calls / cameras.size() <<
+        " draw calls, " << face_states / cameras.size() << " states" <<
+        std::endl;
+    os << "  batches:      " << ticks_to_nsec(batch_ticks) / 1000.0 /
+        cameras.size() << " us/camera, " << batch_calls / cameras.size() <<
+        " draw calls, " << batch_states / cameras.size() << " states, " <<
+        batches / cameras.size() << " ranges" << std::endl;
+}
+
+// Reading, decoding and building the mipmaps of the map's textures on one
+// thread and on all of them, without uploading. With compression enabled,
+// that includes compressing them or reading them from the cache.
+void MapBench::bench_textures(std::ostream& os) const
+{
+    std::vector<std::string> names;
+    for (auto&& texture : m_map.m_textures) {
+        names.emplace_back(texture.name);
+    }
+
+    ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    ThreadPool* const pools[2] = { nullptr, &pool };
+    std::int64_t ticks[2];
+    std::size_t num_decoded = 0;
+    std::uint64_t num_bytes = 0;
+    for (int i = 0; i < 2; ++i) {
+        num_decoded = 0;
+        num_bytes = 0;
+        const std::int64_t start = get_ticks();
+        decode_textures(names, m_pak, pools[i],
+                [&](const std::size_t, const LoadedTexture& texture) {
+                    ++num_decoded;
+                    num_bytes += texture.get_bytes();
+                });
+        ticks[i] = get_ticks() - start;
+    }
+
+    os << "textures: " << num_decoded << "/" << names.size() <<
+        " decoded, " << num_bytes / (1024.0 * 1024.0) <<
+        " MB with mipmaps" << std::endl;
+    os << "  1 thread:  " << ticks_to_nsec(double(ticks[0])) / 1000000.0 <<
+        " ms" << std::endl;
+    os << "  " << pool.get_num_threads() << " threads: " <<
+        ticks_to_nsec(double(ticks[1])) / 1000000.0 << " ms (" <<
+        double(ticks[0]) / std::max<std::int64_t>(ticks[1], 1) << "x)" <<
+        std::endl;
+}
+
+// Decoding the map's TGA textures straight into their images versus through
+// an SDL_image surface, of the TGAs the native decoder takes, along with the
+// bytes of the surfaces it does without.
+void MapBench::bench_tga(std::ostream& os) const
+{
+    std::vector<std::vector<std::uint8_t>> files;
+    std::size_t num_tga = 0;
+    for (auto&& texture : m_map.m_textures) {
+        const std::string filename = texture.name + std::string(".tga");
+        auto maybe_data = m_pak.read_file(filename.c_str());
+        if (!maybe_data) {
+            continue;
+        }
+        ++num_tga;
+        Image image;
+        try {
+            if (decode_tga_native(maybe_data.value(), &image)) {
+                files.push_back(std::move(maybe_data.value()));
+            }
+        }
+        catch (const QException&) {
+        }
+    }
+    if (files.empty()) {
+        os << "tga: no TGA textures the native decoder takes" << std::endl;
+        return;
+    }
+
+    std::uint64_t image_bytes = 0;
+    const double native_ticks = ticks_per_call([&]() {
+        image_bytes = 0;
+        for (auto&& file : files) {
+            Image image;
+            decode_tga_native(file, &image);
+            image_bytes += image.get_pixels().size() * sizeof(pixel_t);
+        }
+        g_sink = g_sink + image_bytes;
+    });
+
+    std::size_t surface_bytes = 0;
+    const double sdl_ticks = ticks_per_call([&]() {
+        surface_bytes = 0;
+        for (auto&& file : files) {
+            const Image image = decode_tga_sdl(file, &surface_bytes);
+            g_sink = g_sink + image.get_width();
+        }
+    });
+
+    const double mb = 1024.0 * 1024.0;
+    const double n = static_cast<double>(files.size());
+    os << "tga: " << files.size() << "/" << num_tga << " TGAs decoded " <<
+        "natively, " << image_bytes / mb << " MB of images" << std::endl;
+    os << "  SDL_image: " << ticks_to_nsec(sdl_ticks) / n / 1000.0 <<
+        " us/texture, " << surface_bytes / mb << " MB of surfaces" <<
+        std::endl;
+    os << "  native:    " << ticks_to_nsec(native_ticks) / n / 1000.0 <<
+        " us/texture (" << sdl_ticks / native_ticks << "x), no surfaces" <<
+        std::endl;
+}
+
+// Mipmaps of the map's textures from gluBuild2DMipmaps, which builds them
+// on the CPU and uploads them, versus each of our filters alone and with
+// the upload of every level.
+void MapBench::bench_mipmaps(std::ostream& os) const
+{
+    std::vector<Image> images;
+    for (auto&& texture : m_map.m_textures) {
+        mip_chain_t levels;
+        if (decode_texture(texture.name, m_pak, &levels)) {
+            images.push_back(std::move(levels[0]));
+        }
+    }
+    if (images.empty()) {
+        os << "mipmaps: no textures decoded" << std::endl;
+        return;
+    }
+
+    const auto pixels = [](const Image& image) {
+        return reinterpret_cast<const std::uint8_t*>(
+                image.get_pixels().data());
+    };
+    const auto upload = [](const mip_chain_t& levels) {
+        for (std::size_t i = 0; i < levels.size(); ++i) {
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), GL_RGBA,
+                    static_cast<GLsizei>(levels[i].get_width()),
+                    static_cast<GLsizei>(levels[i].get_height()), 0,
+                    GL_RGBA, GL_UNSIGNED_BYTE, levels[i].get_pixels().data());
+        }
+    };
+
+    GLuint texture_id;
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    const double glu_ticks = ticks_per_call([&]() {
+        for (auto&& image : images) {
+            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA,
+                    static_cast<GLsizei>(image.get_width()),
+                    static_cast<GLsizei>(image.get_height()), GL_RGBA,
+                    GL_UNSIGNED_BYTE, pixels(image));
+        }
+        glFinish();
+    });
+    const double n = static_cast<double>(images.size());
+    os << "mipmaps: " << images.size() << " textures" << std::endl;
+    os << "  gluBuild2DMipmaps:    " << ticks_to_nsec(glu_ticks) / 1000.0 / n <<
+        " us/texture with upload" << std::endl;
+
+    static const char* const names[4] = {
+        "box", "box, gamma", "kaiser", "kaiser, gamma"
+    };
+    for (int i = 0; i < 4; ++i) {
+        MipOptions options;
+        options.filter = i < 2 ? MIP_FILTER_BOX : MIP_FILTER_KAISER;
+        options.gamma_correct = i % 2 == 1;
+        const double build_ticks = ticks_per_call([&]() {
+            for (auto&& image : images) {
+                g_sink = g_sink + build_mip_chain(image.get_width(),
+                        image.get_height(), pixels(image), options).size();
+            }
+        });
+        const double upload_ticks = ticks_per_call([&]() {
+            for (auto&& image : images) {
+                upload(build_mip_chain(image.get_width(), image.get_height(),
+                            pixels(image), options));
+            }
+            glFinish();
+        });
+        os << "  " << std::left << std::setw(20) << names[i] <<
+            std::right << ticks_to_nsec(build_ticks) / 1000.0 / n <<
+            " us/texture, " << ticks_to_nsec(upload_ticks) / 1000.0 / n <<
+            " with upload (" << glu_ticks / upload_ticks << "x)" << std::endl;
+    }
+    glDeleteTextures(1, &texture_id);
+}
+
+// The overbright conversion of lightmaps with each kernel the CPU runs,
+// first checked against the scalar one on every RGB color and on the map's
+// lightmaps, then timed on one thread and with the fastest kernel on all.
+void MapBench::bench_lightmaps(std::ostream& os) const
+{
+    static const char* const names[3] = { "scalar", "sse2", "avx2" };
+    const unsigned bits = LightmapTexture::get_overbright_bits();
+    const LightmapKernel best = get_lightmap_kernel();
+    const std::size_t texels = 128 * 128;
+    const auto& lightmaps = m_map.m_lightmaps;
+
+    std::vector<std::uint8_t> colors(256 * 256 * 3);
+    std::vector<std::uint8_t> expected(256 * 256 * 4);
+    std::vector<std::uint8_t> actual(256 * 256 * 4);
+    std::vector<char> identical(best + 1, 1);
+    for (unsigned red = 0; red < 256; ++red) {
+        for (std::size_t i = 0; i < 256 * 256; ++i) {
+            colors[3 * i] = static_cast<std::uint8_t>(red);
+            colors[3 * i + 1] = static_cast<std::uint8_t>(i >> 8);
+            colors[3 * i + 2] = static_cast<std::uint8_t>(i);
+        }
+        convert_lightmap_texels(colors.data(), expected.data(), 256 * 256,
+                bits, LIGHTMAP_KERNEL_SCALAR);
+        for (int k = 1; k <= best; ++k) {
+            convert_lightmap_texels(colors.data(), actual.data(), 256 * 256,
+                    bits, static_cast<LightmapKernel>(k));
+            identical[k] = identical[k] && actual == expected;
+        }
+    }
+    expected.resize(texels * 4);
+    actual.resize(texels * 4);
+    for (auto&& lightmap : lightmaps) {
+        convert_lightmap_texels(lightmap.map, expected.data(), texels, bits,
+                LIGHTMAP_KERNEL_SCALAR);
+        for (int k = 1; k <= best; ++k) {
+            convert_lightmap_texels(lightmap.map, actual.data(), texels,
+                    bits, static_cast<LightmapKernel>(k));
+            identical[k] = identical[k] && actual == expected;
+        }
+    }
+
+    os << "lightmaps: " << lightmaps.size() << " lightmaps, " << bits <<
+        " overbright bits" << std::endl;
+    if (lightmaps.empty()) {
+        return;
+    }
+    const double n = static_cast<double>(lightmaps.size());
+    double scalar_ticks = 0.0;
+    for (int k = 0; k <= best; ++k) {
+        const auto kernel = static_cast<LightmapKernel>(k);
+        const double ticks = ticks_per_call([&]() {
+            for (auto&& lightmap : lightmaps) {
+                convert_lightmap_texels(lightmap.map, actual.data(), texels,
+                        bits, kernel);
+            }
+            g_sink = g_sink + actual[0];
+        });
+        if (k == 0) {
+            scalar_ticks = ticks;
+        }
+        os << "  " << std::left << std::setw(8) << names[k] << std::right <<
+            ticks_to_nsec(ticks) / 1000.0 / n << " us/lightmap";
+        if (k > 0) {
+            os << " (" << scalar_ticks / ticks << "x), " <<
+                (identical[k] ? "identical" : "DIFFERENT") <<
+                " to scalar";
+        }
+        os << std::endl;
+    }
+
+    ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    std::vector<std::uint8_t> pixels(lightmaps.size() * texels * 4);
+    const double parallel_ticks = ticks_per_call([&]() {
+        pool.parallel_for(0, lightmaps.size(), [&](const std::size_t i) {
+            convert_lightmap_texels(lightmaps[i].map,
+                    pixels.data() + i * texels * 4, texels, bits, best);
+        });
+        g_sink = g_sink + pixels[0];
+    });
+    os << "  " << names[best] << " on " << pool.get_num_threads() <<
+        " threads: " << ticks_to_nsec(parallel_ticks) / 1000.0 <<
+        " us for all (" << scalar_ticks / parallel_ticks << "x)" << std::endl;
+}
@@ -0,0 +1,55 @@
+#ifndef Q3BSP__BENCH_H
+#define Q3BSP__BENCH_H
+
+#include <ostream>
+#include <vector>
+#include <cstdint>
+
+#include "src/math/util.h"
+
+class MapBSP46;
+class PAK3Archive;
+
+// Microbenchmarks of individual rendering stages, run against the data of
+// a loaded map.
+class MapBench
+{
+    public:
+        MapBench(const MapBSP46& map, const PAK3Archive& pak)
+            : m_map(map), m_pak(pak)
+        {}
+
+        MapBench(const MapBench&) = delete;
+        void operator=(const MapBench&) = delete;
+
+        void run(std::ostream&) const;
+
+    private:
+        const MapBSP46&     m_map;
+        const PAK3Archive&  m_pak;
+
+        struct Camera
+        {
+            std::int32_t        cluster;
+            vec3                position;
+            Frustum<float>      frustum;
+        };
+
+        std::vector<Camera> make_cameras() const;
+
+        void bench_dedupe(std::ostream&) const;
+        void bench_visibility(std::ostream&) const;
+        void bench_pvs(std::ostream&) const;
+        void bench_find_leaf(std::ostream&) const;
+        void bench_frustum(std::ostream&) const;
+        void bench_cull_views(std::ostream&) const;
+        void bench_face_cull(std::ostream&) const;
+        void bench_occlusion(std::ostream&) const;
+        void bench_static_batches(std::ostream&) const;
+        void bench_textures(std::ostream&) const;
+        void bench_tga(std::ostream&) const;
+        void bench_mipmaps(std::ostream&) const;
+        void bench_lightmaps(std::ostream&) const;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef Q3BSP__BOUNDED_QUEUE_H
+#define Q3BSP__BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+// FIFO of at most `capacity` items between threads: push() blocks while it
+// is full and pop() while it is empty. After close(), push() fails and
+// pop() fails once the items left have been taken.
+template <class T>
+class BoundedQueue
+{
+    public:
+        explicit BoundedQueue(const std::size_t capacity)
+            : m_capacity(capacity), m_closed(false)
+        {}
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        void operator=(const BoundedQueue&) = delete;
+
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [this] {
+                    return m_closed || m_items.size() < m_capacity; });
+            if (m_closed) {
+                return false;
+            }
+            m_items.push_back(std::move(item));
+            lock.unlock();
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        bool pop(T* item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this] {
+                    return m_closed || !m_items.empty(); });
+            if (m_items.empty()) {
+                return false;
+            }
+            *item = std::move(m_items.front());
+            m_items.pop_front();
+            lock.unlock();
+            m_not_full.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = true;
+            }
+            m_not_full.notify_all();
+            m_not_empty.notify_all();
+        }
+
+    private:
+        const std::size_t       m_capacity;
+        std::deque<T>           m_items;
+        bool                    m_closed;
+        std::mutex              m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+};
+
+#endif
@@ -1,14 +1,81 @@
 #include <algorithm>
+#include <numeric>
+#include <map>
+#include <string>
+#include <utility>
+#include <tuple>
+#include <limits>
 #include <iostream>
+#include <cmath>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include "src/bsp.h"
 #include "src/exception.h"
 #include "src/binio.h"
+#include "src/profile.h"
+#include "src/stats.h"
+#include "src/thread_pool.h"
+#include "src/texture_cache.h"
+#include "src/texture_loader.h"
+#include "src/texture_streamer.h"
+#include "src/time.h"
 #include "src/math/vector3.h"
 #include "src/math/util.h"
 
 namespace
 {
+    // Number of per-cluster visible sets kept around.
+    const std::size_t cluster_vis_cache_size = 64;
+
+    // Views cull_views() handles at once, one bit each.
+    const std::size_t max_cull_views = 32;
+
+    // Queues of at least `min_parallel_cull_faces` faces are culled on the
+    // thread pool in chunks of `face_cull_chunk_size`.
+    const std::size_t min_parallel_cull_faces = 4096;
+    const std::size_t face_cull_chunk_size = 1024;
+
+    // Key of the texture faces are drawn with until theirs is streamed in.
+    const char* const placeholder_texture_key = "#placeholder";
+
+    // Rows and columns each 3x3 piece of a bezier patch is divided into.
+    const unsigned patch_tessellation_steps = 7;
+
+    // Whether `area_bits`, if any, rule out the area. Leaves and clusters
+    // of no single area (-1) are never ruled out.
+    inline bool is_area_culled(const std::uint8_t* area_bits,
+            const std::int32_t area)
+    {
+        return area_bits && area >= 0 &&
+            !(area_bits[area >> 3] & (1 << (area & 7)));
+    }
+
+    // State id that no face has, for "nothing bound yet".
+    const std::uint32_t no_face_state = ~std::uint32_t(0);
+
+    // Size of the software depth buffer used for occlusion culling.
+    const int occlusion_width = 256;
+    const int occlusion_height = 128;
+
+    // Occluders are the largest faces in the PVS, relative to their distance
+    // to the camera, out of those at least `min_occluder_area` square units.
+    const std::size_t max_occluders = 64;
+    const float min_occluder_area = 64.0f * 64.0f;
+
+    // Content and surface flags of DTexture_t, from Quake III's
+    // surfaceflags.h.
+    const std::uint32_t contents_solid = 0x1;
+    const std::uint32_t contents_translucent = 0x20000000;
+    const std::uint32_t surf_sky = 0x4;
+    const std::uint32_t surf_nodraw = 0x80;
+
     void swizzle(float v[3])
     {
         float t = v[1];
@@ -35,6 +102,186 @@ namespace
         max->z = maxs[2];
     }
 
+    // Grows min/max to include the box with corners `a` and `b`. Swizzled
+    // boxes have their X bounds flipped, so the corners may be in any order.
+    void extend_aabb(const vec3& a, const vec3& b, vec3* min, vec3* max)
+    {
+        min->x = std::min({min->x, a.x, b.x});
+        min->y = std::min({min->y, a.y, b.y});
+        min->z = std::min({min->z, a.z, b.z});
+        max->x = std::max({max->x, a.x, b.x});
+        max->y = std::max({max->y, a.y, b.y});
+        max->z = std::max({max->z, a.z, b.z});
+    }
+
+    using entity_t = std::map<std::string, std::string>;
+
+    // Splits the entity lump, a list of { "key" "value" ... } blocks, into
+    // its entities.
+    std::vector<entity_t> parse_entities(const std::string& text)
+    {
+        std::size_t pos = 0;
+        // Returns '{', '}', '"' for a quoted string stored in *token, or 0
+        // at the end of the text.
+        const auto next_token = [&text, &pos](std::string* token) -> char {
+            while (pos < text.size() && (std::isspace(
+                            static_cast<unsigned char>(text[pos])) ||
+                        text[pos] == '\0')) {
+                ++pos;
+            }
+            if (pos == text.size()) {
+                return 0;
+            }
+            const char c = text[pos++];
+            if (c == '{' || c == '}') {
+                return c;
+            }
+            if (c != '"') {
+                throwf("Unexpected character in entity lump");
+            }
+            const std::size_t end = text.find('"', pos);
+            if (end == std::string::npos) {
+                throwf("Unterminated string in entity lump");
+            }
+            *token = text.substr(pos, end - pos);
+            pos = end + 1;
+            return c;
+        };
+
+        std::vector<entity_t> entities;
+        std::string key, value;
+        for (char c; (c = next_token(&key)) != 0; ) {
+            if (c != '{') {
+                throwf("Expected '{' in entity lump");
+            }
+            entity_t entity;
+            while ((c = next_token(&key)) == '"') {
+                if (next_token(&value) != '"') {
+                    throwf("Expected a value for \"%s\" in entity lump",
+                            key.c_str());
+                }
+                entity[key] = value;
+            }
+            if (c != '}') {
+                throwf("Expected '}' in entity lump");
+            }
+            entities.push_back(std::move(entity));
+        }
+        return entities;
+    }
+
+    // Bounds and visible-side normals of a face, gathered at load.
+    struct FaceShape
+    {
+        vec3                mins;
+        vec3                maxs;
+        std::vector<vec3>   normals;
+    };
+
+    void add_point(const float p[3], FaceShape* shape)
+    {
+        const vec3 v(p[0], p[1], p[2]);
+        extend_aabb(v, v, &shape->mins, &shape->maxs);
+    }
+
+    // Front faces are wound clockwise (see glFrontFace), so the visible side
+    // is the one opposite the right-handed normal of a, b, c.
+    void add_triangle(const float a[3], const float b[3], const float c[3],
+            FaceShape* shape)
+    {
+        vec3 n(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+        n.cross(vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+        if (n.normalize() > 0.0f) {
+            shape->normals.push_back(n * -1.0f);
+        }
+    }
+
+    // Adds the tessellated patch, as SimpleBezierSurface::draw draws it.
+    void add_patch(const DFace_t& face, const DVertex_t* const vertices,
+            FaceShape* shape)
+    {
+        DVertex_t controls[9];
+        for (int i = 0; i < face.m_max - 2; i += 2) {
+            for (int j = 0; j < face.n_max - 2; j += 2) {
+                for (int m = 0; m < 3; ++m) {
+                    for (int n = 0; n < 3; ++n) {
+                        controls[m * 3 + n] =
+                            vertices[(i + m) * face.n_max + (j + n)];
+                    }
+                }
+                SimpleBezierSurface surf(controls, patch_tessellation_steps);
+                const auto& v = surf.get_vertices();
+                for (auto&& vertex : v) {
+                    add_point(vertex.position, shape);
+                }
+                const unsigned size = surf.get_num_strips() + 1;
+                for (unsigned row = 0; row + 1 < size; ++row) {
+                    const DVertex_t* v1 = v.data() + row * size;
+                    const DVertex_t* v2 = v1 + size;
+                    for (unsigned col = 0; col + 1 < size; ++col) {
+                        add_triangle(v2[col].position, v1[col].position,
+                                v1[col + 1].position, shape);
+                        add_triangle(v2[col].position, v1[col + 1].position,
+                                v2[col + 1].position, shape);
+                    }
+                }
+            }
+        }
+    }
+
+    // Returns a bitmask of the four faces that may be facing the camera,
+    // given rows of box centers, normal cone axes and cone cosines, sines
+    // and offsets (see MapBSP46::FaceCullData).
+#ifdef __SSE__
+    unsigned test_face_cones(const vec3& camera, const float center[3][4],
+            const float axis[3][4], const float cone[3][4])
+    {
+        const __m128 vx = _mm_sub_ps(_mm_loadu_ps(center[0]),
+                _mm_set1_ps(camera.x));
+        const __m128 vy = _mm_sub_ps(_mm_loadu_ps(center[1]),
+                _mm_set1_ps(camera.y));
+        const __m128 vz = _mm_sub_ps(_mm_loadu_ps(center[2]),
+                _mm_set1_ps(camera.z));
+
+        __m128 dot = _mm_mul_ps(vx, _mm_loadu_ps(axis[0]));
+        dot = _mm_add_ps(dot, _mm_mul_ps(vy, _mm_loadu_ps(axis[1])));
+        dot = _mm_add_ps(dot, _mm_mul_ps(vz, _mm_loadu_ps(axis[2])));
+
+        __m128 length2 = _mm_mul_ps(vx, vx);
+        length2 = _mm_add_ps(length2, _mm_mul_ps(vy, vy));
+        length2 = _mm_add_ps(length2, _mm_mul_ps(vz, vz));
+        const __m128 cross = _mm_sqrt_ps(_mm_max_ps(
+                    _mm_sub_ps(length2, _mm_mul_ps(dot, dot)),
+                    _mm_setzero_ps()));
+
+        const __m128 away = _mm_sub_ps(
+                _mm_mul_ps(dot, _mm_loadu_ps(cone[0])),
+                _mm_mul_ps(cross, _mm_loadu_ps(cone[1])));
+        return ~static_cast<unsigned>(_mm_movemask_ps(
+                    _mm_cmpgt_ps(away, _mm_loadu_ps(cone[2])))) & 0xf;
+    }
+#else
+    unsigned test_face_cones(const vec3& camera, const float center[3][4],
+            const float axis[3][4], const float cone[3][4])
+    {
+        unsigned facing = 0;
+        for (int j = 0; j < 4; ++j) {
+            const float vx = center[0][j] - camera.x;
+            const float vy = center[1][j] - camera.y;
+            const float vz = center[2][j] - camera.z;
+            const float dot = vx * axis[0][j] + vy * axis[1][j] +
+                vz * axis[2][j];
+            const float length2 = vx * vx + vy * vy + vz * vz;
+            const float cross = std::sqrt(std::max(length2 - dot * dot,
+                        0.0f));
+            if (!(dot * cone[0][j] - cross * cone[1][j] > cone[2][j])) {
+                facing |= 1u << j;
+            }
+        }
+        return facing;
+    }
+#endif
+
     void draw_aabb(const vec3& min, const vec3& max)
     {
         const float x1 = min.x, y1 = min.y, z1 = min.z;
@@ -65,6 +312,45 @@ namespace
         glVertex3f(x1, y2, z2);
         glEnd();
     }
+
+    // The lookups of one map load and what stays resident.
+    void print_texture_manager(const TextureManager& textures,
+            const std::uint64_t hits, const std::uint64_t misses)
+    {
+        const double mb = 1024.0 * 1024.0;
+        std::printf("  %llu textures reused, %llu loaded, %zu resident in "
+                "%0.2f MB, %0.2f MB unreferenced\n",
+                static_cast<unsigned long long>(textures.get_hits() - hits),
+                static_cast<unsigned long long>(
+                    textures.get_misses() - misses),
+                textures.get_num_textures(), textures.get_bytes() / mb,
+                textures.get_unused_bytes() / mb);
+        if (textures.get_limit() > 0) {
+            std::printf("  %zu lowered to fit in %0.2f MB, %0.2f MB at full "
+                    "size\n", textures.get_num_lowered(),
+                    textures.get_limit() / mb, textures.get_full_bytes() / mb);
+            if (textures.get_over_limit() > 0) {
+                std::printf("  %llu created over the limit\n",
+                        static_cast<unsigned long long>(
+                            textures.get_over_limit()));
+            }
+        }
+    }
+
+    // With compression, along with what the same levels take as RGBA8.
+    void print_texture_bytes(const std::size_t bytes,
+            const std::size_t uncompressed_bytes, const std::size_t cache_hits)
+    {
+        const double mb = 1024.0 * 1024.0;
+        if (!get_texture_compression().enabled) {
+            std::printf("  %0.2f MB with mipmaps\n", bytes / mb);
+            return;
+        }
+        std::printf("  %0.2f MB with mipmaps, %0.2f MB uncompressed (%0.0f%%), "
+                "%zu from the cache\n", bytes / mb, uncompressed_bytes / mb,
+                100.0 * bytes / std::max<std::size_t>(uncompressed_bytes, 1),
+                cache_hits);
+    }
 }
 
 SimpleBezierSurface::SimpleBezierSurface(const DVertex_t* const controls,
@@ -193,6 +479,7 @@ void SimpleBezierSurface::draw() const
 
 GLBezierSurface::GLBezierSurface(const DVertex_t* const vertices,
         const int n_max, const int m_max, const unsigned steps)
+    : m_num_draw_calls(0), m_num_vertices(0)
 {
     m_gl_list_id = glGenLists(1);
     glNewList(m_gl_list_id, GL_COMPILE);
@@ -204,7 +491,10 @@ GLBezierSurface::GLBezierSurface(const DVertex_t* const vertices,
                     controls[m * 3 + n] = vertices[(i + m) * n_max + (j + n)];
                 }
             }
-            SimpleBezierSurface(controls, steps).draw();
+            SimpleBezierSurface surf(controls, steps);
+            surf.draw();
+            m_num_draw_calls += surf.get_num_strips();
+            m_num_vertices += surf.get_num_strip_vertices();
         }
     }
     glEndList();
@@ -222,12 +512,16 @@ void GLBezierSurface::draw() const
 
 void MapBSP46::bsp_read_header(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_header");
+
     bio->read_chars(m_header.magic, sizeof(m_header.magic));
     m_header.version = bio->read_u32le();
 }
 
 void MapBSP46::bsp_read_directory(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_directory");
+
     m_directory.entities.offset = bio->read_u32le();
     m_directory.entities.length = bio->read_u32le();
 
@@ -280,8 +574,47 @@ void MapBSP46::bsp_read_directory(BinaryIO* bio)
     m_directory.vis_data.length = bio->read_u32le();
 }
 
+void MapBSP46::bsp_read_entities(BinaryIO* bio)
+{
+    PROFILE_SPAN(span, "bsp_read_entities");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.entities.length);
+
+    bio->seek(m_directory.entities.offset);
+    m_entities = bio->read_string(m_directory.entities.length);
+}
+
+void MapBSP46::bsp_read_models(BinaryIO* bio)
+{
+    PROFILE_SPAN(span, "bsp_read_models");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.models.length);
+
+    bio->seek(m_directory.models.offset);
+
+    const std::size_t entry_size = 40;
+    m_models = std::vector<DModel_t>(m_directory.models.length / entry_size);
+    for (auto&& model : m_models) {
+        for (int i = 0; i < 3; ++i) {
+            model.mins[i] = bio->read_f32le();
+        }
+        for (int i = 0; i < 3; ++i) {
+            model.maxs[i] = bio->read_f32le();
+        }
+
+        model.face = bio->read_s32le();
+        model.num_faces = bio->read_s32le();
+        model.brush = bio->read_s32le();
+        model.num_brushes = bio->read_s32le();
+
+        swizzle(model.mins);
+        swizzle(model.maxs);
+    }
+}
+
 void MapBSP46::bsp_read_textures(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_textures");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.textures.length);
+
     bio->seek(m_directory.textures.offset);
 
     const std::size_t entry_size = 72;
@@ -296,6 +629,9 @@ void MapBSP46::bsp_read_textures(BinaryIO* bio)
 
 void MapBSP46::bsp_read_faces(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_faces");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.faces.length);
+
     bio->seek(m_directory.faces.offset);
 
     const std::size_t entry_size = 104;
@@ -337,11 +673,16 @@ void MapBSP46::bsp_read_faces(BinaryIO* bio)
         }
         face.n_max = bio->read_s32le();
         face.m_max = bio->read_s32le();
+
+        swizzle(face.normal);
     }
 }
 
 void MapBSP46::bsp_read_vertices(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_vertices");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.vertices.length);
+
     bio->seek(m_directory.vertices.offset);
 
     const std::size_t entry_size = 44;
@@ -371,6 +712,9 @@ void MapBSP46::bsp_read_vertices(BinaryIO* bio)
 
 void MapBSP46::bsp_read_planes(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_planes");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.planes.length);
+
     bio->seek(m_directory.planes.offset);
 
     const std::size_t entry_size = 16;
@@ -387,6 +731,9 @@ void MapBSP46::bsp_read_planes(BinaryIO* bio)
 
 void MapBSP46::bsp_read_leaves(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_leaves");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.leaves.length);
+
     bio->seek(m_directory.leaves.offset);
 
     const std::size_t entry_size = 48;
@@ -419,6 +766,9 @@ void MapBSP46::bsp_read_leaves(BinaryIO* bio)
 
 void MapBSP46::bsp_read_leaf_faces(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_leaf_faces");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.leaf_faces.length);
+
     bio->seek(m_directory.leaf_faces.offset);
 
     const std::size_t entry_size = 4;
@@ -431,6 +781,9 @@ void MapBSP46::bsp_read_leaf_faces(BinaryIO* bio)
 
 void MapBSP46::bsp_read_nodes(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_nodes");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.nodes.length);
+
     bio->seek(m_directory.nodes.offset);
 
     const std::size_t entry_size = 36;
@@ -459,6 +812,9 @@ void MapBSP46::bsp_read_nodes(BinaryIO* bio)
 
 void MapBSP46::bsp_read_mesh_verts(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_mesh_verts");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.mesh_verts.length);
+
     bio->seek(m_directory.mesh_verts.offset);
 
     const std::size_t entry_size = 4;
@@ -471,6 +827,9 @@ void MapBSP46::bsp_read_mesh_verts(BinaryIO* bio)
 
 void MapBSP46::bsp_read_lightmaps(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_lightmaps");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.lightmaps.length);
+
     bio->seek(m_directory.lightmaps.offset);
 
     const std::size_t entry_size = 128 * 128 * 3;
@@ -485,6 +844,9 @@ void MapBSP46::bsp_read_lightmaps(BinaryIO* bio)
 
 void MapBSP46::bsp_read_vis_data(BinaryIO* bio)
 {
+    PROFILE_SPAN(span, "bsp_read_vis_data");
+    PROFILE_SPAN_ARG(span, "bytes", m_directory.vis_data.length);
+
     bio->seek(m_directory.vis_data.offset);
 
     m_vis_data.num_bitsets = bio->read_s32le();
@@ -496,8 +858,584 @@ void MapBSP46::bsp_read_vis_data(BinaryIO* bio)
     }
 }
 
-MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak)
+void MapBSP46::sort_leaves_by_cluster()
+{
+    PROFILE_SCOPE("sort_leaves_by_cluster");
+    using leaves_size_t = decltype(m_leaves)::size_type;
+
+    // Leaves outside of the map (cluster -1) go last.
+    std::vector<std::uint32_t> order(m_leaves.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+            [this](const std::uint32_t a, const std::uint32_t b) {
+                return static_cast<std::uint32_t>(m_leaves[a].cluster) <
+                    static_cast<std::uint32_t>(m_leaves[b].cluster);
+            });
+
+    std::vector<DLeaf_t> leaves;
+    leaves.reserve(m_leaves.size());
+    m_leaf_remap.resize(m_leaves.size());
+    for (leaves_size_t i = 0; i < order.size(); ++i) {
+        leaves.push_back(m_leaves[order[i]]);
+        m_leaf_remap[order[i]] = static_cast<std::uint32_t>(i);
+    }
+    m_leaves.swap(leaves);
+
+    for (auto&& node : m_nodes) {
+        for (std::int32_t* child : { &node.front, &node.back }) {
+            if (*child < 0) {
+                const auto leaf = static_cast<leaves_size_t>(~*child);
+                if (leaf >= m_leaf_remap.size()) {
+                    throwf("`node` leaf index out of range");
+                }
+                *child = ~static_cast<std::int32_t>(m_leaf_remap[leaf]);
+            }
+        }
+    }
+
+    std::int32_t num_clusters = 0;
+    for (auto&& leaf : m_leaves) {
+        num_clusters = std::max(num_clusters, leaf.cluster + 1);
+    }
+    const float inf = std::numeric_limits<float>::infinity();
+    m_clusters.assign(static_cast<std::size_t>(num_clusters),
+            Cluster{0, 0, vec3(inf, inf, inf), vec3(-inf, -inf, -inf), -1});
+
+    vec3 box_min, box_max;
+    for (leaves_size_t i = 0; i < m_leaves.size(); ++i) {
+        const DLeaf_t& leaf = m_leaves[i];
+        if (leaf.cluster < 0) {
+            break;
+        }
+        Cluster& cluster = m_clusters[static_cast<std::size_t>(leaf.cluster)];
+        if (cluster.num_leaves == 0) {
+            cluster.first_leaf = static_cast<std::uint32_t>(i);
+        }
+        ++cluster.num_leaves;
+        if (leaf.num_leaf_faces > 0) {
+            const bool first = cluster.mins.x > cluster.maxs.x;
+            if (first || cluster.area == leaf.area) {
+                cluster.area = leaf.area;
+            }
+            else {
+                cluster.area = -1;
+            }
+            make_aabb(leaf.mins, leaf.maxs, &box_min, &box_max);
+            extend_aabb(box_min, box_max, &cluster.mins, &cluster.maxs);
+        }
+    }
+}
+
+void MapBSP46::compile_nodes()
+{
+    PROFILE_SCOPE("compile_nodes");
+    m_traversal_nodes.clear();
+    m_traversal_nodes.reserve(m_nodes.size());
+    m_node_bounds.clear();
+    m_node_bounds.reserve(m_nodes.size());
+    if (!m_nodes.empty()) {
+        compile_node(0);
+    }
+}
+
+std::int32_t MapBSP46::compile_node(const std::int32_t index)
+{
+    if (index < 0) {
+        return index;
+    }
+
+    using nodes_size_t = decltype(m_nodes)::size_type;
+    if (static_cast<nodes_size_t>(index) >= m_nodes.size()) {
+        throwf("`node` child index out of range");
+    }
+    if (m_traversal_nodes.size() == m_nodes.size()) {
+        throwf("`node` children don't form a tree");
+    }
+    const DNode_t& node = m_nodes[static_cast<nodes_size_t>(index)];
+
+    using planes_size_t = decltype(m_planes)::size_type;
+    if (static_cast<planes_size_t>(node.plane) >= m_planes.size()) {
+        throwf("`node.plane` value out of range");
+    }
+    const DPlane_t& plane = m_planes[static_cast<planes_size_t>(node.plane)];
+
+    TraversalNode compiled;
+    for (int i = 0; i < 3; ++i) {
+        compiled.normal[i] = plane.normal[i];
+    }
+    compiled.dist = plane.dist;
+    compiled.children[0] = node.front;
+    compiled.children[1] = node.back;
+    compiled.axis = 3;
+    for (int i = 0; i < 3; ++i) {
+        if (compiled.normal[(i + 1) % 3] == 0.0f &&
+                compiled.normal[(i + 2) % 3] == 0.0f) {
+            compiled.axis = i;
+        }
+    }
+    compiled.padding = 0;
+
+    const float inf = std::numeric_limits<float>::infinity();
+    NodeBounds bounds{vec3(inf, inf, inf), vec3(-inf, -inf, -inf)};
+    vec3 box_min, box_max;
+    make_aabb(node.mins, node.maxs, &box_min, &box_max);
+    extend_aabb(box_min, box_max, &bounds.mins, &bounds.maxs);
+
+    const auto compiled_index =
+        static_cast<std::int32_t>(m_traversal_nodes.size());
+    m_traversal_nodes.push_back(compiled);
+    m_node_bounds.push_back(bounds);
+
+    const std::int32_t front = compile_node(node.front);
+    const std::int32_t back = compile_node(node.back);
+    TraversalNode& t = m_traversal_nodes[static_cast<std::size_t>(
+            compiled_index)];
+    t.children[0] = front;
+    t.children[1] = back;
+    return compiled_index;
+}
+
+void MapBSP46::build_face_cull_data()
+{
+    PROFILE_SCOPE("build_face_cull_data");
+    const float inf = std::numeric_limits<float>::infinity();
+
+    FaceCullData& data = m_face_cull;
+    for (int i = 0; i < 3; ++i) {
+        data.center[i].resize(m_faces.size());
+        data.extent[i].resize(m_faces.size());
+        data.axis[i].resize(m_faces.size());
+    }
+    data.cos.resize(m_faces.size());
+    data.sin.resize(m_faces.size());
+    data.offset.resize(m_faces.size());
+
+    FaceShape shape;
+    for (std::size_t i = 0; i < m_faces.size(); ++i) {
+        const DFace_t& face = m_faces[i];
+        if (std::uint64_t(face.vertex) + face.num_vertices >
+                m_vertices.size()) {
+            throwf("`face.vertex` value out of range");
+        }
+        const DVertex_t* const vertices = m_vertices.data() + face.vertex;
+
+        shape.mins = vec3(inf, inf, inf);
+        shape.maxs = vec3(-inf, -inf, -inf);
+        shape.normals.clear();
+        if (face.type == 1 || face.type == 3) {
+            for (std::uint32_t j = 0; j < face.num_vertices; ++j) {
+                add_point(vertices[j].position, &shape);
+            }
+        }
+        if (face.type == 2) {
+            if (face.n_max < 0 || face.m_max < 0 ||
+                    std::uint64_t(face.n_max) * std::uint64_t(face.m_max) >
+                    face.num_vertices) {
+                throwf("`face.n_max` or `face.m_max` value out of range");
+            }
+            add_patch(face, vertices, &shape);
+        }
+        else if (face.type == 3) {
+            if (std::uint64_t(face.mesh_vert) + face.num_mesh_verts >
+                    m_mesh_verts.size()) {
+                throwf("`face.mesh_vert` value out of range");
+            }
+            const DMeshVert_t* const mesh_verts =
+                m_mesh_verts.data() + face.mesh_vert;
+            for (std::uint32_t j = 0; j + 2 < face.num_mesh_verts; j += 3) {
+                const float* p[3];
+                for (int k = 0; k < 3; ++k) {
+                    const std::int32_t offset = mesh_verts[j + k].offset;
+                    if (offset < 0 ||
+                            std::uint32_t(offset) >= face.num_vertices) {
+                        throwf("`mesh_vert.offset` value out of range");
+                    }
+                    p[k] = vertices[offset].position;
+                }
+                add_triangle(p[0], p[1], p[2], &shape);
+            }
+        }
+
+        vec3 center, extent(inf, inf, inf);
+        if (shape.mins.x <= shape.maxs.x) {
+            center = (shape.mins + shape.maxs) * 0.5f;
+            extent = (shape.maxs - shape.mins) * 0.5f;
+        }
+        vec3 axis;
+        float cone_cos = 1.0f;
+        float cone_sin = 0.0f;
+        float offset = inf;
+        vec3 normal(face.normal[0], face.normal[1], face.normal[2]);
+        if (face.type == 1 && face.num_vertices > 0 &&
+                normal.normalize() > 0.0f) {
+            const float* p = vertices[0].position;
+            axis = normal;
+            offset = normal.dot(center - vec3(p[0], p[1], p[2]));
+        }
+        else if (!shape.normals.empty()) {
+            for (auto&& n : shape.normals) {
+                axis += n;
+            }
+            if (axis.normalize() > 0.0f) {
+                for (auto&& n : shape.normals) {
+                    cone_cos = std::min(cone_cos, axis.dot(n));
+                }
+                // Cones of 90 degrees or more can't be tested this way.
+                if (cone_cos > 0.0f) {
+                    cone_sin = std::sqrt(1.0f - cone_cos * cone_cos);
+                    offset = extent.length();
+                }
+            }
+        }
+
+        data.center[0][i] = center.x;
+        data.center[1][i] = center.y;
+        data.center[2][i] = center.z;
+        data.extent[0][i] = extent.x;
+        data.extent[1][i] = extent.y;
+        data.extent[2][i] = extent.z;
+        data.axis[0][i] = axis.x;
+        data.axis[1][i] = axis.y;
+        data.axis[2][i] = axis.z;
+        data.cos[i] = cone_cos;
+        data.sin[i] = cone_sin;
+        data.offset[i] = offset;
+    }
+}
+
+void MapBSP46::assign_face_states()
+{
+    std::map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t> states;
+    m_face_states.reserve(m_faces.size());
+    for (auto&& face : m_faces) {
+        const auto id = static_cast<std::uint32_t>(states.size());
+        auto it = states.emplace(std::make_pair(face.texture, face.lm_index),
+                id).first;
+        m_face_states.push_back(it->second);
+    }
+    m_state_stamps.assign(states.size(), 0);
+    m_state_batches.assign(states.size(), 0);
+}
+
+// Picks the polygons that may serve as occluders: solid, drawn and big
+// enough. Their area is kept to rank them; other faces get 0.
+void MapBSP46::find_occluders()
+{
+    m_occluder_areas.assign(m_faces.size(), 0.0f);
+    for (std::size_t i = 0; i < m_faces.size(); ++i) {
+        const DFace_t& face = m_faces[i];
+        if (face.type != 1 || face.texture >= m_textures.size() ||
+                face.vertex + face.num_vertices > m_vertices.size()) {
+            continue;
+        }
+        const DTexture_t& texture = m_textures[face.texture];
+        if (!(texture.contents & contents_solid) ||
+                (texture.contents & contents_translucent) ||
+                (texture.flags & (surf_sky | surf_nodraw))) {
+            continue;
+        }
+        const DVertex_t* const vertex = m_vertices.data() + face.vertex;
+        const float* const a = vertex[0].position;
+        float area = 0.0f;
+        for (std::uint32_t j = 2; j < face.num_vertices; ++j) {
+            const float* const b = vertex[j - 1].position;
+            const float* const c = vertex[j].position;
+            vec3 n(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+            n.cross(vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+            area += n.length() * 0.5f;
+        }
+        if (area >= min_occluder_area) {
+            m_occluder_areas[i] = area;
+        }
+    }
+}
+
+void MapBSP46::set_static_batches(const bool enable)
+{
+    if (enable && m_static_batches.list_offsets.empty()) {
+        build_static_batches();
+    }
+    m_use_static_batches = enable;
+}
+
+void MapBSP46::build_static_batches()
+{
+    PROFILE_SCOPE("build_static_batches");
+    const std::int64_t start_ticks = get_ticks();
+    const float inf = std::numeric_limits<float>::infinity();
+    const std::uint32_t none = ~std::uint32_t(0);
+    const std::size_t num_faces = m_faces.size();
+    StaticBatches& sb = m_static_batches;
+
+    // The first cluster each face is in, and its area, -1 if it spans areas.
+    std::vector<std::int32_t> face_clusters(num_faces, -1);
+    sb.face_areas.assign(num_faces, -1);
+    for (auto&& leaf : m_leaves) {
+        if (leaf.cluster < 0) {
+            break;
+        }
+        const DLeafFace_t* leaf_face = m_leaf_faces.data() + leaf.leaf_face;
+        for (std::int32_t j = 0; j < leaf.num_leaf_faces; ++j) {
+            const auto face_index = static_cast<std::size_t>(leaf_face[j].face);
+            if (face_clusters[face_index] < 0) {
+                face_clusters[face_index] = leaf.cluster;
+                sb.face_areas[face_index] = leaf.area;
+            }
+            else if (sb.face_areas[face_index] != leaf.area) {
+                sb.face_areas[face_index] = -1;
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> order;
+    for (std::uint32_t i = 0; i < num_faces; ++i) {
+        const DFace_t& face = m_faces[i];
+        if (face_clusters[i] >= 0 &&
+                ((face.type == 1 && face.num_vertices >= 3) ||
+                 (face.type == 3 && face.num_mesh_verts >= 3))) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(),
+            [&](const std::uint32_t a, const std::uint32_t b) {
+                return std::tie(face_clusters[a], m_face_states[a], a) <
+                    std::tie(face_clusters[b], m_face_states[b], b);
+            });
+
+    // Polygons become triangle fans, which keeps their winding.
+    const FaceCullData& data = m_face_cull;
+    std::vector<GLuint> indices;
+    std::vector<std::uint32_t> face_batches(num_faces, none);
+    sb.batches.clear();
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        const std::uint32_t face_index = order[i];
+        const DFace_t& face = m_faces[face_index];
+        if (i == 0 || face_clusters[face_index] !=
+                face_clusters[order[i - 1]] ||
+                m_face_states[face_index] != m_face_states[order[i - 1]]) {
+            sb.batches.push_back(StaticBatch{face_index,
+                    sb.face_areas[face_index],
+                    static_cast<std::uint32_t>(indices.size()), 0,
+                    vec3(inf, inf, inf), vec3(-inf, -inf, -inf)});
+        }
+        StaticBatch& batch = sb.batches.back();
+        if (batch.area != sb.face_areas[face_index]) {
+            batch.area = -1;
+        }
+        if (face.type == 1) {
+            for (std::uint32_t j = 2; j < face.num_vertices; ++j) {
+                indices.push_back(face.vertex);
+                indices.push_back(face.vertex + j - 1);
+                indices.push_back(face.vertex + j);
+            }
+        }
+        else {
+            const DMeshVert_t* const mesh_verts =
+                m_mesh_verts.data() + face.mesh_vert;
+            const std::uint32_t num_mesh_verts =
+                face.num_mesh_verts - face.num_mesh_verts % 3;
+            for (std::uint32_t j = 0; j < num_mesh_verts; ++j) {
+                indices.push_back(face.vertex +
+                        static_cast<std::uint32_t>(mesh_verts[j].offset));
+            }
+        }
+        batch.num_indices =
+            static_cast<std::uint32_t>(indices.size()) - batch.first_index;
+        const vec3 center(data.center[0][face_index],
+                data.center[1][face_index], data.center[2][face_index]);
+        const vec3 extent(data.extent[0][face_index],
+                data.extent[1][face_index], data.extent[2][face_index]);
+        extend_aabb(center - extent, center + extent, &batch.mins,
+                &batch.maxs);
+        face_batches[face_index] =
+            static_cast<std::uint32_t>(sb.batches.size() - 1);
+    }
+
+    // The batches and other faces in the PVS of each cluster; a cluster's
+    // index stamps what it has listed already.
+    const auto num_clusters = static_cast<std::int32_t>(m_clusters.size());
+    std::vector<std::uint32_t> batch_stamps(sb.batches.size(), none);
+    std::vector<std::uint32_t> face_stamps(num_faces, none);
+    std::uint64_t num_pvs_faces = 0;
+    std::size_t max_batches = 0;
+    sb.lists.clear();
+    sb.list_offsets.assign(1, 0);
+    sb.faces.clear();
+    sb.face_offsets.assign(1, 0);
+    for (std::int32_t c = 0; c < num_clusters; ++c) {
+        const auto stamp = static_cast<std::uint32_t>(c);
+        for (std::int32_t v = 0; v < num_clusters; ++v) {
+            if (!is_cluster_visible(c, v)) {
+                continue;
+            }
+            const Cluster& cluster = m_clusters[static_cast<std::size_t>(v)];
+            for (auto j = cluster.first_leaf;
+                    j < cluster.first_leaf + cluster.num_leaves; ++j) {
+                const DLeaf_t& leaf = m_leaves[j];
+                const DLeafFace_t* leaf_face =
+                    m_leaf_faces.data() + leaf.leaf_face;
+                for (std::int32_t k = 0; k < leaf.num_leaf_faces; ++k) {
+                    const auto face_index =
+                        static_cast<std::uint32_t>(leaf_face[k].face);
+                    if (face_stamps[face_index] == stamp) {
+                        continue;
+                    }
+                    face_stamps[face_index] = stamp;
+                    const std::uint32_t batch = face_batches[face_index];
+                    if (batch == none) {
+                        if (m_faces[face_index].type == 2) {
+                            sb.faces.push_back(face_index);
+                        }
+                        continue;
+                    }
+                    ++num_pvs_faces;
+                    if (batch_stamps[batch] != stamp) {
+                        batch_stamps[batch] = stamp;
+                        sb.lists.push_back(batch);
+                    }
+                }
+            }
+        }
+        const auto first = sb.lists.begin() + sb.list_offsets.back();
+        std::sort(first, sb.lists.end(),
+                [&](const std::uint32_t a, const std::uint32_t b) {
+                    const std::uint32_t state_a =
+                        m_face_states[sb.batches[a].face];
+                    const std::uint32_t state_b =
+                        m_face_states[sb.batches[b].face];
+                    return std::tie(state_a, a) < std::tie(state_b, b);
+                });
+        max_batches = std::max<std::size_t>(max_batches,
+                sb.lists.size() - sb.list_offsets.back());
+        sb.list_offsets.push_back(static_cast<std::uint32_t>(sb.lists.size()));
+        sb.face_offsets.push_back(static_cast<std::uint32_t>(sb.faces.size()));
+    }
+
+    glGenBuffers(2, sb.buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, sb.buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(
+                m_vertices.size() * sizeof(DVertex_t)), m_vertices.data(),
+            GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sb.buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(
+                indices.size() * sizeof(GLuint)), indices.data(),
+            GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    sb.num_indices = indices.size();
+
+    // What batching costs in memory against what it saves per frame: the
+    // GL buffers and lists, and the batches a cluster's PVS draws against
+    // its faces, each of which is a draw call without batching.
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    const double clusters = std::max(num_clusters, 1);
+    std::printf("Static batches: %zu batches of %zu faces, built in "
+            "%0.2f sec\n", sb.batches.size(), order.size(),
+            (get_ticks() - start_ticks) / double(TICKS_PER_SECOND));
+    std::printf("  %0.2f MB vertex buffer, %0.2f MB index buffer, "
+            "%0.2f MB cluster lists\n",
+            m_vertices.size() * sizeof(DVertex_t) * mb,
+            sb.num_indices * sizeof(GLuint) * mb, sb.get_list_bytes() * mb);
+    std::printf("  %0.1f batches per PVS on average, %zu at most, for "
+            "%0.1f faces\n", sb.lists.size() / clusters, max_batches,
+            num_pvs_faces / clusters);
+}
+
+// Finds the area portals that the game opens and closes with its doors:
+// a func_door whose brush model touches the leaves of two areas joins them,
+// as the areanum and areanum2 of SV_LinkEntity. The viewer does not draw
+// doors, so all portals start open.
+void MapBSP46::build_area_portals()
+{
+    std::int32_t num_areas = 0;
+    for (auto&& leaf : m_leaves) {
+        num_areas = std::max(num_areas, leaf.area + 1);
+    }
+    m_area_portals.reset(num_areas);
+
+    const float inf = std::numeric_limits<float>::infinity();
+    for (auto&& entity : parse_entities(m_entities)) {
+        const auto classname = entity.find("classname");
+        const auto model = entity.find("model");
+        if (classname == entity.end() || model == entity.end() ||
+                classname->second.compare(0, 9, "func_door") != 0 ||
+                model->second.size() < 2 || model->second[0] != '*') {
+            continue;
+        }
+        const auto index = static_cast<std::size_t>(
+                std::strtoul(model->second.c_str() + 1, nullptr, 10));
+        if (index == 0 || index >= m_models.size()) {
+            continue;
+        }
+        const DModel_t& m = m_models[index];
+        vec3 box_min(inf, inf, inf), box_max(-inf, -inf, -inf);
+        extend_aabb(vec3(m.mins[0], m.mins[1], m.mins[2]),
+                vec3(m.maxs[0], m.maxs[1], m.maxs[2]), &box_min, &box_max);
+        // Entities are linked with their bounds grown by one unit.
+        box_min -= vec3(1.0f, 1.0f, 1.0f);
+        box_max += vec3(1.0f, 1.0f, 1.0f);
+
+        std::int32_t areas[2] = { -1, -1 };
+        find_box_areas(0, box_min, box_max, areas);
+        if (areas[1] >= 0) {
+            m_area_portals.add_portal(areas[0], areas[1]);
+        }
+    }
+}
+
+// Collects the first two distinct areas of the leaves the box touches.
+void MapBSP46::find_box_areas(const std::int32_t index, const vec3& box_min,
+        const vec3& box_max, std::int32_t areas[2]) const
 {
+    if (index < 0) {
+        using leaves_size_t = decltype(m_leaves)::size_type;
+        const std::int32_t area =
+            m_leaves[static_cast<leaves_size_t>(~index)].area;
+        if (area < 0) {
+            return;
+        }
+        if (areas[0] < 0) {
+            areas[0] = area;
+        }
+        else if (areas[1] < 0 && area != areas[0]) {
+            areas[1] = area;
+        }
+        return;
+    }
+
+    const TraversalNode& node =
+        m_traversal_nodes[static_cast<std::size_t>(index)];
+    float dist = -node.dist;
+    float radius = 0.0f;
+    const float mins[3] = { box_min.x, box_min.y, box_min.z };
+    const float maxs[3] = { box_max.x, box_max.y, box_max.z };
+    for (int i = 0; i < 3; ++i) {
+        dist += node.normal[i] * (mins[i] + maxs[i]) * 0.5f;
+        radius += std::abs(node.normal[i]) * (maxs[i] - mins[i]) * 0.5f;
+    }
+    if (dist + radius >= 0.0f) {
+        find_box_areas(node.children[0], box_min, box_max, areas);
+    }
+    if (dist - radius < 0.0f) {
+        find_box_areas(node.children[1], box_min, box_max, areas);
+    }
+}
+
+std::int32_t MapBSP46::find_area(const vec3& pos) const
+{
+    return find_leaf(pos).area;
+}
+
+MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak,
+        TextureManager* textures, ThreadPool* pool)
+    : m_tex_mgr(textures), m_pak(pak), m_placeholder_texture_id(0),
+    m_stream_start_ticks(0),
+    m_static_batches(), m_draw_order(DRAW_ORDER_CLUSTERS),
+    m_occlusion_culling(false), m_use_static_batches(false),
+    m_thread_pool(pool), m_cluster_vis_cache(cluster_vis_cache_size),
+    m_frame_stamp(0), m_occlusion(occlusion_width, occlusion_height)
+{
+    PROFILE_SPAN_DETAIL(map_span, "load_map", filename);
     auto maybe_data = pak.read_file(filename);
     if (!maybe_data) {
         throwf("%s: Couldn't open file from ZIP archive", filename);
@@ -516,19 +1454,29 @@ MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak)
 
     bsp_read_directory(&bio);
 
+    bsp_read_entities(&bio);
+    bsp_read_models(&bio);
     bsp_read_faces(&bio);
+    m_face_stamps.assign(m_faces.size(), 0);
+    assign_face_states();
     bsp_read_vertices(&bio);
     bsp_read_planes(&bio);
     bsp_read_leaves(&bio);
     bsp_read_leaf_faces(&bio);
     bsp_read_nodes(&bio);
+    sort_leaves_by_cluster();
+    compile_nodes();
+    build_area_portals();
     bsp_read_mesh_verts(&bio);
 
     bsp_read_textures(&bio);
+    const std::uint64_t texture_hits = m_tex_mgr->get_hits();
+    const std::uint64_t texture_misses = m_tex_mgr->get_misses();
     load_textures(pak);
 
     bsp_read_lightmaps(&bio);
-    process_lightmaps();
+    process_lightmaps(filename, pak);
+    print_texture_manager(*m_tex_mgr, texture_hits, texture_misses);
 
     bsp_read_vis_data(&bio);
 
@@ -536,11 +1484,15 @@ MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak)
     for (auto&& face : m_faces) {
         GLBezierSurface* surf = nullptr;
         if (face.type == 2) {
+            PROFILE_SPAN(span, "tessellate_patch");
+            PROFILE_SPAN_ARG(span, "control_points", face.n_max * face.m_max);
             surf = new GLBezierSurface(m_vertices.data() + face.vertex,
-                    face.n_max, face.m_max, 7);
+                    face.n_max, face.m_max, patch_tessellation_steps);
         }
         m_beziers.push_back(surf);
     }
+    build_face_cull_data();
+    find_occluders();
 
     std::cout << filename << ":" << std::endl;
     std::cout << "  " << m_textures.size() << " textures, " << std::endl;
@@ -548,6 +1500,11 @@ MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak)
     std::cout << "  " << m_vertices.size() << " vertices, " << std::endl;
     std::cout << "  " << m_planes.size() << " planes, " << std::endl;
     std::cout << "  " << m_leaves.size() << " leaves, " << std::endl;
+    std::cout << "  " << m_clusters.size() << " clusters, " << std::endl;
+    std::cout << "  " << m_area_portals.get_num_areas() << " areas, " <<
+        std::endl;
+    std::cout << "  " << m_area_portals.get_num_portals() <<
+        " area portals, " << std::endl;
     std::cout << "  " << m_leaf_faces.size() << " leaf faces, " << std::endl;
     std::cout << "  " << m_nodes.size() << " nodes, " << std::endl;
     std::cout << "  " << m_mesh_verts.size() << " mesh vertices, " << std::endl;
@@ -556,55 +1513,322 @@ MapBSP46::MapBSP46(const char* filename, const PAK3Archive& pak)
 
 MapBSP46::~MapBSP46() noexcept
 {
+    m_texture_streamer.reset();
+    m_texture_restorer.reset();
     for (auto texture_id : m_texture_ids) {
-        m_tex_mgr.free(texture_id);
+        if (texture_id != m_placeholder_texture_id) {
+            m_tex_mgr->release(texture_id);
+        }
     }
+    m_tex_mgr->release(m_placeholder_texture_id);
     for (auto lightmap_id : m_lightmap_ids) {
-        m_tex_mgr.free(lightmap_id);
+        m_tex_mgr->release(lightmap_id);
     }
     for (auto p : m_beziers) {
         delete p;
     }
+    if (m_static_batches.buffers[0]) {
+        glDeleteBuffers(2, m_static_batches.buffers);
+    }
 }
 
+// Textures still resident from an earlier map are only referenced. The
+// others are decoded on the thread pool while this thread uploads them, or
+// streamed in while the map is drawn. Textures without a file stay 0.
 void MapBSP46::load_textures(const PAK3Archive& pak)
 {
-    static const char* const file_extensions[2] = { ".jpg", ".tga" };
+    PROFILE_SCOPE("load_textures");
+    const std::int64_t start_ticks = get_ticks();
+    std::vector<std::string> names;
+    m_texture_keys.clear();
+    m_texture_ids.assign(m_textures.size(), 0);
+    for (std::size_t i = 0; i < m_textures.size(); ++i) {
+        m_texture_keys.push_back(
+                resolve_texture_key(m_textures[i].name, pak));
+        const std::string& key = m_texture_keys.back();
+        if (!key.empty()) {
+            m_texture_ids[i] = m_tex_mgr->acquire(key);
+        }
+        names.emplace_back(key.empty() || m_texture_ids[i] ?
+                "" : m_textures[i].name);
+    }
+    if (get_texture_streaming().enabled) {
+        mip_chain_t placeholder;
+        placeholder.emplace_back(1, 1, pixel_vector_t{{128, 128, 128, 255}});
+        m_placeholder_texture_id = m_tex_mgr->add(placeholder,
+                placeholder_texture_key);
+        for (std::size_t i = 0; i < m_textures.size(); ++i) {
+            if (!names[i].empty()) {
+                m_texture_ids[i] = m_placeholder_texture_id;
+            }
+        }
+        m_texture_streamer = std::make_unique<TextureStreamer>(
+                std::move(names), pak,
+                m_thread_pool ? m_thread_pool->get_num_threads() : 1);
+        m_stream_start_ticks = start_ticks;
+        std::cout << "Streaming textures..." << std::endl;
+        return;
+    }
+
     std::cout << "Precaching textures..." << std::endl;
-    for (auto&& texture : m_textures) {
-        uint32_t texture_id = 0;
-        for (int j = 0; j < 2; ++j) {
-            std::string filename = texture.name;
-            filename += file_extensions[j];
-            try {
-                ImageTexture bsp_texture(filename.c_str(), pak);
-                texture_id = m_tex_mgr.add(bsp_texture);
-                break;
+    std::size_t num_bytes = 0;
+    std::size_t num_uncompressed_bytes = 0;
+    std::size_t num_cache_hits = 0;
+    decode_textures(names, pak, m_thread_pool,
+            [&](const std::size_t i, const LoadedTexture& texture) {
+                m_texture_ids[i] = add_texture(texture, m_texture_keys[i]);
+                num_bytes += texture.get_bytes();
+                num_uncompressed_bytes += texture.get_uncompressed_bytes();
+                num_cache_hits += texture.cache_hit;
+            });
+    std::printf("  %zu textures in %0.2f sec on %u threads\n",
+            m_textures.size(),
+            (get_ticks() - start_ticks) / double(TICKS_PER_SECOND),
+            m_thread_pool ? m_thread_pool->get_num_threads() : 1);
+    print_texture_bytes(num_bytes, num_uncompressed_bytes, num_cache_hits);
+}
+
+// Returns 0 for a texture that wasn't found, as for one never loaded.
+GLuint MapBSP46::add_texture(const LoadedTexture& texture,
+        const std::string& key)
+{
+    if (texture.is_compressed()) {
+        return m_tex_mgr->add(texture.compressed, key);
+    }
+    return texture.levels.empty() ? 0 : m_tex_mgr->add(texture.levels, key);
+}
+
+void MapBSP46::stream_textures(const DrawList& list, FrameStats* stats)
+{
+    const std::uint64_t start_bytes = m_tex_mgr->get_bytes_uploaded();
+    if (m_texture_streamer) {
+        upload_streamed_textures(list, stats);
+    }
+    restore_textures(start_bytes, stats);
+    m_tex_mgr->end_frame();
+    stats->add(STAT_TEXTURE_UPLOAD_BYTES,
+            m_tex_mgr->get_bytes_uploaded() - start_bytes);
+    stats->add(STAT_TEXTURES_LOWERED, m_tex_mgr->get_num_lowered());
+    stats->add(STAT_TEXTURE_RESIDENT_KB, m_tex_mgr->get_bytes() / 1024);
+}
+
+void MapBSP46::upload_streamed_textures(const DrawList& list,
+        FrameStats* stats)
+{
+    m_texture_face_counts.assign(m_textures.size(), 0);
+    for (auto face_index : list.faces) {
+        const std::uint32_t texture = m_faces[face_index].texture;
+        if (texture < m_texture_face_counts.size()) {
+            ++m_texture_face_counts[texture];
+        }
+    }
+    for (auto&& run : list.batch_runs) {
+        const std::uint32_t texture = m_faces[run.first].texture;
+        if (texture < m_texture_face_counts.size()) {
+            m_texture_face_counts[texture] += run.second;
+        }
+    }
+    m_texture_streamer->set_visible(m_texture_face_counts);
+
+    std::size_t num_textures = 0;
+    std::size_t num_bytes = 0;
+    m_texture_streamer->upload(get_texture_streaming(),
+            [this](const std::size_t i, const LoadedTexture& texture) {
+                m_texture_ids[i] = add_texture(texture, m_texture_keys[i]);
+            },
+            &num_textures, &num_bytes);
+    const std::size_t num_pending = m_texture_streamer->get_num_pending();
+    stats->add(STAT_TEXTURES_STREAMED, num_textures);
+    stats->add(STAT_TEXTURES_PENDING, num_pending);
+    if (num_pending == 0) {
+        m_texture_streamer.reset();
+        std::printf("\nStreamed %zu textures in %0.2f sec\n",
+                m_textures.size(), (get_ticks() - m_stream_start_ticks) /
+                double(TICKS_PER_SECOND));
+    }
+}
+
+// Lightmaps are keyed by the map's pk3 entry, so that they are shared
+// when the same map is loaded again. They are converted and their mipmaps
+// built on the thread pool, and compressed there too, and cached on disk
+// under the same key.
+void MapBSP46::process_lightmaps(const char* filename, const PAK3Archive& pak)
+{
+    PROFILE_SCOPE("process_lightmaps");
+    PAK3Archive::FileInfo info;
+    const bool keyed = pak.stat_file(filename, &info);
+    std::vector<std::string> keys(m_lightmaps.size());
+    m_lightmap_ids.assign(m_lightmaps.size(), 0);
+    for (std::size_t i = 0; keyed && i < m_lightmaps.size(); ++i) {
+        char detail[64];
+        std::snprintf(detail, sizeof(detail), "#lightmap%zu:%u", i,
+                LightmapTexture::get_overbright_bits());
+        keys[i] = make_texture_cache_key(info, filename + std::string(detail));
+        m_lightmap_ids[i] = m_tex_mgr->acquire(keys[i] +
+                get_texture_options_key());
+    }
+    const auto manager_key = [&](const std::size_t i) {
+        return keys[i].empty() ? keys[i] : keys[i] + get_texture_options_key();
+    };
+
+    if (!get_texture_compression().enabled) {
+        std::vector<mip_chain_t> levels(m_lightmaps.size());
+        const auto build = [&](const std::size_t i) {
+            if (!m_lightmap_ids[i]) {
+                LightmapTexture lmtex(m_lightmaps[i]);
+                levels[i] = build_mip_chain(lmtex.get_width(),
+                        lmtex.get_height(), lmtex.get_pixels());
             }
-            catch (const QException&) {
+        };
+        if (m_thread_pool) {
+            m_thread_pool->parallel_for(0, m_lightmaps.size(), build);
+        }
+        else {
+            for (std::size_t i = 0; i < m_lightmaps.size(); ++i) {
+                build(i);
+            }
+        }
+        for (std::size_t i = 0; i < m_lightmaps.size(); ++i) {
+            if (!m_lightmap_ids[i]) {
+                m_lightmap_ids[i] = m_tex_mgr->add(levels[i], manager_key(i));
             }
         }
-        m_texture_ids.push_back(texture_id);
+        return;
+    }
+
+    std::vector<CompressedTexture> compressed(m_lightmaps.size());
+    std::vector<char> cache_hits(m_lightmaps.size());
+    const auto compress = [&](const std::size_t i) {
+        if (m_lightmap_ids[i]) {
+            return;
+        }
+        const auto build = [&]() {
+            LightmapTexture lmtex(m_lightmaps[i]);
+            return build_mip_chain(lmtex.get_width(), lmtex.get_height(),
+                    lmtex.get_pixels());
+        };
+        cache_hits[i] = load_compressed(keys[i], build, &compressed[i]);
+    };
+    if (m_thread_pool) {
+        m_thread_pool->parallel_for(0, m_lightmaps.size(), compress);
     }
+    else {
+        for (std::size_t i = 0; i < m_lightmaps.size(); ++i) {
+            compress(i);
+        }
+    }
+
+    std::size_t num_bytes = 0;
+    std::size_t num_uncompressed_bytes = 0;
+    for (std::size_t i = 0; i < m_lightmaps.size(); ++i) {
+        if (!m_lightmap_ids[i]) {
+            m_lightmap_ids[i] = m_tex_mgr->add(compressed[i], manager_key(i));
+            num_bytes += compressed[i].get_bytes();
+            num_uncompressed_bytes += compressed[i].get_uncompressed_bytes();
+        }
+    }
+    std::printf("  %zu lightmaps\n", m_lightmaps.size());
+    print_texture_bytes(num_bytes, num_uncompressed_bytes,
+            static_cast<std::size_t>(std::count(cache_hits.begin(),
+                    cache_hits.end(), 1)));
 }
 
-void MapBSP46::process_lightmaps()
+// Textures are rebuilt as at load time on the restorer's thread, while the
+// lowered ones are drawn at their lower size, but lightmaps aren't read from
+// the disk cache. The textures rebuilt are uploaded within the frame's upload
+// budget, shared with the streamed textures uploaded since the manager had
+// uploaded `start_bytes`. A texture that doesn't fit under the limit is
+// dropped, to be requested again when it is drawn again.
+void MapBSP46::restore_textures(const std::uint64_t start_bytes,
+        FrameStats* stats)
 {
-    for (auto&& lightmap : m_lightmaps) {
-        LightmapTexture lmtex(lightmap);
-        GLuint texture_id = m_tex_mgr.add(lmtex);
-        m_lightmap_ids.push_back(texture_id);
+    m_tex_mgr->take_wanted(&m_restore_queue);
+    if (m_restore_queue.empty() && !m_texture_restorer) {
+        return;
     }
+    PROFILE_SCOPE("restore_textures");
+    if (!m_texture_restorer) {
+        m_texture_restorer = std::make_unique<TextureRestorer>();
+    }
+    for (auto texture_id : m_restore_queue) {
+        request_restore(texture_id);
+    }
+
+    const TextureStreaming& budget = get_texture_streaming();
+    const std::int64_t end_ticks = get_ticks() + static_cast<std::int64_t>(
+            budget.budget_msec * TICKS_PER_SECOND / 1000.0);
+    std::size_t num_restored = 0;
+    for (;;) {
+        const std::uint64_t bytes =
+            m_tex_mgr->get_bytes_uploaded() - start_bytes;
+        if (num_restored > 0 && (get_ticks() >= end_ticks ||
+                    (budget.budget_bytes > 0 &&
+                     bytes >= budget.budget_bytes))) {
+            break;
+        }
+        std::size_t id;
+        LoadedTexture loaded;
+        if (!m_texture_restorer->take(&id, &loaded)) {
+            break;
+        }
+        const auto texture_id = static_cast<GLuint>(id);
+        if ((!loaded.is_compressed() && loaded.levels.empty()) ||
+                !m_tex_mgr->reserve(texture_id)) {
+            continue;
+        }
+        if (loaded.is_compressed() ?
+                m_tex_mgr->restore(texture_id, loaded.compressed) :
+                m_tex_mgr->restore(texture_id, loaded.levels)) {
+            ++num_restored;
+        }
+    }
+    stats->add(STAT_TEXTURES_RESTORED, num_restored);
 }
 
-void MapBSP46::draw_face(const face_index_size_t face_index) const
+// Textures are looked up by their GL name, which is rare enough not to
+// need an index: only lowered textures bound again are restored.
+void MapBSP46::request_restore(const GLuint texture_id)
 {
-    const DFace_t& face = m_faces[face_index];
+    const auto texture = std::find(m_texture_ids.begin(), m_texture_ids.end(),
+            texture_id);
+    if (texture != m_texture_ids.end()) {
+        const std::string name =
+            m_textures[texture - m_texture_ids.begin()].name;
+        const PAK3Archive& pak = m_pak;
+        m_texture_restorer->request(texture_id, [name, &pak]() {
+                LoadedTexture loaded;
+                load_texture(name, pak, &loaded);
+                return loaded;
+                });
+        return;
+    }
+
+    const auto lightmap = std::find(m_lightmap_ids.begin(),
+            m_lightmap_ids.end(), texture_id);
+    if (lightmap != m_lightmap_ids.end()) {
+        const DLightmap_t& source =
+            m_lightmaps[lightmap - m_lightmap_ids.begin()];
+        m_texture_restorer->request(texture_id, [&source]() {
+                LightmapTexture lmtex(source);
+                LoadedTexture loaded;
+                loaded.levels = build_mip_chain(lmtex.get_width(),
+                        lmtex.get_height(), lmtex.get_pixels());
+                if (get_texture_compression().enabled) {
+                    loaded.compressed = compress_mip_chain(loaded.levels);
+                    loaded.levels.clear();
+                }
+                return loaded;
+                });
+    }
+}
 
+void MapBSP46::bind_face_textures(const DFace_t& face, FrameStats* stats) const
+{
     glActiveTexture(GL_TEXTURE0_ARB);
     if (face.texture < m_texture_ids.size()) {
         glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, m_texture_ids[face.texture]);
+        m_tex_mgr->bind(m_texture_ids[face.texture]);
+        stats->add(STAT_TEXTURE_BINDS);
     }
     else {
         glDisable(GL_TEXTURE_2D);
@@ -613,11 +1837,26 @@ void MapBSP46::draw_face(const face_index_size_t face_index) const
     glActiveTexture(GL_TEXTURE1_ARB);
     if (face.lm_index < m_lightmap_ids.size()) {
         glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, m_lightmap_ids[face.lm_index]);
+        m_tex_mgr->bind(m_lightmap_ids[face.lm_index]);
+        stats->add(STAT_TEXTURE_BINDS);
     }
     else {
         glDisable(GL_TEXTURE_2D);
     }
+}
+
+// The textures are only bound when `bind_textures` is set, i.e. when the
+// previous face drawn had a different state. Meshes are drawn from the
+// vertex, color and unit 0 texture coordinate arrays, which the caller
+// enables.
+void MapBSP46::draw_face(const face_index_size_t face_index,
+        const bool bind_textures, FrameStats* stats) const
+{
+    const DFace_t& face = m_faces[face_index];
+
+    if (bind_textures) {
+        bind_face_textures(face, stats);
+    }
 
     if (face.type == 1) {
         const DVertex_t* const vertex = m_vertices.data() + face.vertex;
@@ -638,9 +1877,16 @@ void MapBSP46::draw_face(const face_index_size_t face_index) const
             glVertex3fv(cv.position);
         }
         glEnd();
+        stats->add(STAT_FACES_POLYGON);
+        stats->add(STAT_VERTICES, face.num_vertices);
+        stats->add(STAT_DRAW_CALLS);
     }
     else if (face.type == 2) {
-        m_beziers[face_index]->draw();
+        const GLBezierSurface* surf = m_beziers[face_index];
+        surf->draw();
+        stats->add(STAT_FACES_PATCH);
+        stats->add(STAT_VERTICES, surf->get_num_vertices());
+        stats->add(STAT_DRAW_CALLS, surf->get_num_draw_calls());
     }
     else if (face.type == 3) {
         const DVertex_t& vertex = m_vertices[face.vertex];
@@ -650,79 +1896,311 @@ void MapBSP46::draw_face(const face_index_size_t face_index) const
         glVertexPointer(3, GL_FLOAT, sizeof(DVertex_t), vertex.position);
         glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(face.num_mesh_verts),
                 GL_UNSIGNED_INT, &m_mesh_verts[face.mesh_vert].offset);
+        stats->add(STAT_FACES_MESH);
+        stats->add(STAT_VERTICES, face.num_vertices);
+        stats->add(STAT_INDICES, face.num_mesh_verts);
+        stats->add(STAT_DRAW_CALLS);
+    }
+    else if (face.type == 4) {
+        // Billboards (flares) reach here but aren't drawn.
+        stats->add(STAT_FACES_BILLBOARD);
     }
 }
 
-void MapBSP46::draw_leaves(const leaf_ptr_vec_t& leaf_ptrs,
-        const GLFrustum<float>& frustum) const
+void MapBSP46::begin_face_queue() const
 {
-    vec3 box_min, box_max;
-    face_index_vec_t face_indices;
+    m_draw_queue.clear();
+    if (++m_frame_stamp == 0) {
+        std::fill(m_face_stamps.begin(), m_face_stamps.end(), 0);
+        std::fill(m_state_stamps.begin(), m_state_stamps.end(), 0);
+        m_frame_stamp = 1;
+    }
+}
 
-    for (auto leaf_ptr : leaf_ptrs) {
-        make_aabb(leaf_ptr->mins, leaf_ptr->maxs, &box_min, &box_max);
-        if (!frustum.is_aabb_visible(box_min, box_max)) {
-            continue;
+inline void MapBSP46::queue_face(const face_index_size_t face_index) const
+{
+    std::uint32_t& stamp = m_face_stamps[face_index];
+    if (stamp != m_frame_stamp) {
+        stamp = m_frame_stamp;
+        m_draw_queue.push_back(face_index);
+    }
+}
+
+// Drops the faces in [first, last) of the queue that are outside the
+// frustum or facing away from the camera, four at a time. The faces kept are
+// moved to the front of the range; returns their number.
+std::size_t MapBSP46::cull_face_range(const std::size_t first,
+        const std::size_t last, const vec3& camera_pos,
+        const Frustum<float>& frustum, FrameStats* stats) const
+{
+    const FaceCullData& data = m_face_cull;
+    std::size_t num_kept = first;
+    std::uint64_t num_culled = 0;
+    std::uint64_t num_backfacing = 0;
+
+    face_index_size_t faces[4];
+    float center[3][4], extent[3][4], axis[3][4], cone[3][4];
+    for (std::size_t i = first; i < last; i += 4) {
+        const std::size_t n = std::min<std::size_t>(last - i, 4);
+        for (std::size_t j = 0; j < 4; ++j) {
+            // The last group is padded with its first face.
+            const face_index_size_t face_index =
+                m_draw_queue[j < n ? i + j : i];
+            faces[j] = face_index;
+            for (int k = 0; k < 3; ++k) {
+                center[k][j] = data.center[k][face_index];
+                extent[k][j] = data.extent[k][face_index];
+                axis[k][j] = data.axis[k][face_index];
+            }
+            cone[0][j] = data.cos[face_index];
+            cone[1][j] = data.sin[face_index];
+            cone[2][j] = data.offset[face_index];
         }
-        const DLeafFace_t* leaf_face = m_leaf_faces.data() + leaf_ptr->leaf_face;
-        for (std::int32_t j = 0; j < leaf_ptr->num_leaf_faces; ++j) {
-            face_indices.push_back(static_cast<face_index_size_t>(
-                        leaf_face[j].face));
+
+        const unsigned visible = frustum.are_aabbs_visible(center, extent);
+        const unsigned facing = test_face_cones(camera_pos, center, axis, cone);
+        for (std::size_t j = 0; j < n; ++j) {
+            const unsigned bit = 1u << j;
+            if (!(visible & bit)) {
+                ++num_culled;
+            }
+            else if (!(facing & bit)) {
+                ++num_backfacing;
+            }
+            else {
+                m_draw_queue[num_kept++] = faces[j];
+            }
         }
     }
+    stats->add(STAT_FACES_CULLED, num_culled);
+    stats->add(STAT_FACES_BACKFACING, num_backfacing);
+    return num_kept - first;
+}
 
-    std::sort(face_indices.begin(), face_indices.end());
-    auto end = std::unique(face_indices.begin(), face_indices.end());
-    for (auto face_it = face_indices.cbegin(); face_it != end; ++face_it) {
-        draw_face(*face_it);
+// Large queues are cut into chunks culled on the thread pool, which are
+// then closed up in order, so the result is the same as culling serially.
+void MapBSP46::cull_queued_faces(const vec3& camera_pos,
+        const Frustum<float>& frustum, FrameStats* stats) const
+{
+    PROFILE_SCOPE("cull_faces");
+    const std::size_t num_queued = m_draw_queue.size();
+    if (!m_thread_pool || m_thread_pool->get_num_threads() == 1 ||
+            num_queued < min_parallel_cull_faces) {
+        m_draw_queue.resize(cull_face_range(0, num_queued, camera_pos,
+                    frustum, stats));
+        return;
     }
 
-#if 0
-    glActiveTexture(GL_TEXTURE0_ARB);
-    glDisable(GL_TEXTURE_2D);
-    glActiveTexture(GL_TEXTURE1_ARB);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_DEPTH_TEST);
+    const std::size_t num_chunks =
+        (num_queued + face_cull_chunk_size - 1) / face_cull_chunk_size;
+    m_chunk_kept.resize(num_chunks);
+    m_chunk_stats.assign(num_chunks, FrameStats());
+    m_thread_pool->parallel_for(0, num_chunks, [&](const std::size_t i) {
+            const std::size_t first = i * face_cull_chunk_size;
+            const std::size_t last =
+                std::min(first + face_cull_chunk_size, num_queued);
+            m_chunk_kept[i] = cull_face_range(first, last, camera_pos,
+                    frustum, &m_chunk_stats[i]);
+        });
+
+    std::size_t num_kept = 0;
+    for (std::size_t i = 0; i < num_chunks; ++i) {
+        const auto chunk = m_draw_queue.begin() +
+            static_cast<std::ptrdiff_t>(i * face_cull_chunk_size);
+        std::copy(chunk, chunk + static_cast<std::ptrdiff_t>(m_chunk_kept[i]),
+                m_draw_queue.begin() + static_cast<std::ptrdiff_t>(num_kept));
+        num_kept += m_chunk_kept[i];
+        stats->add(STAT_FACES_CULLED,
+                m_chunk_stats[i].get(STAT_FACES_CULLED));
+        stats->add(STAT_FACES_BACKFACING,
+                m_chunk_stats[i].get(STAT_FACES_BACKFACING));
+    }
+    m_draw_queue.resize(num_kept);
+}
 
-    for (auto&& node : m_nodes) {
-        make_aabb(node.mins, node.maxs, &box_min, &box_max);
-        if (frustum.is_aabb_visible(box_min, box_max)) {
-            glColor3f(0.0f, 1.0f, 0.0f);
+// Groups the queued faces by state with a counting sort. Batches are
+// ordered by their first face and keep the order of their faces, so a queue
+// filled front to back gives batches that are roughly front to back.
+void MapBSP46::group_queued_faces() const
+{
+    PROFILE_SCOPE("group_faces");
+    m_batch_offsets.clear();
+    for (auto face_index : m_draw_queue) {
+        const std::uint32_t state = m_face_states[face_index];
+        if (m_state_stamps[state] != m_frame_stamp) {
+            m_state_stamps[state] = m_frame_stamp;
+            m_state_batches[state] =
+                static_cast<std::uint32_t>(m_batch_offsets.size());
+            m_batch_offsets.push_back(0);
         }
-        else {
-            glColor3f(1.0f, 0.0f, 0.0f);
+        ++m_batch_offsets[m_state_batches[state]];
+    }
+
+    std::uint32_t offset = 0;
+    for (auto& batch_offset : m_batch_offsets) {
+        const std::uint32_t num_faces = batch_offset;
+        batch_offset = offset;
+        offset += num_faces;
+    }
+
+    m_draw_scratch.resize(m_draw_queue.size());
+    for (auto face_index : m_draw_queue) {
+        const std::uint32_t batch = m_state_batches[m_face_states[face_index]];
+        m_draw_scratch[m_batch_offsets[batch]++] = face_index;
+    }
+    m_draw_queue.swap(m_draw_scratch);
+}
+
+void MapBSP46::submit(const DrawList& list, FrameStats* stats) const
+{
+    PROFILE_SCOPE("submit");
+    std::uint32_t bound_state = no_face_state;
+    if (!list.batch_runs.empty()) {
+        bound_state = draw_static_batches(list, stats);
+    }
+    glClientActiveTexture(GL_TEXTURE0_ARB);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    for (auto face_index : list.faces) {
+        const std::uint32_t state = m_face_states[face_index];
+        draw_face(face_index, state != bound_state, stats);
+        bound_state = state;
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Draws the batch ranges of the list from the world buffers, with a
+// glMultiDrawElements per run of the same state. Returns the state bound
+// last, with the client arrays disabled and the buffers unbound again.
+std::uint32_t MapBSP46::draw_static_batches(const DrawList& list,
+        FrameStats* stats) const
+{
+    const StaticBatches& sb = m_static_batches;
+    glBindBuffer(GL_ARRAY_BUFFER, sb.buffers[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sb.buffers[1]);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glClientActiveTexture(GL_TEXTURE1_ARB);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(DVertex_t),
+            reinterpret_cast<const GLvoid*>(offsetof(DVertex_t, lm_coord)));
+    glClientActiveTexture(GL_TEXTURE0_ARB);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(DVertex_t),
+            reinterpret_cast<const GLvoid*>(offsetof(DVertex_t, tex_coord)));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(DVertex_t),
+            reinterpret_cast<const GLvoid*>(offsetof(DVertex_t, color)));
+    glVertexPointer(3, GL_FLOAT, sizeof(DVertex_t),
+            reinterpret_cast<const GLvoid*>(offsetof(DVertex_t, position)));
+
+    std::size_t first = 0;
+    for (auto&& run : list.batch_runs) {
+        bind_face_textures(m_faces[run.first], stats);
+        glMultiDrawElements(GL_TRIANGLES, list.batch_counts.data() + first,
+                GL_UNSIGNED_INT, list.batch_offsets.data() + first,
+                static_cast<GLsizei>(run.second));
+        for (std::size_t i = first; i < first + run.second; ++i) {
+            stats->add(STAT_INDICES,
+                    static_cast<std::uint64_t>(list.batch_counts[i]));
         }
-        draw_aabb(box_min, box_max);
+        stats->add(STAT_BATCHES, run.second);
+        stats->add(STAT_DRAW_CALLS);
+        first += run.second;
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glActiveTexture(GL_TEXTURE1_ARB);
-    glEnable(GL_TEXTURE_2D);
-    glActiveTexture(GL_TEXTURE0_ARB);
-    glEnable(GL_TEXTURE_2D);
-#endif
+    glClientActiveTexture(GL_TEXTURE1_ARB);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glClientActiveTexture(GL_TEXTURE0_ARB);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return m_face_states[list.batch_runs.back().first];
 }
 
-const DLeaf_t& MapBSP46::find_leaf(const vec3& pos) const
+// Tests the batches in the camera cluster's list against `area_bits`, if
+// any, the frustum and `occlusion`, if any, and adds the ranges of those
+// passing to the list. The cluster's other faces are queued.
+void MapBSP46::queue_static_batches(const std::int32_t cluster,
+        const Frustum<float>& frustum, const std::uint8_t* area_bits,
+        const OcclusionBuffer* occlusion, DrawList* list) const
 {
-    using leaves_size_t = decltype(m_leaves)::size_type;
-    typename std::make_signed<leaves_size_t>::type index = 0;
-    while (index >= 0) {
-        using nodes_size_t = decltype(m_nodes)::size_type;
-        const DNode_t& node = m_nodes[static_cast<nodes_size_t>(index)];
+    PROFILE_SCOPE("static_batches");
+    const StaticBatches& sb = m_static_batches;
+    const auto c = static_cast<std::size_t>(cluster);
+    std::uint32_t run_state = no_face_state;
+    std::uint64_t num_culled = 0;
+    for (auto i = sb.list_offsets[c]; i < sb.list_offsets[c + 1]; ++i) {
+        const StaticBatch& batch = sb.batches[sb.lists[i]];
+        if (is_area_culled(area_bits, batch.area) ||
+                !frustum.is_aabb_visible(batch.mins, batch.maxs) ||
+                (occlusion &&
+                 !occlusion->is_aabb_visible(batch.mins, batch.maxs))) {
+            ++num_culled;
+            continue;
+        }
+        const std::uint32_t state = m_face_states[batch.face];
+        if (state != run_state) {
+            run_state = state;
+            list->batch_runs.emplace_back(batch.face, 0);
+        }
+        ++list->batch_runs.back().second;
+        list->batch_counts.push_back(static_cast<GLsizei>(batch.num_indices));
+        list->batch_offsets.push_back(reinterpret_cast<const GLvoid*>(
+                    std::uintptr_t(batch.first_index) * sizeof(GLuint)));
+    }
+    list->stats.add(STAT_BATCHES_CULLED, num_culled);
 
-        using planes_size_t = decltype(m_planes)::size_type;
-        const DPlane_t& plane = m_planes[static_cast<planes_size_t>(node.plane)];
+    for (auto i = sb.face_offsets[c]; i < sb.face_offsets[c + 1]; ++i) {
+        const face_index_size_t face_index = sb.faces[i];
+        if (!is_area_culled(area_bits, sb.face_areas[face_index])) {
+            queue_face(face_index);
+        }
+    }
+}
 
-        vec3 v(plane.normal[0], plane.normal[1], plane.normal[2]);
-        const float dist = v.dot(pos) - plane.dist;
-        if (dist >= 0.0f) {
-            index = node.front;
+void MapBSP46::queue_leaves(const leaf_ptr_vec_t& leaf_ptrs) const
+{
+    for (auto leaf_ptr : leaf_ptrs) {
+        const DLeafFace_t* leaf_face =
+            m_leaf_faces.data() + leaf_ptr->leaf_face;
+        for (std::int32_t j = 0; j < leaf_ptr->num_leaf_faces; ++j) {
+            queue_face(static_cast<face_index_size_t>(leaf_face[j].face));
+        }
+    }
+}
+
+const DLeaf_t& MapBSP46::find_leaf(const vec3& pos, FrameStats* stats) const
+{
+    PROFILE_SCOPE("find_leaf");
+    const float p[3] = { pos.x, pos.y, pos.z };
+    std::int32_t index = 0;
+    std::uint64_t nodes_visited = 0;
+    while (index >= 0) {
+        ++nodes_visited;
+        const TraversalNode& node =
+            m_traversal_nodes[static_cast<std::size_t>(index)];
+
+        // The axial path still multiplies by the (signed) normal component,
+        // so that it gives the same distance as the full dot product.
+        float dist;
+        if (node.axis < 3) {
+            dist = p[node.axis] * node.normal[node.axis] - node.dist;
         }
         else {
-            index = node.back;
+            dist = node.normal[0] * p[0] + node.normal[1] * p[1] +
+                node.normal[2] * p[2] - node.dist;
         }
+        index = node.children[dist >= 0.0f ? 0 : 1];
+    }
+    if (stats) {
+        stats->add(STAT_NODES_VISITED, nodes_visited);
     }
+    using leaves_size_t = decltype(m_leaves)::size_type;
     return m_leaves[static_cast<leaves_size_t>(~index)];
 }
 
@@ -735,48 +2213,389 @@ inline bool MapBSP46::is_cluster_visible(const std::int32_t cur_cluster,
     return m_vis_bitset[n] & (1 << (cluster & 7));
 }
 
-void MapBSP46::draw(const vec3& camera_pos, const GLFrustum<float>& frustum)
-    const
+void MapBSP46::draw(const vec3& camera_pos, const Frustum<float>& frustum,
+        FrameStats* stats) const
+{
+    cull(camera_pos, frustum, &m_draw_list);
+    stats->add(m_draw_list.stats);
+    submit(m_draw_list, stats);
+}
+
+// The queue's buffer is handed over to the list, and the list's old buffer
+// becomes the next queue, so a pair of lists culled in turn allocates
+// nothing once they have grown.
+void MapBSP46::cull(const vec3& camera_pos, const Frustum<float>& frustum,
+        DrawList* list) const
 {
-    const DLeaf_t& camera_leaf = find_leaf(camera_pos);
+    PROFILE_SCOPE("cull");
+    list->batch_runs.clear();
+    list->batch_counts.clear();
+    list->batch_offsets.clear();
+    list->stats = FrameStats();
+    FrameStats* const stats = &list->stats;
+    const DLeaf_t& camera_leaf = find_leaf(camera_pos, stats);
+    TreeWalk walk{&frustum, {camera_pos.x, camera_pos.y, camera_pos.z}, -1,
+        nullptr, nullptr};
+    begin_face_queue();
     if (camera_leaf.cluster < 0) {
-        draw(frustum);
-        return;
+        queue_tree(walk, stats);
+    }
+    else {
+        const ClusterVisSet* vis;
+        {
+            PROFILE_SCOPE("pvs_leaves");
+            vis = &get_cluster_vis(camera_leaf.cluster);
+        }
+        stats->add(STAT_LEAVES_IN_PVS, vis->leaves.size());
+        if (camera_leaf.area >= 0 && m_area_portals.get_num_portals() > 0) {
+            m_area_portals.write_area_bits(camera_leaf.area, &m_area_bits);
+            walk.area_bits = m_area_bits.data();
+        }
+        if (m_occlusion_culling) {
+            walk.occlusion = render_occluders(camera_pos, *vis, frustum,
+                    m_thread_pool, stats);
+        }
+        if (m_use_static_batches) {
+            queue_static_batches(camera_leaf.cluster, frustum,
+                    walk.area_bits, walk.occlusion, list);
+        }
+        else if (m_draw_order == DRAW_ORDER_FRONT_TO_BACK) {
+            walk.cluster = camera_leaf.cluster;
+            queue_tree(walk, stats);
+        }
+        else {
+            queue_cluster_vis(*vis, frustum, walk.area_bits, walk.occlusion,
+                    stats);
+        }
     }
+    cull_queued_faces(camera_pos, frustum, stats);
+    group_queued_faces();
+    list->faces.swap(m_draw_queue);
+}
 
-    leaf_ptr_vec_t leaf_ptrs;
-    for (auto&& leaf : m_leaves) {
-        if (is_cluster_visible(camera_leaf.cluster, leaf.cluster)) {
-            leaf_ptrs.push_back(&leaf);
+ClusterVisSet MapBSP46::build_cluster_vis(const std::int32_t cluster) const
+{
+    ClusterVisSet vis;
+    vis.cluster_offsets.push_back(0);
+    vis.leaf_offsets.push_back(0);
+
+    const auto num_clusters = static_cast<std::int32_t>(m_clusters.size());
+    for (std::int32_t i = 0; i < num_clusters; ++i) {
+        if (!is_cluster_visible(cluster, i)) {
+            continue;
+        }
+        const Cluster& c = m_clusters[static_cast<std::size_t>(i)];
+        for (auto j = c.first_leaf; j < c.first_leaf + c.num_leaves; ++j) {
+            const DLeaf_t& leaf = m_leaves[j];
+            if (leaf.num_leaf_faces == 0) {
+                continue;
+            }
+            vis.leaves.push_back(j);
+            const DLeafFace_t* leaf_face = m_leaf_faces.data() + leaf.leaf_face;
+            for (std::int32_t k = 0; k < leaf.num_leaf_faces; ++k) {
+                vis.faces.push_back(static_cast<std::uint32_t>(leaf_face[k].face));
+            }
+            vis.leaf_offsets.push_back(static_cast<std::uint32_t>(
+                        vis.faces.size()));
+        }
+        if (vis.leaves.size() != vis.cluster_offsets.back()) {
+            vis.clusters.push_back(static_cast<std::uint32_t>(i));
+            vis.cluster_offsets.push_back(static_cast<std::uint32_t>(
+                        vis.leaves.size()));
         }
     }
-    draw_leaves(leaf_ptrs, frustum);
+
+    for (auto face_index : vis.faces) {
+        if (m_occluder_areas[face_index] > 0.0f) {
+            vis.occluders.push_back(face_index);
+        }
+    }
+    std::sort(vis.occluders.begin(), vis.occluders.end());
+    vis.occluders.erase(std::unique(vis.occluders.begin(),
+                vis.occluders.end()), vis.occluders.end());
+    std::stable_sort(vis.occluders.begin(), vis.occluders.end(),
+            [this](const std::uint32_t a, const std::uint32_t b) {
+                return m_occluder_areas[a] > m_occluder_areas[b];
+            });
+    return vis;
 }
 
+const ClusterVisSet& MapBSP46::get_cluster_vis(const std::int32_t cluster) const
+{
+    const ClusterVisSet* vis = m_cluster_vis_cache.find(cluster);
+    if (vis) {
+        return *vis;
+    }
+    return m_cluster_vis_cache.insert(cluster, build_cluster_vis(cluster));
+}
+
+// Rasterizes the occluders of the PVS that face the camera from inside the
+// frustum, the `max_occluders` largest relative to their squared distance,
+// on the threads of `pool`. Returns nullptr when there are none.
+const OcclusionBuffer* MapBSP46::render_occluders(const vec3& camera_pos,
+        const ClusterVisSet& vis, const Frustum<float>& frustum,
+        ThreadPool* pool, FrameStats* stats) const
+{
+    PROFILE_SCOPE("occluders");
+    const std::int64_t start_ticks = get_ticks();
+    const FaceCullData& data = m_face_cull;
+    m_occluder_scratch.clear();
+    for (auto face_index : vis.occluders) {
+        const vec3 center(data.center[0][face_index],
+                data.center[1][face_index], data.center[2][face_index]);
+        const vec3 extent(data.extent[0][face_index],
+                data.extent[1][face_index], data.extent[2][face_index]);
+        const vec3 axis(data.axis[0][face_index], data.axis[1][face_index],
+                data.axis[2][face_index]);
+        const vec3 v = center - camera_pos;
+        unsigned plane_mask = frustum_all_planes;
+        if (v.dot(axis) > data.offset[face_index] ||
+                !frustum.is_aabb_visible(center - extent, center + extent,
+                    &plane_mask)) {
+            continue;
+        }
+        const float dist2 = v.dot(v) + 1.0f;
+        m_occluder_scratch.emplace_back(m_occluder_areas[face_index] / dist2,
+                face_index);
+    }
+    const std::size_t num_occluders =
+        std::min(m_occluder_scratch.size(), max_occluders);
+    std::partial_sort(m_occluder_scratch.begin(),
+            m_occluder_scratch.begin() + num_occluders,
+            m_occluder_scratch.end(),
+            [](const occluder_t& a, const occluder_t& b) {
+                return a.first > b.first;
+            });
+
+    m_occlusion.begin(frustum.get_clip_matrix());
+    for (std::size_t i = 0; i < num_occluders; ++i) {
+        const DFace_t& face = m_faces[m_occluder_scratch[i].second];
+        const DVertex_t* const vertex = m_vertices.data() + face.vertex;
+        for (std::uint32_t j = 2; j < face.num_vertices; ++j) {
+            m_occlusion.add_triangle(vertex[0].position,
+                    vertex[j - 1].position, vertex[j].position);
+        }
+    }
+    m_occlusion.rasterize(pool);
+
+    stats->add(STAT_OCCLUDERS, num_occluders);
+    stats->add(STAT_OCCLUSION_USEC, static_cast<std::uint64_t>(
+                (get_ticks() - start_ticks) / (TICKS_PER_SECOND / 1000000)));
+    return num_occluders ? &m_occlusion : nullptr;
+}
+
+// Clusters and leaves in areas not set in `area_bits`, if any, are dropped
+// first. The others are tested against the frustum and then against
+// `occlusion`, if any.
+void MapBSP46::queue_cluster_vis(const ClusterVisSet& vis,
+        const Frustum<float>& frustum, const std::uint8_t* area_bits,
+        const OcclusionBuffer* occlusion, FrameStats* stats) const
+{
+    PROFILE_SCOPE("frustum_leaves");
+    vec3 box_min, box_max;
+    for (std::size_t i = 0; i < vis.clusters.size(); ++i) {
+        const Cluster& cluster = m_clusters[vis.clusters[i]];
+        const auto first = vis.cluster_offsets[i];
+        const auto last = vis.cluster_offsets[i + 1];
+        if (is_area_culled(area_bits, cluster.area)) {
+            stats->add(STAT_LEAVES_AREA_CULLED, last - first);
+            continue;
+        }
+        unsigned plane_mask = frustum_all_planes;
+        if (!frustum.is_aabb_visible(cluster.mins, cluster.maxs,
+                    &plane_mask)) {
+            stats->add(STAT_CLUSTERS_CULLED);
+            stats->add(STAT_LEAVES_CULLED, last - first);
+            continue;
+        }
+        if (occlusion && !occlusion->is_aabb_visible(cluster.mins,
+                    cluster.maxs)) {
+            stats->add(STAT_CLUSTERS_OCCLUDED);
+            stats->add(STAT_LEAVES_OCCLUDED, last - first);
+            continue;
+        }
+        for (auto j = first; j < last; ++j) {
+            const DLeaf_t& leaf = m_leaves[vis.leaves[j]];
+            if (cluster.area < 0 && is_area_culled(area_bits, leaf.area)) {
+                stats->add(STAT_LEAVES_AREA_CULLED);
+                continue;
+            }
+            make_aabb(leaf.mins, leaf.maxs, &box_min, &box_max);
+            unsigned leaf_mask = plane_mask;
+            if (!frustum.is_aabb_visible(box_min, box_max, &leaf_mask)) {
+                stats->add(STAT_LEAVES_CULLED);
+                continue;
+            }
+            if (occlusion && !occlusion->is_aabb_visible(box_min, box_max)) {
+                stats->add(STAT_LEAVES_OCCLUDED);
+                continue;
+            }
+            for (auto k = vis.leaf_offsets[j]; k < vis.leaf_offsets[j + 1];
+                    ++k) {
+                queue_face(vis.faces[k]);
+            }
+        }
+    }
+}
+
+// Collects the leaves inside the frustum, those nearest to the camera
+// first: at each node the child on the camera's side of the plane is
+// visited before the other. Leaves in areas not set in `area_bits`, then
+// leaves of clusters not visible from `cluster`, are skipped; the walk
+// still visits every node in the frustum, as nodes know nothing of areas or
+// the PVS. Leaves inside the frustum are then tested against `occlusion`.
 void MapBSP46::collect_leaves(leaf_ptr_vec_t* leaf_ptrs, const int index,
-        const GLFrustum<float>& frustum) const
+        unsigned plane_mask, const TreeWalk& walk, FrameStats* stats) const
 {
     if (index < 0) {
         using leaves_size_t = decltype(m_leaves)::size_type;
-        leaf_ptrs->push_back(&m_leaves[static_cast<leaves_size_t>(~index)]);
+        const DLeaf_t& leaf = m_leaves[static_cast<leaves_size_t>(~index)];
+        if (is_area_culled(walk.area_bits, leaf.area)) {
+            stats->add(STAT_LEAVES_AREA_CULLED);
+            return;
+        }
+        if (walk.cluster >= 0 && (leaf.cluster < 0 ||
+                    !is_cluster_visible(walk.cluster, leaf.cluster))) {
+            return;
+        }
+        vec3 box_min, box_max;
+        make_aabb(leaf.mins, leaf.maxs, &box_min, &box_max);
+        if (!walk.frustum->is_aabb_visible(box_min, box_max, &plane_mask)) {
+            stats->add(STAT_LEAVES_CULLED);
+            return;
+        }
+        if (walk.occlusion &&
+                !walk.occlusion->is_aabb_visible(box_min, box_max)) {
+            stats->add(STAT_LEAVES_OCCLUDED);
+            return;
+        }
+        leaf_ptrs->push_back(&leaf);
         return;
     }
 
-    using nodes_size_t = decltype(m_nodes)::size_type;
-    const DNode_t& node = m_nodes[static_cast<nodes_size_t>(index)];
+    stats->add(STAT_NODES_VISITED);
+    const auto node_index = static_cast<std::size_t>(index);
+    const NodeBounds& bounds = m_node_bounds[node_index];
+    if (!walk.frustum->is_aabb_visible(bounds.mins, bounds.maxs,
+                &plane_mask)) {
+        return;
+    }
+    const TraversalNode& node = m_traversal_nodes[node_index];
+    const float* const camera = walk.camera;
+    const float dist = node.normal[0] * camera[0] +
+        node.normal[1] * camera[1] + node.normal[2] * camera[2] - node.dist;
+    const int near_child = dist >= 0.0f ? 0 : 1;
+    collect_leaves(leaf_ptrs, node.children[near_child], plane_mask, walk,
+            stats);
+    collect_leaves(leaf_ptrs, node.children[near_child ^ 1], plane_mask, walk,
+            stats);
+}
+
+void MapBSP46::queue_tree(const TreeWalk& walk, FrameStats* stats) const
+{
+    leaf_ptr_vec_t leaf_ptrs;
+    {
+        PROFILE_SCOPE("collect_leaves");
+        collect_leaves(&leaf_ptrs, 0, frustum_all_planes, walk, stats);
+    }
+    queue_leaves(leaf_ptrs);
+
+#if 0
+    glActiveTexture(GL_TEXTURE0_ARB);
+    glDisable(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE1_ARB);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
 
     vec3 box_min, box_max;
-    make_aabb(node.mins, node.maxs, &box_min, &box_max);
-    if (!frustum.is_aabb_visible(box_min, box_max)) {
+    for (auto&& node : m_nodes) {
+        make_aabb(node.mins, node.maxs, &box_min, &box_max);
+        if (frustum.is_aabb_visible(box_min, box_max)) {
+            glColor3f(0.0f, 1.0f, 0.0f);
+        }
+        else {
+            glColor3f(1.0f, 0.0f, 0.0f);
+        }
+        draw_aabb(box_min, box_max);
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE1_ARB);
+    glEnable(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE0_ARB);
+    glEnable(GL_TEXTURE_2D);
+#endif
+}
+
+void MapBSP46::cull_views(const std::vector<Frustum<float>>& views,
+        std::vector<leaf_ptr_vec_t>* leaf_ptrs) const
+{
+    PROFILE_SCOPE("cull_views");
+    if (views.size() > max_cull_views) {
+        throwf("Can't cull more than %zu views at once", max_cull_views);
+    }
+    leaf_ptrs->resize(views.size());
+    for (auto&& view_leaf_ptrs : *leaf_ptrs) {
+        view_leaf_ptrs.clear();
+    }
+    if (views.empty() || m_traversal_nodes.empty()) {
         return;
     }
-    collect_leaves(leaf_ptrs, node.front, frustum);
-    collect_leaves(leaf_ptrs, node.back, frustum);
+
+    unsigned plane_masks[max_cull_views];
+    std::fill_n(plane_masks, views.size(), frustum_all_planes);
+    const std::uint32_t views_left = static_cast<std::uint32_t>(
+            (std::uint64_t(1) << views.size()) - 1);
+    collect_view_leaves(leaf_ptrs, 0, plane_masks, views_left, views);
 }
 
-void MapBSP46::draw(const GLFrustum<float>& frustum) const
+// `views_left` has a bit set for each view the node may still be visible
+// in, with the plane masks of its parent in `parent_masks`.
+void MapBSP46::collect_view_leaves(std::vector<leaf_ptr_vec_t>* leaf_ptrs,
+        const int index, const unsigned* parent_masks, std::uint32_t views_left,
+        const std::vector<Frustum<float>>& views) const
 {
-    leaf_ptr_vec_t leaf_ptrs;
-    collect_leaves(&leaf_ptrs, 0, frustum);
-    draw_leaves(leaf_ptrs, frustum);
+    vec3 box_min, box_max;
+    const DLeaf_t* leaf = nullptr;
+    if (index < 0) {
+        using leaves_size_t = decltype(m_leaves)::size_type;
+        leaf = &m_leaves[static_cast<leaves_size_t>(~index)];
+        make_aabb(leaf->mins, leaf->maxs, &box_min, &box_max);
+    }
+    else {
+        const NodeBounds& bounds = m_node_bounds[static_cast<std::size_t>(
+                index)];
+        box_min = bounds.mins;
+        box_max = bounds.maxs;
+    }
+
+    unsigned plane_masks[max_cull_views];
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        const std::uint32_t bit = std::uint32_t(1) << i;
+        if (!(views_left & bit)) {
+            continue;
+        }
+        plane_masks[i] = parent_masks[i];
+        if (!views[i].is_aabb_visible(box_min, box_max, &plane_masks[i])) {
+            views_left &= ~bit;
+        }
+    }
+    if (!views_left) {
+        return;
+    }
+
+    if (leaf) {
+        for (std::size_t i = 0; i < views.size(); ++i) {
+            if (views_left & (std::uint32_t(1) << i)) {
+                (*leaf_ptrs)[i].push_back(leaf);
+            }
+        }
+        return;
+    }
+    const TraversalNode& node = m_traversal_nodes[static_cast<std::size_t>(
+            index)];
+    collect_view_leaves(leaf_ptrs, node.children[0], plane_masks, views_left,
+            views);
+    collect_view_leaves(leaf_ptrs, node.children[1], plane_masks, views_left,
+            views);
 }
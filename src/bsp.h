@@ -4,6 +4,9 @@
 #include <type_traits>
 #include <vector>
 #include <list>
+#include <memory>
+#include <string>
+#include <utility>
 #include <cstdint>
 
 #define GL_GLEXT_PROTOTYPES
@@ -12,12 +15,20 @@
 #include "src/ibsp46.h"
 #include "src/archive.h"
 #include "src/texture.h"
+#include "src/cluster_vis.h"
+#include "src/occlusion.h"
+#include "src/area_portals.h"
+#include "src/stats.h"
 #include "src/math/vector3.h"
 
 class BinaryIO;
+class ThreadPool;
+class TextureStreamer;
+class TextureRestorer;
+struct LoadedTexture;
 
 template <class T>
-class GLFrustum;
+class Frustum;
 
 class SimpleBezierSurface
 {
@@ -29,6 +40,23 @@ class SimpleBezierSurface
 
         void draw() const;
 
+        unsigned get_num_strips() const
+        {
+            return m_num_vertices - 1;
+        }
+
+        unsigned get_num_strip_vertices() const
+        {
+            return get_num_strips() * m_num_vertices * 2;
+        }
+
+        // The tessellated vertices, row by row, each row being
+        // get_num_strips() + 1 vertices long.
+        const std::vector<DVertex_t>& get_vertices() const
+        {
+            return m_vertices;
+        }
+
     private:
         unsigned                m_num_vertices;
         std::vector<DVertex_t>  m_vertices;
@@ -46,27 +74,175 @@ class GLBezierSurface
 
         void draw() const;
 
+        unsigned get_num_draw_calls() const
+        {
+            return m_num_draw_calls;
+        }
+
+        unsigned get_num_vertices() const
+        {
+            return m_num_vertices;
+        }
+
     private:
-        GLuint m_gl_list_id;
+        GLuint      m_gl_list_id;
+        unsigned    m_num_draw_calls;
+        unsigned    m_num_vertices;
 };
 
 class MapBSP46
 {
     public:
-        MapBSP46(const char* const, const PAK3Archive&);
+        // Textures are shared through `textures`, which must outlive the
+        // map. The archive must outlive the map as well, since evicted
+        // textures are reloaded from it. Textures are decoded on the threads
+        // of `pool`, if any, which is then used as by set_thread_pool().
+        MapBSP46(const char* const, const PAK3Archive&, TextureManager*,
+                ThreadPool* = nullptr);
         ~MapBSP46() noexcept;
 
         MapBSP46(const MapBSP46&) = delete;
         void operator=(const MapBSP46&) = delete;
 
-        void draw(const vec3&, const GLFrustum<float>&) const;
+        // Order in which draw() gathers the visible faces. Either way the
+        // faces are then grouped into batches by texture and lightmap, and
+        // the batches keep the order of their first face.
+        enum DrawOrder
+        {
+            DRAW_ORDER_CLUSTERS,        // Cluster by cluster, from the PVS.
+            DRAW_ORDER_FRONT_TO_BACK    // Down the tree, near child first.
+        };
+
+        void set_draw_order(const DrawOrder order)
+        {
+            m_draw_order = order;
+        }
+
+        DrawOrder get_draw_order() const
+        {
+            return m_draw_order;
+        }
+
+        // Optional CPU occlusion culling: the largest faces in view are
+        // rasterized into a coarse depth buffer, against which leaves and
+        // clusters of the PVS are tested before their faces are queued.
+        void set_occlusion_culling(const bool enable)
+        {
+            m_occlusion_culling = enable;
+        }
+
+        bool get_occlusion_culling() const
+        {
+            return m_occlusion_culling;
+        }
+
+        // Optional static batches: at the first call, planar and mesh faces
+        // are put in a world vertex and index buffer, grouped by cluster
+        // and state, and each cluster gets the list of batches in its PVS.
+        // A view is then drawn with a multi-draw call per state, culling
+        // whole batches. Needs the GL context.
+        void set_static_batches(const bool);
+
+        bool get_static_batches() const
+        {
+            return m_use_static_batches;
+        }
+
+        // Portals between the areas on either side of each door, all open
+        // at first. draw() skips leaves in areas not connected to the
+        // camera's.
+        AreaPortals& get_area_portals()
+        {
+            return m_area_portals;
+        }
+
+        const AreaPortals& get_area_portals() const
+        {
+            return m_area_portals;
+        }
+
+        // Area around `pos`, or -1 outside the map.
+        std::int32_t find_area(const vec3&) const;
+
+        // Bitset of the areas connected to the one around `pos`, for
+        // culling entities the way draw() culls leaves.
+        void get_area_bits(const vec3& pos, std::vector<std::uint8_t>* bits)
+            const
+        {
+            m_area_portals.write_area_bits(find_area(pos), bits);
+        }
+
+        // Threads for the parallel stages, or nullptr to run them on the
+        // calling thread. The pool must outlive its use by the map.
+        void set_thread_pool(ThreadPool* pool)
+        {
+            m_thread_pool = pool;
+        }
+
+        using face_index_size_t = std::common_type<
+            std::vector<DFace_t>::size_type,
+            std::vector<GLBezierSurface*>::size_type>::type;
+        using face_index_vec_t = std::vector<face_index_size_t>;
+
+        // The faces to draw for one view, in submission order, and the
+        // counters of finding them. Filled by cull() and only read by
+        // submit(), so one list may be submitted while the next is culled.
+        // With static batches, most faces are drawn as index ranges
+        // instead, in runs of the same state given by a face of the run
+        // and its number of ranges.
+        struct DrawList
+        {
+            face_index_vec_t            faces;
+            std::vector<std::pair<face_index_size_t, std::uint32_t>>
+                                        batch_runs;
+            std::vector<GLsizei>        batch_counts;
+            std::vector<const GLvoid*>  batch_offsets;
+            FrameStats                  stats;
+        };
+
+        // Culls and submits in one go.
+        void draw(const vec3&, const Frustum<float>&, FrameStats*) const;
+
+        // Finds the faces to draw without touching GL. Calls must not
+        // overlap each other or changes to the map's settings, but may run
+        // on another thread than submit().
+        void cull(const vec3&, const Frustum<float>&, DrawList*) const;
+
+        // Draws a culled list on the GL thread.
+        void submit(const DrawList&, FrameStats*) const;
+
+        // The list draw() culled last.
+        const DrawList& get_draw_list() const
+        {
+            return m_draw_list;
+        }
+
+        // With texture streaming, marks the textures of the list's faces as
+        // seen and uploads those loaded since the last call, within the
+        // frame's budget. Then uploads the textures the manager lowered to
+        // fit its limit that were drawn again and have been rebuilt since,
+        // within the same budget, queues those drawn again for rebuilding,
+        // and ends the manager's frame. Called on the GL thread once a
+        // frame.
+        void stream_textures(const DrawList&, FrameStats*);
+
+        using leaf_ptr_vec_t = std::vector<const DLeaf_t*>;
+
+        // Culls the leaves against up to 32 views in a single traversal of
+        // the node tree, e.g. for split screens or the faces of a cube map.
+        // (*leaf_ptrs)[i] receives the leaves inside views[i].
+        void cull_views(const std::vector<Frustum<float>>&,
+                std::vector<leaf_ptr_vec_t>*) const;
 
     private:
-        TextureManager              m_tex_mgr;
+        TextureManager*             m_tex_mgr;
+        const PAK3Archive&          m_pak;
 
         DHeader_t                   m_header;
         DDir_t                      m_directory;
 
+        std::string                 m_entities;
+        std::vector<DModel_t>       m_models;
         std::vector<DTexture_t>     m_textures;
         std::vector<DFace_t>        m_faces;
         std::vector<DVertex_t>      m_vertices;
@@ -84,16 +260,155 @@ class MapBSP46
 
         std::vector<GLuint>         m_texture_ids;
         std::vector<GLuint>         m_lightmap_ids;
+        std::vector<std::string>    m_texture_keys;
 
-        using leaf_ptr_vec_t = std::vector<const DLeaf_t*>;
+        // While textures stream in, faces whose texture isn't there yet are
+        // drawn with a 1x1 placeholder.
+        std::unique_ptr<TextureStreamer> m_texture_streamer;
+        GLuint                      m_placeholder_texture_id;
+        std::vector<std::uint32_t>  m_texture_face_counts;
+        std::int64_t                m_stream_start_ticks;
+        std::vector<GLuint>         m_restore_queue;
+        std::unique_ptr<TextureRestorer> m_texture_restorer;
 
-        using face_index_size_t = std::common_type<
-            decltype(m_faces)::size_type,
-            decltype(m_beziers)::size_type>::type;
-        using face_index_vec_t = std::vector<face_index_size_t>;
+        // Leaves are stored sorted by cluster, so that the leaves of a
+        // cluster are contiguous. m_leaf_remap maps a leaf index of the file
+        // to its index in m_leaves.
+        struct Cluster
+        {
+            std::uint32_t   first_leaf;
+            std::uint32_t   num_leaves;
+            vec3            mins;   // Bounds of the leaves that have faces.
+            vec3            maxs;
+            std::int32_t    area;   // Of all those leaves, or -1 if mixed.
+        };
+
+        std::vector<Cluster>        m_clusters;
+        std::vector<std::uint32_t>  m_leaf_remap;
+
+        AreaPortals                 m_area_portals;
+
+        // The node lump compiled for traversal, in depth-first order so that
+        // a node's front child directly follows it. The plane is inlined;
+        // `axis` is 0-2 for planes along an axis, where only that component
+        // of the normal is needed, and 3 otherwise. Children are encoded as
+        // in DNode_t. Bounds are kept apart as only culling needs them.
+        struct TraversalNode
+        {
+            float           normal[3];
+            float           dist;
+            std::int32_t    children[2];
+            std::int32_t    axis;
+            std::int32_t    padding;    // Two nodes per cache line.
+        };
+
+        struct NodeBounds
+        {
+            vec3            mins;
+            vec3            maxs;
+        };
+
+        std::vector<TraversalNode>  m_traversal_nodes;
+        std::vector<NodeBounds>     m_node_bounds;
+
+        // Per-face culling data in SoA form: the bounding box as center and
+        // half extents, and a cone around the normals of the face's visible
+        // sides (its axis and the cosine and sine of its half-angle). A face
+        // is facing away from a camera at `p` when, with v = center - p,
+        //
+        //     dot(v, axis) * cos - |cross(v, axis)| * sin > offset
+        //
+        // where `offset` is the radius of the box for curved faces. Planar
+        // faces have a cone of zero width, and their offset is the distance
+        // of the box center from the face plane, which makes the test exact.
+        // Faces that are never rejected have an infinite offset.
+        struct FaceCullData
+        {
+            std::vector<float>  center[3];
+            std::vector<float>  extent[3];
+            std::vector<float>  axis[3];
+            std::vector<float>  cos;
+            std::vector<float>  sin;
+            std::vector<float>  offset;
+        };
+
+        FaceCullData                m_face_cull;
+
+        // A batch holds the planar and mesh faces of a cluster with the
+        // same state, as a range of the world index buffer. Each face is
+        // in the batch of the first cluster it is in, and a cluster's list
+        // has the batches with a face in its PVS, ordered by state, and the
+        // other faces in its PVS, which are drawn one by one.
+        struct StaticBatch
+        {
+            face_index_size_t   face;       // First face, for the state.
+            std::int32_t        area;       // -1 if the faces span areas.
+            std::uint32_t       first_index;
+            std::uint32_t       num_indices;
+            vec3                mins;
+            vec3                maxs;
+        };
+
+        struct StaticBatches
+        {
+            std::vector<StaticBatch>    batches;
+            std::vector<std::uint32_t>  lists;
+            std::vector<std::uint32_t>  list_offsets;
+            face_index_vec_t            faces;
+            std::vector<std::uint32_t>  face_offsets;
+            std::vector<std::int32_t>   face_areas; // Per face of the map.
+            GLuint                      buffers[2]; // Vertices, indices.
+            std::size_t                 num_indices;
+
+            // Bytes of the batches and lists, besides the GL buffers.
+            std::size_t get_list_bytes() const
+            {
+                return batches.size() * sizeof(StaticBatch) +
+                    (lists.size() + list_offsets.size() +
+                     face_offsets.size()) * sizeof(std::uint32_t) +
+                    faces.size() * sizeof(face_index_size_t) +
+                    face_areas.size() * sizeof(std::int32_t);
+            }
+        };
+
+        StaticBatches               m_static_batches;
+
+        DrawOrder                   m_draw_order;
+        bool                        m_occlusion_culling;
+        bool                        m_use_static_batches;
+        ThreadPool*                 m_thread_pool;
+
+        // Faces with the same texture and lightmap share a state id, which
+        // indexes the per-state arrays below.
+        std::vector<std::uint32_t>  m_face_states;
+
+        // Area of each face that may serve as an occluder, 0 for others.
+        std::vector<float>          m_occluder_areas;
+
+        using occluder_t = std::pair<float, std::uint32_t>;   // Score, face.
+
+        // Per-frame scratch state, kept around to avoid reallocation.
+        // A face is queued at most once per frame: its stamp is set to the
+        // current frame's stamp when it is queued (Quake's "visframe").
+        mutable ClusterVisCache             m_cluster_vis_cache;
+        mutable std::vector<std::uint32_t>  m_face_stamps;
+        mutable std::uint32_t               m_frame_stamp;
+        mutable face_index_vec_t            m_draw_queue;
+        mutable face_index_vec_t            m_draw_scratch;
+        mutable std::vector<std::uint32_t>  m_state_stamps;
+        mutable std::vector<std::uint32_t>  m_state_batches;
+        mutable std::vector<std::uint32_t>  m_batch_offsets;
+        mutable std::vector<occluder_t>     m_occluder_scratch;
+        mutable OcclusionBuffer             m_occlusion;
+        mutable std::vector<std::uint8_t>   m_area_bits;
+        mutable std::vector<std::size_t>    m_chunk_kept;
+        mutable std::vector<FrameStats>     m_chunk_stats;
+        mutable DrawList                    m_draw_list;
 
         void bsp_read_header(BinaryIO*);
         void bsp_read_directory(BinaryIO*);
+        void bsp_read_entities(BinaryIO*);
+        void bsp_read_models(BinaryIO*);
         void bsp_read_textures(BinaryIO*);
         void bsp_read_faces(BinaryIO*);
         void bsp_read_vertices(BinaryIO*);
@@ -105,18 +420,73 @@ class MapBSP46
         void bsp_read_lightmaps(BinaryIO*);
         void bsp_read_vis_data(BinaryIO*);
 
+        void sort_leaves_by_cluster();
+        void compile_nodes();
+        std::int32_t compile_node(const std::int32_t);
+        void build_area_portals();
+        void find_box_areas(const std::int32_t, const vec3&, const vec3&,
+                std::int32_t[2]) const;
+        void build_face_cull_data();
+        void assign_face_states();
+        void find_occluders();
+        void build_static_batches();
+
         void load_textures(const PAK3Archive&);
-        void process_lightmaps();
+        GLuint add_texture(const LoadedTexture&, const std::string&);
+        void process_lightmaps(const char*, const PAK3Archive&);
+        void upload_streamed_textures(const DrawList&, FrameStats*);
+        void restore_textures(const std::uint64_t, FrameStats*);
+        void request_restore(const GLuint);
 
-        void draw_face(const face_index_size_t) const;
-        void draw_leaves(const leaf_ptr_vec_t&, const GLFrustum<float>&) const;
+        void bind_face_textures(const DFace_t&, FrameStats*) const;
+        void draw_face(const face_index_size_t, const bool, FrameStats*) const;
+        std::uint32_t draw_static_batches(const DrawList&, FrameStats*) const;
+        void queue_static_batches(const std::int32_t, const Frustum<float>&,
+                const std::uint8_t*, const OcclusionBuffer*, DrawList*) const;
 
-        const DLeaf_t& find_leaf(const vec3&) const;
+        void begin_face_queue() const;
+        void queue_face(const face_index_size_t) const;
+        void group_queued_faces() const;
+
+        void queue_leaves(const leaf_ptr_vec_t&) const;
+        void cull_queued_faces(const vec3&, const Frustum<float>&,
+                FrameStats*) const;
+        std::size_t cull_face_range(const std::size_t, const std::size_t,
+                const vec3&, const Frustum<float>&, FrameStats*) const;
+
+        const DLeaf_t& find_leaf(const vec3&, FrameStats* = nullptr) const;
         bool is_cluster_visible(const std::int32_t, const std::int32_t) const;
 
-        void collect_leaves(leaf_ptr_vec_t*, const int, const GLFrustum<float>&)
-            const;
-        void draw(const GLFrustum<float>&) const;
+        ClusterVisSet build_cluster_vis(const std::int32_t) const;
+        const ClusterVisSet& get_cluster_vis(const std::int32_t) const;
+        const OcclusionBuffer* render_occluders(const vec3&,
+                const ClusterVisSet&, const Frustum<float>&, ThreadPool*,
+                FrameStats*) const;
+        void queue_cluster_vis(const ClusterVisSet&, const Frustum<float>&,
+                const std::uint8_t*, const OcclusionBuffer*,
+                FrameStats*) const;
+
+        // What collect_leaves() culls the leaves against. Area, PVS and
+        // occlusion tests are skipped for null `area_bits`, a `cluster` of
+        // -1 and null `occlusion`.
+        struct TreeWalk
+        {
+            const Frustum<float>*   frustum;
+            float                   camera[3];
+            std::int32_t            cluster;
+            const std::uint8_t*     area_bits;
+            const OcclusionBuffer*  occlusion;
+        };
+
+        void collect_leaves(leaf_ptr_vec_t*, const int, unsigned,
+                const TreeWalk&, FrameStats*) const;
+        void queue_tree(const TreeWalk&, FrameStats*) const;
+
+        void collect_view_leaves(std::vector<leaf_ptr_vec_t>*, const int,
+                const unsigned*, std::uint32_t,
+                const std::vector<Frustum<float>>&) const;
+
+        friend class MapBench;
 };
 
 #endif
@@ -0,0 +1,36 @@
+#include <algorithm>
+
+#include "src/cluster_vis.h"
+
+ClusterVisCache::ClusterVisCache(const std::size_t capacity)
+    : m_capacity(std::max<std::size_t>(capacity, 1)), m_hits(0), m_misses(0)
+{}
+
+const ClusterVisSet* ClusterVisCache::find(const std::int32_t cluster)
+{
+    auto it = m_index.find(cluster);
+    if (it == m_index.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return &it->second->second;
+}
+
+const ClusterVisSet& ClusterVisCache::insert(const std::int32_t cluster,
+        ClusterVisSet set)
+{
+    auto it = m_index.find(cluster);
+    if (it != m_index.end()) {
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+    while (m_entries.size() >= m_capacity) {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+    m_entries.emplace_front(cluster, std::move(set));
+    m_index[cluster] = m_entries.begin();
+    return m_entries.front().second;
+}
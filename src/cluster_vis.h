@@ -0,0 +1,65 @@
+#ifndef Q3BSP__CLUSTER_VIS_H
+#define Q3BSP__CLUSTER_VIS_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+
+// Everything a camera in one cluster can potentially see, in CSR form: the
+// leaves of cluster `clusters[i]` are leaves[cluster_offsets[i]] up to, but
+// not including, leaves[cluster_offsets[i + 1]], and the faces of leaf
+// `leaves[j]` are faces[leaf_offsets[j]] up to faces[leaf_offsets[j + 1]].
+// Faces shared by several leaves appear once per leaf. Leaves without faces
+// and clusters without such leaves are left out. `occluders` lists the
+// faces fit for occlusion culling once each, largest first.
+struct ClusterVisSet
+{
+    std::vector<std::uint32_t> clusters;
+    std::vector<std::uint32_t> cluster_offsets;
+    std::vector<std::uint32_t> leaves;
+    std::vector<std::uint32_t> leaf_offsets;
+    std::vector<std::uint32_t> faces;
+    std::vector<std::uint32_t> occluders;
+};
+
+// Bounded LRU cache of ClusterVisSets, keyed by the camera's cluster.
+class ClusterVisCache
+{
+    public:
+        explicit ClusterVisCache(const std::size_t);
+
+        ClusterVisCache(const ClusterVisCache&) = delete;
+        void operator=(const ClusterVisCache&) = delete;
+
+        const ClusterVisSet* find(const std::int32_t);
+        const ClusterVisSet& insert(const std::int32_t, ClusterVisSet);
+
+        std::size_t get_capacity() const
+        {
+            return m_capacity;
+        }
+
+        std::uint64_t get_hits() const
+        {
+            return m_hits;
+        }
+
+        std::uint64_t get_misses() const
+        {
+            return m_misses;
+        }
+
+    private:
+        using entry_t = std::pair<std::int32_t, ClusterVisSet>;
+        using entry_list_t = std::list<entry_t>;
+
+        std::size_t                                             m_capacity;
+        entry_list_t                                            m_entries;
+        std::unordered_map<std::int32_t, entry_list_t::iterator> m_index;
+        std::uint64_t                                           m_hits;
+        std::uint64_t                                           m_misses;
+};
+
+#endif
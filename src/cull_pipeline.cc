@@ -0,0 +1,80 @@
+#include "src/cull_pipeline.h"
+#include "src/profile.h"
+#include "src/math/util.h"
+
+CullPipeline::CullPipeline(const MapBSP46& map)
+    : m_map(map), m_ready(-1), m_busy(false), m_done(false)
+{
+    m_thread = std::thread(&CullPipeline::work, this);
+}
+
+CullPipeline::~CullPipeline() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+const CullPipeline::Frame& CullPipeline::advance(const vec3& position,
+        const mat4& projection, const mat4& modelview)
+{
+    wait_idle();
+    if (m_ready < 0) {
+        m_ready = 0;
+        Frame& frame = m_frames[0];
+        frame.position = position;
+        frame.projection = projection;
+        frame.modelview = modelview;
+        cull(&frame);
+        return frame;
+    }
+
+    Frame& next = m_frames[m_ready ^ 1];
+    next.position = position;
+    next.projection = projection;
+    next.modelview = modelview;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy = true;
+    }
+    m_wake.notify_one();
+    return m_frames[m_ready];
+}
+
+void CullPipeline::wait_idle()
+{
+    PROFILE_SCOPE("wait_cull");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_busy) {
+        m_idle.wait(lock, [this] { return !m_busy; });
+        m_ready ^= 1;
+    }
+}
+
+void CullPipeline::cull(Frame* frame) const
+{
+    m_map.cull(frame->position,
+            Frustum<float>(frame->projection, frame->modelview),
+            &frame->list);
+}
+
+void CullPipeline::work()
+{
+    profile_set_thread_name("cull");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this] { return m_done || m_busy; });
+        if (m_done) {
+            return;
+        }
+        Frame* const frame = &m_frames[m_ready ^ 1];
+        lock.unlock();
+        cull(frame);
+        lock.lock();
+        m_busy = false;
+        m_idle.notify_one();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef Q3BSP__CULL_PIPELINE_H
+#define Q3BSP__CULL_PIPELINE_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "src/bsp.h"
+#include "src/math/vector3.h"
+#include "src/math/matrix4.h"
+
+// Culls the map on a thread of its own, one frame ahead of the GL thread:
+// while frame N is submitted, frame N+1 is culled into the other of two
+// draw lists. A frame costs about the longer of culling and submission
+// rather than their sum, at the price of one frame of latency, as each
+// frame draws the view given to the previous call of advance().
+class CullPipeline
+{
+    public:
+        // A view and the draw list culled for it.
+        struct Frame
+        {
+            vec3                position;
+            mat4                projection;
+            mat4                modelview;
+            MapBSP46::DrawList  list;
+        };
+
+        explicit CullPipeline(const MapBSP46&);
+        ~CullPipeline() noexcept;
+
+        CullPipeline(const CullPipeline&) = delete;
+        void operator=(const CullPipeline&) = delete;
+
+        // Starts culling the given view and returns the frame of the last
+        // view, which stays valid until the next call. The first call culls
+        // its view on the calling thread and returns it.
+        const Frame& advance(const vec3&, const mat4&, const mat4&);
+
+        // Waits for the culling in flight, if any. The map's settings must
+        // only change in between this and the next advance().
+        void wait_idle();
+
+    private:
+        const MapBSP46&             m_map;
+        Frame                       m_frames[2];
+        int                         m_ready;    // Last culled frame, or -1.
+
+        std::thread                 m_thread;
+        std::mutex                  m_mutex;
+        std::condition_variable     m_wake;
+        std::condition_variable     m_idle;
+
+        // Guarded by m_mutex.
+        bool                        m_busy;     // The other frame is culled.
+        bool                        m_done;
+
+        void cull(Frame*) const;
+        void work();
+};
+
+#endif
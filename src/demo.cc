@@ -0,0 +1,133 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "src/demo.h"
+#include "src/exception.h"
+#include "src/time.h"
+
+namespace
+{
+    const char* const demo_magic = "Q3BSPDEMO";
+    const int demo_version = 1;
+
+    double ticks_to_msec(const std::int64_t ticks)
+    {
+        return ticks * 1000.0 / TICKS_PER_SECOND;
+    }
+
+    // Nearest-rank percentile of an ascending sequence.
+    std::int64_t percentile(const std::vector<std::int64_t>& sorted,
+            const double p)
+    {
+        const auto n = sorted.size();
+        auto rank = static_cast<decltype(sorted.size())>(
+                std::ceil(p / 100.0 * n));
+        if (rank > 0) {
+            --rank;
+        }
+        return sorted[std::min(rank, n - 1)];
+    }
+}
+
+DemoRecorder::DemoRecorder(const char* filename, const char* map_name)
+    : m_filename(filename), m_stream(filename)
+{
+    if (!m_stream) {
+        throwf("%s: Couldn't open demo file for writing", filename);
+    }
+    m_stream << demo_magic << " " << demo_version << " " << map_name << "\n";
+    m_stream << std::setprecision(std::numeric_limits<float>::max_digits10);
+}
+
+void DemoRecorder::add(const DemoFrame& frame)
+{
+    m_stream <<
+        frame.position.x << " " <<
+        frame.position.y << " " <<
+        frame.position.z << " " <<
+        frame.yaw << " " <<
+        frame.pitch << "\n";
+    if (!m_stream) {
+        throwf("%s: Couldn't write demo frame", m_filename.c_str());
+    }
+}
+
+demo_frame_vec_t load_demo(const char* filename, const char* map_name)
+{
+    std::ifstream stream(filename);
+    if (!stream) {
+        throwf("%s: Couldn't open demo file", filename);
+    }
+
+    std::string magic, demo_map_name;
+    int version = 0;
+    stream >> magic >> version >> demo_map_name;
+    if (!stream || magic != demo_magic) {
+        throwf("%s: Not a demo file", filename);
+    }
+    if (version != demo_version) {
+        throwf("%s: Unsupported demo version %d", filename, version);
+    }
+    if (demo_map_name != map_name) {
+        std::cout << filename << ": Warning: demo was recorded on " <<
+            demo_map_name << ", not " << map_name << std::endl;
+    }
+
+    demo_frame_vec_t frames;
+    DemoFrame frame;
+    while (stream >>
+            frame.position.x >>
+            frame.position.y >>
+            frame.position.z >>
+            frame.yaw >>
+            frame.pitch) {
+        frames.push_back(frame);
+    }
+    if (!stream.eof()) {
+        throwf("%s: Malformed demo frame %zu", filename, frames.size() + 1);
+    }
+    if (frames.empty()) {
+        throwf("%s: Demo contains no frames", filename);
+    }
+    return frames;
+}
+
+void FrameTimeStats::write_json(std::ostream& os,
+        const std::int64_t budget_ticks) const
+{
+    std::vector<std::int64_t> sorted(m_frame_ticks);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::int64_t total_ticks = 0;
+    std::size_t over_budget = 0;
+    for (auto ticks : sorted) {
+        total_ticks += ticks;
+        if (ticks > budget_ticks) {
+            ++over_budget;
+        }
+    }
+
+    const auto n = sorted.size();
+    const double total_sec = total_ticks / double(TICKS_PER_SECOND);
+
+    os << std::fixed << std::setprecision(3);
+    os << "{\n";
+    os << "  \"frames\": " << n << ",\n";
+    os << "  \"total_sec\": " << total_sec << ",\n";
+    os << "  \"avg_fps\": " << (total_sec > 0.0 ? n / total_sec : 0.0) << ",\n";
+    os << "  \"frame_ms\": {\n";
+    if (n > 0) {
+        os << "    \"avg\": " << ticks_to_msec(total_ticks) / n << ",\n";
+        os << "    \"p50\": " << ticks_to_msec(percentile(sorted, 50.0)) << ",\n";
+        os << "    \"p90\": " << ticks_to_msec(percentile(sorted, 90.0)) << ",\n";
+        os << "    \"p99\": " << ticks_to_msec(percentile(sorted, 99.0)) << ",\n";
+        os << "    \"max\": " << ticks_to_msec(sorted.back()) << "\n";
+    }
+    os << "  },\n";
+    os << "  \"budget_ms\": " << ticks_to_msec(budget_ticks) << ",\n";
+    os << "  \"frames_over_budget\": " << over_budget << "\n";
+    os << "}" << std::endl;
+}
@@ -0,0 +1,67 @@
+#ifndef Q3BSP__DEMO_H
+#define Q3BSP__DEMO_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <cstdint>
+
+#include "src/math/vector3.h"
+
+struct DemoFrame
+{
+    vec3    position;
+    float   yaw;
+    float   pitch;
+};
+
+using demo_frame_vec_t = std::vector<DemoFrame>;
+
+// Camera path file: a header line followed by one
+// "<x> <y> <z> <yaw> <pitch>" line per frame.
+class DemoRecorder
+{
+    public:
+        DemoRecorder(const char*, const char*);
+
+        DemoRecorder(const DemoRecorder&) = delete;
+        void operator=(const DemoRecorder&) = delete;
+
+        void add(const DemoFrame&);
+
+    private:
+        std::string     m_filename;
+        std::ofstream   m_stream;
+};
+
+extern demo_frame_vec_t load_demo(const char*, const char*);
+
+class FrameTimeStats
+{
+    public:
+        FrameTimeStats()
+        {}
+
+        void reserve(const std::size_t n)
+        {
+            m_frame_ticks.reserve(n);
+        }
+
+        void add(const std::int64_t ticks)
+        {
+            m_frame_ticks.push_back(ticks);
+        }
+
+        std::size_t get_frames() const
+        {
+            return m_frame_ticks.size();
+        }
+
+        void write_json(std::ostream&, const std::int64_t) const;
+
+    private:
+        std::vector<std::int64_t> m_frame_ticks;
+};
+
+#endif
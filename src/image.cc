@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <memory>
 #include <map>
 #include <cstring>
@@ -22,8 +23,21 @@ namespace
         {".jpg", decode_jpg}
     };
 
+    // Converts straight into the image's pixels. Surfaces SDL_ConvertPixels
+    // doesn't take, e.g. those with a palette, are converted to a surface
+    // first.
     Image make_image_from_surface(surf_uptr_t surf)
     {
+        const auto width = static_cast<unsigned>(surf->w);
+        const auto height = static_cast<unsigned>(surf->h);
+        pixel_vector_t pixels(std::size_t(width) * height);
+        if (SDL_ConvertPixels(surf->w, surf->h, surf->format->format,
+                    surf->pixels, surf->pitch, SDL_PIXELFORMAT_RGBA32,
+                    pixels.data(),
+                    static_cast<int>(width * sizeof(pixel_t))) == 0) {
+            return Image(width, height, std::move(pixels));
+        }
+
         SDL_PixelFormat fmt;
         fmt.format = SDL_PIXELFORMAT_RGBA8888;
         fmt.palette = nullptr;
@@ -42,8 +56,10 @@ namespace
                 c->pixels);
     }
 
+    // Adds the bytes of the surface decoded to `surface_bytes`, if any.
     Image decode_with(load_func_t load_func,
-            const std::vector<std::uint8_t>& buf, const char* load_func_name)
+            const std::vector<std::uint8_t>& buf, const char* load_func_name,
+            std::size_t* surface_bytes = nullptr)
     {
         SDL_RWops* ops = SDL_RWFromConstMem(buf.data(),
                 static_cast<int>(buf.size()));
@@ -51,17 +67,132 @@ namespace
         if (!surf) {
             throwf("%s: %s", load_func_name, IMG_GetError());
         }
+        if (surface_bytes) {
+            *surface_bytes += std::size_t(surf->pitch) *
+                static_cast<std::size_t>(surf->h);
+        }
         return make_image_from_surface(std::move(surf));
     }
+
+    enum TGAType
+    {
+        TGA_TYPE_TRUE_COLOR = 2,
+        TGA_TYPE_GRAY = 3,
+        TGA_TYPE_RLE_TRUE_COLOR = 10,
+        TGA_TYPE_RLE_GRAY = 11
+    };
+
+    const std::size_t tga_header_size = 18;
+    const std::uint8_t tga_origin_right = 0x10;
+    const std::uint8_t tga_origin_top = 0x20;
+
+    std::uint16_t read_u16le(const std::uint8_t* p)
+    {
+        return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+    }
+}
+
+// Pixels are written as they are read, rows flipped for the bottom-left
+// origin. Runs and raw packets may span rows.
+bool decode_tga_native(const std::vector<std::uint8_t>& buf, Image* image)
+{
+    if (buf.size() < tga_header_size) {
+        throwf("decode_tga: Truncated header");
+    }
+    const std::uint8_t* const header = buf.data();
+    const unsigned type = header[2];
+    const unsigned depth = header[16];
+    const std::uint8_t descriptor = header[17];
+    const bool gray = type == TGA_TYPE_GRAY || type == TGA_TYPE_RLE_GRAY;
+    const bool rle = type == TGA_TYPE_RLE_TRUE_COLOR ||
+        type == TGA_TYPE_RLE_GRAY;
+    if (header[1] != 0 || (descriptor & tga_origin_right) ||
+            (type != TGA_TYPE_TRUE_COLOR && !gray && !rle) ||
+            (gray && depth != 8) ||
+            (!gray && depth != 24 && depth != 32)) {
+        return false;
+    }
+
+    const unsigned width = read_u16le(header + 12);
+    const unsigned height = read_u16le(header + 14);
+    if (width == 0 || height == 0) {
+        throwf("decode_tga: Bad dimensions");
+    }
+    const std::size_t bpp = depth / 8;
+    const std::size_t num_pixels = std::size_t(width) * height;
+    const std::uint8_t* p = header + tga_header_size + header[0];
+    const std::uint8_t* const end = buf.data() + buf.size();
+    // A run packet of 1 + bpp bytes covers at most 128 pixels.
+    if (p > end || (!rle && std::size_t(end - p) < num_pixels * bpp) ||
+            (rle && std::size_t(end - p) / (1 + bpp) * 128 < num_pixels)) {
+        throwf("decode_tga: Truncated image data");
+    }
+
+    pixel_vector_t pixels(num_pixels);
+    const bool flip = !(descriptor & tga_origin_top);
+    const auto row = [&](const unsigned y) {
+        return pixels.data() + std::size_t(flip ? height - 1 - y : y) *
+            width;
+    };
+    const auto read_pixel = [&](const std::uint8_t* q) {
+        if (gray) {
+            return pixel_t{q[0], q[0], q[0], 255};
+        }
+        return pixel_t{q[2], q[1], q[0],
+            static_cast<std::uint8_t>(bpp == 4 ? q[3] : 255)};
+    };
+
+    unsigned x = 0;
+    unsigned y = 0;
+    pixel_t* dst = row(0);
+    for (std::size_t n = 0; n < num_pixels; ) {
+        std::size_t count = num_pixels - n;
+        bool run = false;
+        if (rle) {
+            if (p == end) {
+                throwf("decode_tga: Truncated image data");
+            }
+            run = (*p & 0x80) != 0;
+            count = std::min<std::size_t>((*p & 0x7f) + 1u, count);
+            ++p;
+        }
+        if (std::size_t(end - p) < (run ? 1 : count) * bpp) {
+            throwf("decode_tga: Truncated image data");
+        }
+        const pixel_t value = read_pixel(p);
+        for (std::size_t i = 0; i < count; ++i) {
+            dst[x] = run ? value : read_pixel(p + i * bpp);
+            if (++x == width) {
+                x = 0;
+                if (++y < height) {
+                    dst = row(y);
+                }
+            }
+        }
+        p += (run ? 1 : count) * bpp;
+        n += count;
+    }
+    *image = Image(width, height, std::move(pixels));
+    return true;
 }
 
 #define DECODE_WITH(func_name, buf) decode_with((func_name), (buf), #func_name)
 
 Image decode_tga(const std::vector<std::uint8_t>& buf)
 {
+    Image image;
+    if (decode_tga_native(buf, &image)) {
+        return image;
+    }
     return DECODE_WITH(IMG_LoadTGA_RW, buf);
 }
 
+Image decode_tga_sdl(const std::vector<std::uint8_t>& buf,
+        std::size_t* surface_bytes)
+{
+    return decode_with(IMG_LoadTGA_RW, buf, "IMG_LoadTGA_RW", surface_bytes);
+}
+
 Image decode_jpg(const std::vector<std::uint8_t>& buf)
 {
     return DECODE_WITH(IMG_LoadJPG_RW, buf);
@@ -78,7 +209,6 @@ Image decode_by_extension(const std::vector<std::uint8_t>& buf,
 Image::Image(const unsigned width, const unsigned height, const void* raw_pixels)
     : m_width(width), m_height(height)
 {
-    typename pixel_vector_t::size_type size = width * height * sizeof(pixel_t);
-    m_pixels = pixel_vector_t(size);
-    std::memcpy(m_pixels.data(), raw_pixels, size);
+    m_pixels = pixel_vector_t(std::size_t(width) * height);
+    std::memcpy(m_pixels.data(), raw_pixels, m_pixels.size() * sizeof(pixel_t));
 }
@@ -2,7 +2,9 @@
 #define Q3BSP__IMAGE_H
 
 #include <vector>
+#include <string>
 #include <utility>
+#include <cstddef>
 #include <cstdint>
 
 using pixel_t = struct SPixel
@@ -56,7 +58,18 @@ class Image
 
 };
 
+// Decodes the TGAs decode_tga_native() takes itself, the others through
+// SDL_image.
 extern Image decode_tga(const std::vector<std::uint8_t>&);
+
+// Decodes uncompressed and RLE TGAs, 8-bit gray or 24- or 32-bit color and
+// not right to left, straight into the image. Returns false for the others.
+extern bool decode_tga_native(const std::vector<std::uint8_t>&, Image*);
+
+// Decodes through SDL_image alone, adding the bytes of the intermediate
+// surface to the count, e.g. to compare with decode_tga_native().
+extern Image decode_tga_sdl(const std::vector<std::uint8_t>&, std::size_t*);
+
 extern Image decode_jpg(const std::vector<std::uint8_t>&);
 extern Image decode_by_extension(const std::vector<std::uint8_t>&, std::string);
 
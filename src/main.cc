@@ -1,17 +1,39 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <fstream>
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
 
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
-#include <GL/glu.h>
 
 #include "src/exception.h"
 #include "src/bsp.h"
+#include "src/bench.h"
+#include "src/cull_pipeline.h"
+#include "src/mipmap.h"
+#include "src/texture_loader.h"
+#include "src/texture_streamer.h"
+#include "src/upload_ring.h"
 #include "src/archive.h"
+#include "src/demo.h"
+#include "src/profile.h"
+#include "src/stats.h"
+#include "src/overlay.h"
+#include "src/thread_pool.h"
 #include "src/time.h"
 #include "src/math/vector3.h"
 #include "src/math/vector4.h"
@@ -27,17 +49,41 @@ class Render
         void new_frame() const;
         void end_frame() const;
 
+        void draw_text(const std::vector<std::string>&) const;
+
         void resize(int, int);
 
+        // Counts the samples passing the depth test between the two calls,
+        // in an occlusion query. To not stall on the GPU, end_samples_query()
+        // returns the count of the previous query, or 0 for the first one.
+        void begin_samples_query();
+        std::uint64_t end_samples_query();
+
+        std::uint64_t get_num_pixels() const
+        {
+            return static_cast<std::uint64_t>(m_width) *
+                static_cast<std::uint64_t>(m_height);
+        }
+
+        const mat4& get_projection() const
+        {
+            return m_projection;
+        }
+
     private:
         int             m_width;
         int             m_height;
+        mat4            m_projection;
         SDL_Window*     m_window;
         SDL_GLContext   m_context;
+        GLuint          m_samples_queries[2];
+        int             m_samples_query;
+        bool            m_samples_pending;
 };
 
 Render::Render(const int width, const int height)
-    : m_width(width), m_height(height)
+    : m_width(width), m_height(height), m_samples_query(0),
+    m_samples_pending(false)
 {
     m_window = SDL_CreateWindow(
             "q3bsp",
@@ -81,11 +127,14 @@ Render::Render(const int width, const int height)
     glEnable(GL_TEXTURE_2D);
     glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
 
+    glGenQueries(2, m_samples_queries);
+
     resize(m_width, m_height);
 }
 
 Render::~Render() noexcept
 {
+    glDeleteQueries(2, m_samples_queries);
     SDL_GL_DeleteContext(m_context);
 }
 
@@ -94,10 +143,13 @@ void Render::resize(int width, int height)
     m_width = width;
     m_height = height;
 
+    m_projection = mat4();
+    mat4_perspective(m_projection, 75.0f, m_width / float(m_height), 4.0f,
+            15000.0f);
+
     glViewport(0, 0, m_width, m_height);
     glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(75.0, m_width / double(m_height), 4.0, 15000.0);
+    glLoadMatrixf(m_projection.get_floats());
 }
 
 void Render::new_frame() const
@@ -105,8 +157,34 @@ void Render::new_frame() const
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+void Render::begin_samples_query()
+{
+    glBeginQuery(GL_SAMPLES_PASSED, m_samples_queries[m_samples_query]);
+}
+
+std::uint64_t Render::end_samples_query()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    m_samples_query ^= 1;
+    const bool pending = m_samples_pending;
+    m_samples_pending = true;
+    if (!pending) {
+        return 0;
+    }
+    GLuint samples = 0;
+    glGetQueryObjectuiv(m_samples_queries[m_samples_query], GL_QUERY_RESULT,
+            &samples);
+    return samples;
+}
+
+void Render::draw_text(const std::vector<std::string>& lines) const
+{
+    draw_text_overlay(lines, m_width, m_height);
+}
+
 void Render::end_frame() const
 {
+    PROFILE_SCOPE("swap");
     SDL_GL_SwapWindow(m_window);
 }
 
@@ -130,14 +208,27 @@ class Simulation
 
 namespace
 {
-    void process_events(bool* done, Render* render, float* yaw, float* pitch,
-            float*)
+    struct Commands
+    {
+        bool done = false;
+        bool dump_trace = false;
+        bool toggle_overlay = false;
+        bool toggle_draw_order = false;
+        bool toggle_occlusion = false;
+        bool toggle_area_portals = false;
+        bool toggle_static_batches = false;
+        bool next_map = false;
+    };
+
+    void process_events(Commands* commands, Render* render, float* yaw,
+            float* pitch, float*)
     {
+        PROFILE_SCOPE("events");
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
                 case SDL_QUIT: {
-                    *done = true;
+                    commands->done = true;
                     break;
                 }
                 case SDL_WINDOWEVENT: {
@@ -152,11 +243,32 @@ namespace
                 }
                 case SDL_KEYUP: {
                     if (event.key.keysym.sym == SDLK_ESCAPE) {
-                        *done = true;
+                        commands->done = true;
                     }
                     else if (event.key.keysym.sym == SDLK_f) {
                         SDL_SetRelativeMouseMode(SDL_FALSE);
                     }
+                    else if (event.key.keysym.sym == SDLK_F1) {
+                        commands->toggle_overlay = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F2) {
+                        commands->toggle_draw_order = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F3) {
+                        commands->toggle_occlusion = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F4) {
+                        commands->toggle_area_portals = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F5) {
+                        commands->toggle_static_batches = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F6) {
+                        commands->next_map = true;
+                    }
+                    else if (event.key.keysym.sym == SDLK_F12) {
+                        commands->dump_trace = true;
+                    }
                     break;
                 }
                 case SDL_MOUSEBUTTONDOWN: {
@@ -185,6 +297,29 @@ namespace
         }
     }
 
+    struct Options
+    {
+        const char* record_filename = nullptr;
+        const char* timedemo_filename = nullptr;
+        const char* report_filename = nullptr;
+        const char* trace_filename = "q3bsp-trace.json";
+        const char* startup_trace_filename = "q3bsp-startup.json";
+        const char* metrics_filename = nullptr;
+        float       metrics_interval_sec = 1.0f;
+        bool        run_benchmarks = false;
+        bool        front_to_back = false;
+        bool        occlusion_culling = false;
+        bool        pipelined_culling = false;
+        bool        static_batches = false;
+        MipOptions  mip_options;
+        TextureCompression texture_compression;
+        TextureStreaming texture_streaming;
+        std::size_t texture_cache_mb = 128;
+        std::size_t texture_limit_mb = 0;
+        std::size_t upload_ring_mb = 0;
+        float       frame_budget_ms = 1000.0f / 60.0f;
+    };
+
     float step()
     {
         static std::uint64_t total_frames = 0;
@@ -214,7 +349,23 @@ namespace
         return dt;
     }
 
-    mat4 simulate(const float dt, const mat4& mdir, Simulation* sim)
+    mat4 camera_rotation(const float yaw, const float pitch, const float roll)
+    {
+        mat4 mdir;
+        mat4_rotate_y(mdir, yaw);
+        mat4_rotate_x(mdir, pitch);
+        mat4_rotate_z(mdir, roll);
+        return mdir;
+    }
+
+    mat4 camera_matrix(const vec3& position, const mat4& mdir)
+    {
+        mat4 mat;
+        mat4_translate(mat, -position.x, -position.y, -position.z);
+        return mat * mdir;
+    }
+
+    void simulate(const float dt, const mat4& mdir, Simulation* sim)
     {
         const Uint8* keys = SDL_GetKeyboardState(nullptr);
         vec4 movement;
@@ -237,62 +388,537 @@ namespace
             movement += vec4(0.0f, -1.0f, 0.0f);
         }
         sim->step(vec3(movement), dt * 50.0f);
+    }
 
-        mat4 mat;
-        mat4_translate(mat, -sim->position.x, -sim->position.y, -sim->position.z);
-        return mat * mdir;
+    // Collects the renderer's per-frame counters, shows them in the overlay
+    // and periodically rewrites the metrics file.
+    class StatsReporter
+    {
+        public:
+            explicit StatsReporter(const Options& opts)
+                : m_metrics_filename(opts.metrics_filename),
+                m_metrics_interval(static_cast<std::int64_t>(
+                            opts.metrics_interval_sec * TICKS_PER_SECOND)),
+                m_last_write(get_ticks()), m_show_overlay(false)
+            {}
+
+            void add(const FrameStats& frame)
+            {
+                m_stats.add(frame);
+                if (m_metrics_filename &&
+                        get_ticks() - m_last_write >= m_metrics_interval) {
+                    if (!m_stats.write_prometheus(m_metrics_filename)) {
+                        std::cerr << m_metrics_filename <<
+                            ": Couldn't write metrics file" << std::endl;
+                    }
+                    m_last_write = get_ticks();
+                }
+            }
+
+            void toggle_overlay()
+            {
+                m_show_overlay = !m_show_overlay;
+            }
+
+            // Depth complexity is the average number of samples passing the
+            // depth test per pixel, i.e. how often each pixel is shaded.
+            // The occluded share is of the leaves in the PVS.
+            void draw_overlay(const Render& render) const
+            {
+                if (m_show_overlay) {
+                    std::vector<std::string> lines = m_stats.format_lines();
+                    char buf[64];
+                    std::snprintf(buf, sizeof(buf), "%-14s %8s %8.2f",
+                            "DEPTH CPLX", "", m_stats.get_average(
+                                STAT_SAMPLES_PASSED) / render.get_num_pixels());
+                    lines.push_back(buf);
+                    const double in_pvs =
+                        m_stats.get_average(STAT_LEAVES_IN_PVS);
+                    std::snprintf(buf, sizeof(buf), "%-14s %8s %8.1f",
+                            "OCCLUDED %", "", in_pvs > 0.0 ? 100.0 *
+                            m_stats.get_average(STAT_LEAVES_OCCLUDED) /
+                            in_pvs : 0.0);
+                    lines.push_back(buf);
+                    render.draw_text(lines);
+                }
+            }
+
+        private:
+            RenderStats         m_stats;
+            const char*         m_metrics_filename;
+            const std::int64_t  m_metrics_interval;
+            std::int64_t        m_last_write;
+            bool                m_show_overlay;
+    };
+
+    // With a pipeline, the view is handed over for culling and the frame
+    // culled from the last view is drawn.
+    void draw_frame(Render& render, MapBSP46& map, const vec3& position,
+            const mat4& mat, CullPipeline* pipeline, StatsReporter* reporter)
+    {
+        render.new_frame();
+        glMatrixMode(GL_MODELVIEW);
+        FrameStats frame_stats;
+        if (pipeline) {
+            const CullPipeline::Frame& frame =
+                pipeline->advance(position, render.get_projection(), mat);
+            glLoadMatrixf(frame.modelview.get_floats());
+            frame_stats.add(frame.list.stats);
+            PROFILE_SCOPE("draw");
+            render.begin_samples_query();
+            map.submit(frame.list, &frame_stats);
+            frame_stats.add(STAT_SAMPLES_PASSED, render.end_samples_query());
+            map.stream_textures(frame.list, &frame_stats);
+        }
+        else {
+            glLoadMatrixf(mat.get_floats());
+            PROFILE_SCOPE("draw");
+            render.begin_samples_query();
+            map.draw(position, Frustum<float>(render.get_projection(), mat),
+                    &frame_stats);
+            frame_stats.add(STAT_SAMPLES_PASSED, render.end_samples_query());
+            map.stream_textures(map.get_draw_list(), &frame_stats);
+        }
+        reporter->add(frame_stats);
+        reporter->draw_overlay(render);
+        render.end_frame();
+    }
+
+    void dump_trace(const Options& opts)
+    {
+        if (profile_export_chrome_trace(opts.trace_filename)) {
+            std::cout << "\nWrote trace to " << opts.trace_filename <<
+                std::endl;
+        }
+        else {
+            std::cout << "\nCouldn't write trace to " << opts.trace_filename <<
+                " (profiling needs a build with Q3BSP_PROFILE)" << std::endl;
+        }
+    }
+
+    void toggle_draw_order(MapBSP46* map)
+    {
+        if (map->get_draw_order() == MapBSP46::DRAW_ORDER_CLUSTERS) {
+            map->set_draw_order(MapBSP46::DRAW_ORDER_FRONT_TO_BACK);
+            std::cout << "\nDraw order: front to back" << std::endl;
+        }
+        else {
+            map->set_draw_order(MapBSP46::DRAW_ORDER_CLUSTERS);
+            std::cout << "\nDraw order: clusters" << std::endl;
+        }
     }
 
-    void loop(Render& render, const MapBSP46& map)
+    void handle_commands(const Commands& commands, const Options& opts,
+            MapBSP46* map, CullPipeline* pipeline, StatsReporter* reporter)
+    {
+        if (commands.dump_trace) {
+            dump_trace(opts);
+        }
+        if (commands.toggle_overlay) {
+            reporter->toggle_overlay();
+        }
+        if (pipeline && (commands.toggle_draw_order ||
+                    commands.toggle_occlusion ||
+                    commands.toggle_area_portals ||
+                    commands.toggle_static_batches)) {
+            // Not while the map is being culled.
+            pipeline->wait_idle();
+        }
+        if (commands.toggle_draw_order) {
+            toggle_draw_order(map);
+        }
+        if (commands.toggle_occlusion) {
+            map->set_occlusion_culling(!map->get_occlusion_culling());
+            std::cout << "\nOcclusion culling: " <<
+                (map->get_occlusion_culling() ? "on" : "off") << std::endl;
+        }
+        if (commands.toggle_static_batches) {
+            map->set_static_batches(!map->get_static_batches());
+            std::cout << "\nStatic batches: " <<
+                (map->get_static_batches() ? "on" : "off") << std::endl;
+        }
+        if (commands.toggle_area_portals) {
+            // As if every door closed, or opened again.
+            AreaPortals& portals = map->get_area_portals();
+            const bool open = portals.get_num_portals() > 0 &&
+                !portals.is_portal_open(0);
+            portals.set_all_open(open);
+            std::cout << "\nArea portals: " << (open ? "open" : "closed") <<
+                std::endl;
+        }
+    }
+
+    // Returns true when the next map is asked for, which isn't done while
+    // recording.
+    bool loop(Render& render, MapBSP46& map, CullPipeline* pipeline,
+            DemoRecorder* recorder, const Options& opts)
     {
         float yaw = 0.0f, pitch = 0.0f, roll = 0.0f;
         Simulation sim;
+        StatsReporter reporter(opts);
 
         SDL_SetRelativeMouseMode(SDL_TRUE);
 
         bool done = false;
+        bool next_map = false;
         while (!done) {
+            PROFILE_SCOPE("frame");
             float dt = step();
 
-            process_events(&done, &render, &yaw, &pitch, &roll);
-            mat4 mdir;
-            mat4_rotate_y(mdir, yaw);
-            mat4_rotate_x(mdir, pitch);
-            mat4_rotate_z(mdir, roll);
-            mat4 mat = simulate(dt, mdir, &sim);
+            Commands commands;
+            process_events(&commands, &render, &yaw, &pitch, &roll);
+            handle_commands(commands, opts, &map, pipeline, &reporter);
+            next_map = commands.next_map && !recorder;
+            done = commands.done || next_map;
 
-            render.new_frame();
-            glMatrixMode(GL_MODELVIEW);
-            glLoadMatrixf(mat.get_floats());
-            map.draw(sim.position, GLFrustum<float>());
-            render.end_frame();
+            mat4 mdir = camera_rotation(yaw, pitch, roll);
+            simulate(dt, mdir, &sim);
+            if (recorder) {
+                recorder->add(DemoFrame{sim.position, yaw, pitch});
+            }
+
+            draw_frame(render, map, sim.position,
+                    camera_matrix(sim.position, mdir), pipeline, &reporter);
         }
 
         printf("\n");
+        return next_map;
+    }
+
+    // Replays a recorded camera path as fast as possible. Frame times span
+    // from one buffer swap to the next, so they include event processing,
+    // culling, submission and the swap itself.
+    void timedemo(Render& render, MapBSP46& map, CullPipeline* pipeline,
+            const demo_frame_vec_t& frames, const Options& opts)
+    {
+        float yaw = 0.0f, pitch = 0.0f, roll = 0.0f;
+        SDL_GL_SetSwapInterval(0);
+
+        FrameTimeStats stats;
+        stats.reserve(frames.size());
+        StatsReporter reporter(opts);
+
+        std::int64_t last_ticks = get_ticks();
+        for (auto&& frame : frames) {
+            PROFILE_SCOPE("frame");
+            Commands commands;
+            process_events(&commands, &render, &yaw, &pitch, &roll);
+            if (commands.done) {
+                break;
+            }
+            handle_commands(commands, opts, &map, pipeline, &reporter);
+
+            draw_frame(render, map, frame.position, camera_matrix(frame.position,
+                        camera_rotation(frame.yaw, frame.pitch, 0.0f)),
+                    pipeline, &reporter);
+
+            const std::int64_t ticks = get_ticks();
+            stats.add(ticks - last_ticks);
+            last_ticks = ticks;
+        }
+
+        const auto budget_ticks = static_cast<std::int64_t>(
+                opts.frame_budget_ms * (TICKS_PER_SECOND / 1000));
+        if (opts.report_filename) {
+            std::ofstream report(opts.report_filename);
+            if (!report) {
+                throwf("%s: Couldn't open report file for writing",
+                        opts.report_filename);
+            }
+            stats.write_json(report, budget_ticks);
+        }
+        else {
+            stats.write_json(std::cout, budget_ticks);
+        }
+#ifdef Q3BSP_PROFILE
+        dump_trace(opts);
+#endif
+    }
+
+    // Parses a finite number greater than 0 and at most `max`. Returns
+    // false for anything else, trailing characters included.
+    bool parse_positive(const char* s, const double max, double* value)
+    {
+        char* end;
+        errno = 0;
+        const double v = std::strtod(s, &end);
+        if (end == s || *end != '\0' || errno == ERANGE ||
+                !std::isfinite(v) || v <= 0.0 || v > max) {
+            return false;
+        }
+        *value = v;
+        return true;
+    }
+
+    // Parses a whole number of megabytes that fits in a size_t as bytes.
+    bool parse_mb(const char* s, std::size_t* value)
+    {
+        char* end;
+        errno = 0;
+        const unsigned long long v = std::strtoull(s, &end, 10);
+        if (!std::isdigit(static_cast<unsigned char>(*s)) || *end != '\0' ||
+                errno == ERANGE ||
+                v > std::numeric_limits<std::size_t>::max() >> 20) {
+            return false;
+        }
+        *value = static_cast<std::size_t>(v);
+        return true;
+    }
+
+    void usage(const char* argv0)
+    {
+        std::cerr <<
+            "Usage: " << argv0 << " [options] <path> <map> [<map>...]\n"
+            "  -r <file>  Record the camera path to <file>\n"
+            "  -p <file>  Replay a recorded camera path uncapped (timedemo)\n"
+            "  -o <file>  Write the timedemo report to <file> instead of stdout\n"
+            "  -b <msec>  Frame time budget for the timedemo report\n"
+            "  -t <file>  Chrome trace file written on F12 and after a timedemo\n"
+            "             (default q3bsp-trace.json, needs Q3BSP_PROFILE)\n"
+            "  -s <file>  Chrome trace file of the map loading pipeline\n"
+            "             (default q3bsp-startup.json, needs Q3BSP_PROFILE)\n"
+            "  -m <file>  Periodically rewrite rendering counters to <file>\n"
+            "             in the Prometheus text format\n"
+            "  -i <sec>   Interval between metrics file updates (default 1)\n"
+            "  -f         Draw front to back, near BSP children first (F2)\n"
+            "  -c         Occlusion culling on the CPU against large faces (F3)\n"
+            "  -w         Cull on a worker thread one frame ahead of drawing\n"
+            "  -S         Draw static per-cluster batches built at load (F5)\n"
+            "  -k         Build mipmaps with a Kaiser filter instead of a box\n"
+            "  -g         Average sRGB texels as linear colors in mipmaps\n"
+            "  -z         Compress textures and lightmaps to BC1/BC3 (S3TC)\n"
+            "  -Z <dir>   Cache compressed textures in <dir>, implies -z\n"
+            "  -a <msec>  Stream textures in while drawing, uploading for at\n"
+            "             most <msec> per frame\n"
+            "  -A <KB>    Also upload at most <KB> of textures per frame,\n"
+            "             implies -a\n"
+            "  -T <MB>    Keep up to <MB> of textures no map uses for the next\n"
+            "             maps (default 128)\n"
+            "  -M <MB>    Keep all textures under <MB>, dropping mip levels of\n"
+            "             those not drawn lately\n"
+            "  -P <MB>    Upload textures through a ring of <MB> of pixel\n"
+            "             buffer memory\n"
+            "  -B         Run stage microbenchmarks on the map and exit\n";
     }
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <path> <map>" << std::endl;
+    Options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:o:b:t:s:m:i:fcwSkgzZ:a:A:T:M:P:B")) != -1) {
+        const double max_msec = 1e6;
+        double value = 0.0;
+        bool valid = true;
+        switch (opt) {
+            case 'r': {
+                opts.record_filename = optarg;
+                break;
+            }
+            case 'p': {
+                opts.timedemo_filename = optarg;
+                break;
+            }
+            case 'o': {
+                opts.report_filename = optarg;
+                break;
+            }
+            case 'b': {
+                valid = parse_positive(optarg, max_msec, &value);
+                opts.frame_budget_ms = static_cast<float>(value);
+                break;
+            }
+            case 't': {
+                opts.trace_filename = optarg;
+                break;
+            }
+            case 's': {
+                opts.startup_trace_filename = optarg;
+                break;
+            }
+            case 'm': {
+                opts.metrics_filename = optarg;
+                break;
+            }
+            case 'i': {
+                valid = parse_positive(optarg, max_msec / 1000.0, &value);
+                opts.metrics_interval_sec = static_cast<float>(value);
+                break;
+            }
+            case 'f': {
+                opts.front_to_back = true;
+                break;
+            }
+            case 'c': {
+                opts.occlusion_culling = true;
+                break;
+            }
+            case 'w': {
+                opts.pipelined_culling = true;
+                break;
+            }
+            case 'S': {
+                opts.static_batches = true;
+                break;
+            }
+            case 'k': {
+                opts.mip_options.filter = MIP_FILTER_KAISER;
+                break;
+            }
+            case 'g': {
+                opts.mip_options.gamma_correct = true;
+                break;
+            }
+            case 'z': {
+                opts.texture_compression.enabled = true;
+                break;
+            }
+            case 'Z': {
+                opts.texture_compression.enabled = true;
+                opts.texture_compression.cache_dir = optarg;
+                break;
+            }
+            case 'a': {
+                opts.texture_streaming.enabled = true;
+                valid = parse_positive(optarg, max_msec, &value);
+                opts.texture_streaming.budget_msec = value;
+                break;
+            }
+            case 'A': {
+                opts.texture_streaming.enabled = true;
+                valid = parse_positive(optarg, double(1u << 30), &value);
+                opts.texture_streaming.budget_bytes =
+                    static_cast<std::size_t>(value * 1024.0);
+                break;
+            }
+            case 'T': {
+                valid = parse_mb(optarg, &opts.texture_cache_mb);
+                break;
+            }
+            case 'M': {
+                valid = parse_mb(optarg, &opts.texture_limit_mb);
+                break;
+            }
+            case 'P': {
+                valid = parse_mb(optarg, &opts.upload_ring_mb);
+                break;
+            }
+            case 'B': {
+                opts.run_benchmarks = true;
+                break;
+            }
+            default: {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        if (!valid) {
+            std::cerr << argv[0] << ": Bad value for -" << char(opt) <<
+                ": " << optarg << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        usage(argv[0]);
         return 1;
     }
-    std::string bsp_filename = "maps/";
-    bsp_filename += argv[2];
-    bsp_filename += ".bsp";
+    const char* const pak_path = argv[optind];
+    const std::vector<const char*> map_names(argv + optind + 1, argv + argc);
+    const char* const map_name = map_names[0];
 
     SDL_Init(SDL_INIT_EVERYTHING);
+    // Textures are decoded on several threads, and SDL_image loads its
+    // decoders on first use unless initialized up front.
+    IMG_Init(IMG_INIT_JPG);
+    profile_set_thread_name("main");
     try {
         Uint32 mticks = SDL_GetTicks();
-        PAK3Archive pak(argv[1]);
+        demo_frame_vec_t demo_frames;
+        if (opts.timedemo_filename) {
+            demo_frames = load_demo(opts.timedemo_filename, map_name);
+        }
+
+        PAK3Archive pak(pak_path);
+        set_mip_options(opts.mip_options);
+        ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
 
         /* Render render(1440, 900); */
         Render render(1440, 800);
-        MapBSP46 map(bsp_filename.c_str(), pak);
+        if (opts.texture_compression.enabled &&
+                !TextureManager::supports_compression()) {
+            std::cerr << "S3TC isn't supported, textures are loaded "
+                "uncompressed" << std::endl;
+            opts.texture_compression.enabled = false;
+        }
+        set_texture_compression(opts.texture_compression);
+        set_texture_streaming(opts.texture_streaming);
+        std::unique_ptr<UploadRing> upload_ring;
+        if (opts.upload_ring_mb > 0 && !UploadRing::is_supported()) {
+            std::cerr << "Pixel buffer objects or sync objects aren't "
+                "supported, textures are uploaded directly" << std::endl;
+        }
+        else if (opts.upload_ring_mb > 0) {
+            upload_ring = std::make_unique<UploadRing>(
+                    opts.upload_ring_mb * 1024 * 1024);
+            std::printf("Uploading textures through a %zu MB %s ring\n",
+                    opts.upload_ring_mb, upload_ring->is_persistent() ?
+                    "persistently mapped" : "mapped per copy");
+        }
+        TextureManager textures(opts.texture_cache_mb * 1024 * 1024,
+                opts.texture_limit_mb * 1024 * 1024);
+        textures.set_upload_ring(upload_ring.get());
+
+        // F6 loads the next map, which finds the textures it shares with
+        // the last one still resident.
+        for (std::size_t next = 0; ; next = (next + 1) % map_names.size()) {
+            const std::string bsp_filename =
+                std::string("maps/") + map_names[next] + ".bsp";
+            MapBSP46 map(bsp_filename.c_str(), pak, &textures, &pool);
+            if (opts.front_to_back) {
+                map.set_draw_order(MapBSP46::DRAW_ORDER_FRONT_TO_BACK);
+            }
+            map.set_occlusion_culling(opts.occlusion_culling);
+            map.set_static_batches(opts.static_batches);
+            std::unique_ptr<CullPipeline> pipeline;
+            if (opts.pipelined_culling) {
+                pipeline = std::make_unique<CullPipeline>(map);
+            }
 
-        std::printf("Init: %0.2f sec\n", (SDL_GetTicks() - mticks) / 1000.0f);
-        loop(render, map);
+            std::printf("Init: %0.2f sec\n",
+                    (SDL_GetTicks() - mticks) / 1000.0f);
+#ifdef Q3BSP_PROFILE
+            if (profile_export_chrome_trace(opts.startup_trace_filename)) {
+                std::cout << "Wrote startup trace to " <<
+                    opts.startup_trace_filename << std::endl;
+            }
+            profile_clear();
+#endif
+            if (opts.run_benchmarks) {
+                MapBench(map, pak).run(std::cout);
+                break;
+            }
+            else if (opts.timedemo_filename) {
+                timedemo(render, map, pipeline.get(), demo_frames, opts);
+                break;
+            }
+            else if (opts.record_filename) {
+                DemoRecorder recorder(opts.record_filename, map_name);
+                loop(render, map, pipeline.get(), &recorder, opts);
+                break;
+            }
+            else if (!loop(render, map, pipeline.get(), nullptr, opts)) {
+                break;
+            }
+            mticks = SDL_GetTicks();
+        }
+        if (upload_ring) {
+            std::printf("Uploaded %0.2f MB through the ring, waiting for "
+                    "the GPU %llu times\n",
+                    upload_ring->get_bytes_uploaded() / (1024.0 * 1024.0),
+                    static_cast<unsigned long long>(
+                        upload_ring->get_num_waits()));
+        }
     }
     catch (const QException& e) {
         std::cerr << argv[0] << ": Error: " << e.what() << std::endl;
@@ -302,6 +928,7 @@ int main(int argc, char* argv[])
         std::cerr << argv[0] << ": Error: Unknown exception" << std::endl;
         return 1;
     }
+    IMG_Quit();
     SDL_Quit();
     return 0;
 }
@@ -4,8 +4,13 @@
 #include <cstring>
 #include <cmath>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include <GL/gl.h>
 
+#include "src/math/vector3.h"
 #include "src/math/vector4.h"
 #include "src/math/matrix4.h"
 
@@ -39,19 +44,202 @@ class Plane
         }
 };
 
+// Plane mask with every frustum plane set, for the root of a hierarchy.
+const unsigned frustum_all_planes = 0x3f;
+
+// Tests a box, given by its center and half extents, against up to 8 planes
+// stored as rows of nx, ny, nz, d, |nx|, |ny|, |nz|. Sets the bits of the
+// planes the box is entirely behind in `outside`, and of those it is
+// entirely in front of in `inside`.
+template <class T>
+void test_box_planes(const T planes[7][8], const Vector3<T>& c,
+        const Vector3<T>& e, unsigned* outside, unsigned* inside)
+{
+    *outside = 0;
+    *inside = 0;
+    for (int i = 0; i < 8; ++i) {
+        const T dist = planes[0][i] * c.x + planes[1][i] * c.y +
+            planes[2][i] * c.z + planes[3][i];
+        const T radius = planes[4][i] * e.x + planes[5][i] * e.y +
+            planes[6][i] * e.z;
+        if (dist + radius < T(0)) {
+            *outside |= 1u << i;
+        }
+        if (dist - radius >= T(0)) {
+            *inside |= 1u << i;
+        }
+    }
+}
+
+#ifdef __SSE__
+// Same as above, four planes at a time.
+inline void test_box_planes(const float planes[7][8], const Vector3<float>& c,
+        const Vector3<float>& e, unsigned* outside, unsigned* inside)
+{
+    const __m128 cx = _mm_set1_ps(c.x);
+    const __m128 cy = _mm_set1_ps(c.y);
+    const __m128 cz = _mm_set1_ps(c.z);
+    const __m128 ex = _mm_set1_ps(e.x);
+    const __m128 ey = _mm_set1_ps(e.y);
+    const __m128 ez = _mm_set1_ps(e.z);
+    const __m128 zero = _mm_setzero_ps();
+
+    *outside = 0;
+    *inside = 0;
+    for (int i = 0; i < 8; i += 4) {
+        __m128 dist = _mm_mul_ps(_mm_load_ps(planes[0] + i), cx);
+        dist = _mm_add_ps(dist, _mm_mul_ps(_mm_load_ps(planes[1] + i), cy));
+        dist = _mm_add_ps(dist, _mm_mul_ps(_mm_load_ps(planes[2] + i), cz));
+        dist = _mm_add_ps(dist, _mm_load_ps(planes[3] + i));
+
+        __m128 radius = _mm_mul_ps(_mm_load_ps(planes[4] + i), ex);
+        radius = _mm_add_ps(radius, _mm_mul_ps(_mm_load_ps(planes[5] + i), ey));
+        radius = _mm_add_ps(radius, _mm_mul_ps(_mm_load_ps(planes[6] + i), ez));
+
+        *outside |= static_cast<unsigned>(_mm_movemask_ps(
+                    _mm_cmplt_ps(_mm_add_ps(dist, radius), zero))) << i;
+        *inside |= static_cast<unsigned>(_mm_movemask_ps(
+                    _mm_cmpge_ps(_mm_sub_ps(dist, radius), zero))) << i;
+    }
+}
+#endif
+
+// Tests four boxes, given as rows of centers and half extents, against the
+// first six planes in the layout above. Returns a bitmask of the boxes that
+// aren't entirely behind any of them.
 template <class T>
-class GLFrustum
+unsigned test_boxes_planes(const T planes[7][8], const T center[3][4],
+        const T extent[3][4])
+{
+    unsigned visible = 0;
+    for (int j = 0; j < 4; ++j) {
+        bool outside = false;
+        for (int i = 0; i < 6 && !outside; ++i) {
+            const T dist = planes[0][i] * center[0][j] +
+                planes[1][i] * center[1][j] + planes[2][i] * center[2][j] +
+                planes[3][i];
+            const T radius = planes[4][i] * extent[0][j] +
+                planes[5][i] * extent[1][j] + planes[6][i] * extent[2][j];
+            outside = dist + radius < T(0);
+        }
+        if (!outside) {
+            visible |= 1u << j;
+        }
+    }
+    return visible;
+}
+
+#ifdef __SSE__
+// Same as above, one plane at a time for all four boxes.
+inline unsigned test_boxes_planes(const float planes[7][8],
+        const float center[3][4], const float extent[3][4])
+{
+    const __m128 cx = _mm_loadu_ps(center[0]);
+    const __m128 cy = _mm_loadu_ps(center[1]);
+    const __m128 cz = _mm_loadu_ps(center[2]);
+    const __m128 ex = _mm_loadu_ps(extent[0]);
+    const __m128 ey = _mm_loadu_ps(extent[1]);
+    const __m128 ez = _mm_loadu_ps(extent[2]);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 outside = zero;
+    for (int i = 0; i < 6; ++i) {
+        __m128 dist = _mm_mul_ps(_mm_set1_ps(planes[0][i]), cx);
+        dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(planes[1][i]), cy));
+        dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(planes[2][i]), cz));
+        dist = _mm_add_ps(dist, _mm_set1_ps(planes[3][i]));
+
+        __m128 radius = _mm_mul_ps(_mm_set1_ps(planes[4][i]), ex);
+        radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(planes[5][i]), ey));
+        radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(planes[6][i]), ez));
+
+        outside = _mm_or_ps(outside,
+                _mm_cmplt_ps(_mm_add_ps(dist, radius), zero));
+    }
+    return ~static_cast<unsigned>(_mm_movemask_ps(outside)) & 0xf;
+}
+#endif
+
+// View frustum planes extracted from a projection and a modelview matrix,
+// so that culling needs neither the GL thread nor a context.
+template <class T>
+class Frustum
 {
     public:
-        GLFrustum()
+        Frustum(const Matrix4<T>& projection, const Matrix4<T>& modelview)
         {
-            float p[16];
-            glGetFloatv(GL_PROJECTION_MATRIX, p);
+            set_planes(projection.get_floats(), modelview.get_floats());
+        }
 
-            float m[16];
-            glGetFloatv(GL_MODELVIEW_MATRIX, m);
+        bool is_aabb_visible(const Vector3<T>& vmin, const Vector3<T>& vmax)
+            const
+        {
+            for (int i = 0; i < 6; ++i) {
+                const Plane<T>& plane = m_plane[i];
+                if (plane.distance(vmin.x, vmin.y, vmin.z) < T(0) &&
+                        plane.distance(vmax.x, vmin.y, vmin.z) < T(0) &&
+                        plane.distance(vmin.x, vmax.y, vmin.z) < T(0) &&
+                        plane.distance(vmax.x, vmax.y, vmin.z) < T(0) &&
+                        plane.distance(vmin.x, vmin.y, vmax.z) < T(0) &&
+                        plane.distance(vmax.x, vmin.y, vmax.z) < T(0) &&
+                        plane.distance(vmin.x, vmax.y, vmax.z) < T(0) &&
+                        plane.distance(vmax.x, vmax.y, vmax.z) < T(0)) {
+                    return false;
+                }
+            }
+            return true;
+        }
 
-            float clip[16];
+        // Tests only the corner of the box farthest along each plane's
+        // normal (the "p-vertex") and the opposite one, with four planes
+        // at a time where SSE is available. The corners may be given in
+        // any order.
+        //
+        // Bit i of `plane_mask` means the box may still cross plane i. The
+        // planes the box is entirely in front of are cleared, so boxes
+        // nested inside it only test the remaining planes, and none at all
+        // once the mask is 0.
+        bool is_aabb_visible(const Vector3<T>& vmin, const Vector3<T>& vmax,
+                unsigned* plane_mask) const
+        {
+            if (*plane_mask == 0) {
+                return true;
+            }
+            const Vector3<T> center((vmin.x + vmax.x) * T(0.5),
+                    (vmin.y + vmax.y) * T(0.5), (vmin.z + vmax.z) * T(0.5));
+            const Vector3<T> extent(std::abs(vmax.x - vmin.x) * T(0.5),
+                    std::abs(vmax.y - vmin.y) * T(0.5),
+                    std::abs(vmax.z - vmin.z) * T(0.5));
+            unsigned outside, inside;
+            test_box_planes(m_planes, center, extent, &outside, &inside);
+            if (outside & *plane_mask) {
+                return false;
+            }
+            *plane_mask &= ~inside;
+            return true;
+        }
+
+        // Tests four boxes at once, given in center/half extent form with
+        // one row per axis. Returns a bitmask of the visible ones.
+        unsigned are_aabbs_visible(const T center[3][4], const T extent[3][4])
+            const
+        {
+            return test_boxes_planes(m_planes, center, extent);
+        }
+
+        // Projection times modelview, column-major like GL matrices.
+        const T* get_clip_matrix() const
+        {
+            return m_clip;
+        }
+
+    protected:
+        Frustum()
+        {}
+
+        void set_planes(const T* p, const T* m)
+        {
+            T* const clip = m_clip;
             clip[0]  = m[0]  * p[0] + m[1]  * p[4] + m[2]  * p[8]  + m[3]  * p[12];
             clip[1]  = m[0]  * p[1] + m[1]  * p[5] + m[2]  * p[9]  + m[3]  * p[13];
             clip[2]  = m[0]  * p[2] + m[1]  * p[6] + m[2]  * p[10] + m[3]  * p[14];
@@ -111,29 +299,44 @@ class GLFrustum
             for (int i = 0; i < 6; ++i) {
                 m_plane[i].normalize();
             }
-        }
 
-        bool is_aabb_visible(const Vector3<T>& vmin, const Vector3<T>& vmax)
-            const
-        {
-            for (int i = 0; i < 6; ++i) {
-                const Plane<T>& plane = m_plane[i];
-                if (plane.distance(vmin.x, vmin.y, vmin.z) < T(0) &&
-                        plane.distance(vmax.x, vmin.y, vmin.z) < T(0) &&
-                        plane.distance(vmin.x, vmax.y, vmin.z) < T(0) &&
-                        plane.distance(vmax.x, vmax.y, vmin.z) < T(0) &&
-                        plane.distance(vmin.x, vmin.y, vmax.z) < T(0) &&
-                        plane.distance(vmax.x, vmin.y, vmax.z) < T(0) &&
-                        plane.distance(vmin.x, vmax.y, vmax.z) < T(0) &&
-                        plane.distance(vmax.x, vmax.y, vmax.z) < T(0)) {
-                    return false;
-                }
+            // The two spare rows hold planes every box is in front of.
+            for (int i = 0; i < 8; ++i) {
+                const Plane<T> plane = i < 6 ? m_plane[i] :
+                    Plane<T>(Vector3<T>(), T(1));
+                m_planes[0][i] = plane.normal.x;
+                m_planes[1][i] = plane.normal.y;
+                m_planes[2][i] = plane.normal.z;
+                m_planes[3][i] = plane.d;
+                m_planes[4][i] = std::abs(plane.normal.x);
+                m_planes[5][i] = std::abs(plane.normal.y);
+                m_planes[6][i] = std::abs(plane.normal.z);
             }
-            return true;
         }
 
     private:
         Plane<T> m_plane[6];
+        T        m_clip[16];
+
+        // The planes transposed for test_box_planes.
+        alignas(16) T m_planes[7][8];
+};
+
+// Frustum of the current GL projection and modelview matrices.
+template <class T>
+class GLFrustum : public Frustum<T>
+{
+    public:
+        GLFrustum()
+        {
+            float p[16];
+            glGetFloatv(GL_PROJECTION_MATRIX, p);
+
+            float m[16];
+            glGetFloatv(GL_MODELVIEW_MATRIX, m);
+
+            this->set_planes(p, m);
+        }
 };
 
 template <class T>
@@ -206,4 +409,24 @@ void mat4_rotate_z(Matrix4<T>& a, const float deg)
     a *= t;
 }
 
+// Same as gluPerspective.
+template <class T>
+void mat4_perspective(Matrix4<T>& a, const float fovy, const float aspect,
+        const float z_near, const float z_far)
+{
+    const float f = static_cast<float>(1.0 / std::tan(fovy * M_PI / 360.0));
+    const float depth = z_near - z_far;
+
+    // Starts out as the identity.
+    Matrix4<T> t;
+    t(0, 0) = f / aspect;
+    t(1, 1) = f;
+    t(2, 2) = (z_far + z_near) / depth;
+    t(2, 3) = T(-1);
+    t(3, 2) = 2.0f * z_far * z_near / depth;
+    t(3, 3) = T(0);
+
+    a *= t;
+}
+
 #endif
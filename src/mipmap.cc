@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "src/mipmap.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Half-width, in output texels, and shape of the Kaiser window.
+    const float kaiser_width = 3.0f;
+    const float kaiser_alpha = 4.0f;
+
+    MipOptions g_mip_options;
+
+    // A level with four floats per texel, for the filters that don't work
+    // on bytes.
+    struct FloatLevel
+    {
+        unsigned            width;
+        unsigned            height;
+        std::vector<float>  texels;
+    };
+
+    // Contributions of input texels to an output texel along one axis.
+    struct Tap
+    {
+        unsigned    index;
+        float       weight;
+    };
+
+    struct Taps
+    {
+        unsigned            per_texel;  // Taps of each output texel.
+        std::vector<Tap>    taps;
+    };
+
+    // Lookup tables between 8-bit sRGB and linear values.
+    struct GammaTables
+    {
+        float           to_linear[256];
+        std::uint8_t    to_srgb[4096];
+
+        GammaTables()
+        {
+            for (int i = 0; i < 256; ++i) {
+                const float c = i / 255.0f;
+                to_linear[i] = c <= 0.04045f ? c / 12.92f :
+                    std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i < 4096; ++i) {
+                const float l = i / 4095.0f;
+                const float c = l <= 0.0031308f ? l * 12.92f :
+                    1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                to_srgb[i] = static_cast<std::uint8_t>(
+                        std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    const GammaTables& gamma_tables()
+    {
+        static const GammaTables tables;
+        return tables;
+    }
+
+    // Zeroth-order modified Bessel function of the first kind.
+    float bessel_i0(const float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 32 && term > sum * 1e-7f; ++k) {
+            const float t = x / (2.0f * k);
+            term *= t * t;
+            sum += term;
+        }
+        return sum;
+    }
+
+    float kaiser_sinc(const float t)
+    {
+        const float u = t / kaiser_width;
+        if (std::abs(u) >= 1.0f) {
+            return 0.0f;
+        }
+        const float pi_t = 3.14159265f * t;
+        const float sinc = std::abs(t) < 1e-6f ? 1.0f : std::sin(pi_t) / pi_t;
+        return sinc * bessel_i0(kaiser_alpha * std::sqrt(1.0f - u * u)) /
+            bessel_i0(kaiser_alpha);
+    }
+
+    // Box taps cover exactly the input texels under each output texel: two
+    // halves for an even size, and for an odd size 2n + 1 three texels
+    // weighted (n - x, n, x + 1) / (2n + 1).
+    Taps make_box_taps(const unsigned src_size, const unsigned dst_size)
+    {
+        Taps taps;
+        if (src_size == dst_size) {
+            taps.per_texel = 1;
+            for (unsigned x = 0; x < dst_size; ++x) {
+                taps.taps.push_back(Tap{x, 1.0f});
+            }
+        }
+        else if (src_size % 2 == 0) {
+            taps.per_texel = 2;
+            for (unsigned x = 0; x < dst_size; ++x) {
+                taps.taps.push_back(Tap{2 * x, 0.5f});
+                taps.taps.push_back(Tap{2 * x + 1, 0.5f});
+            }
+        }
+        else {
+            taps.per_texel = 3;
+            const float n = static_cast<float>(dst_size);
+            const float inv_size = 1.0f / src_size;
+            for (unsigned x = 0; x < dst_size; ++x) {
+                taps.taps.push_back(Tap{2 * x, (n - x) * inv_size});
+                taps.taps.push_back(Tap{2 * x + 1, n * inv_size});
+                taps.taps.push_back(Tap{2 * x + 2, (x + 1.0f) * inv_size});
+            }
+        }
+        return taps;
+    }
+
+    // Kaiser taps are centered on each output texel and wrap around the
+    // edges, as textures repeat. Weights are normalized to sum to one.
+    Taps make_kaiser_taps(const unsigned src_size, const unsigned dst_size)
+    {
+        if (src_size == dst_size) {
+            return make_box_taps(src_size, dst_size);
+        }
+        const float scale = static_cast<float>(src_size) / dst_size;
+        const int radius = static_cast<int>(std::ceil(kaiser_width * scale));
+        Taps taps;
+        taps.per_texel = static_cast<unsigned>(2 * radius);
+        for (unsigned x = 0; x < dst_size; ++x) {
+            const float center = (x + 0.5f) * scale;
+            const int first = static_cast<int>(std::floor(center)) - radius;
+            const std::size_t begin = taps.taps.size();
+            float sum = 0.0f;
+            for (int i = first; i < first + 2 * radius; ++i) {
+                const float weight = kaiser_sinc((i + 0.5f - center) / scale);
+                const int size = static_cast<int>(src_size);
+                const int index = ((i % size) + size) % size;
+                taps.taps.push_back(Tap{static_cast<unsigned>(index), weight});
+                sum += weight;
+            }
+            for (std::size_t i = begin; i < taps.taps.size(); ++i) {
+                taps.taps[i].weight /= sum;
+            }
+        }
+        return taps;
+    }
+
+    Taps make_taps(const MipFilter filter, const unsigned src_size,
+            const unsigned dst_size)
+    {
+        return filter == MIP_FILTER_KAISER ?
+            make_kaiser_taps(src_size, dst_size) :
+            make_box_taps(src_size, dst_size);
+    }
+
+    // out[0..3] += weight * in[0..3]
+    inline void add_texel(const float* in, const float weight, float* out)
+    {
+#ifdef __SSE__
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out),
+                    _mm_mul_ps(_mm_loadu_ps(in), _mm_set1_ps(weight))));
+#else
+        for (int c = 0; c < 4; ++c) {
+            out[c] += weight * in[c];
+        }
+#endif
+    }
+
+    FloatLevel downsample(const FloatLevel& src, const MipFilter filter)
+    {
+        const unsigned width = std::max(src.width / 2, 1u);
+        const unsigned height = std::max(src.height / 2, 1u);
+
+        // Rows first, into a level as wide as the output and as high as
+        // the input.
+        const Taps row_taps = make_taps(filter, src.width, width);
+        std::vector<float> rows(std::size_t(width) * src.height * 4, 0.0f);
+        for (unsigned y = 0; y < src.height; ++y) {
+            const float* const in = src.texels.data() +
+                std::size_t(y) * src.width * 4;
+            float* const out = rows.data() + std::size_t(y) * width * 4;
+            const Tap* tap = row_taps.taps.data();
+            for (unsigned x = 0; x < width; ++x) {
+                for (unsigned k = 0; k < row_taps.per_texel; ++k, ++tap) {
+                    add_texel(in + tap->index * 4, tap->weight, out + x * 4);
+                }
+            }
+        }
+
+        const Taps column_taps = make_taps(filter, src.height, height);
+        FloatLevel dst{width, height,
+            std::vector<float>(std::size_t(width) * height * 4, 0.0f)};
+        const Tap* tap = column_taps.taps.data();
+        for (unsigned y = 0; y < height; ++y) {
+            float* const out = dst.texels.data() + std::size_t(y) * width * 4;
+            for (unsigned k = 0; k < column_taps.per_texel; ++k, ++tap) {
+                const float* const in = rows.data() +
+                    std::size_t(tap->index) * width * 4;
+                for (unsigned x = 0; x < width; ++x) {
+                    add_texel(in + x * 4, tap->weight, out + x * 4);
+                }
+            }
+        }
+        return dst;
+    }
+
+    // Alpha is never gamma corrected.
+    FloatLevel to_float(const Image& image, const bool gamma_correct)
+    {
+        const GammaTables& tables = gamma_tables();
+        FloatLevel level{image.get_width(), image.get_height(),
+            std::vector<float>()};
+        level.texels.reserve(image.get_pixels().size() * 4);
+        for (auto&& p : image.get_pixels()) {
+            if (gamma_correct) {
+                level.texels.push_back(tables.to_linear[p.red]);
+                level.texels.push_back(tables.to_linear[p.green]);
+                level.texels.push_back(tables.to_linear[p.blue]);
+            }
+            else {
+                level.texels.push_back(p.red / 255.0f);
+                level.texels.push_back(p.green / 255.0f);
+                level.texels.push_back(p.blue / 255.0f);
+            }
+            level.texels.push_back(p.alpha / 255.0f);
+        }
+        return level;
+    }
+
+    Image to_image(const FloatLevel& level, const bool gamma_correct)
+    {
+        const GammaTables& tables = gamma_tables();
+        pixel_vector_t pixels(std::size_t(level.width) * level.height);
+        const float* in = level.texels.data();
+        for (auto&& p : pixels) {
+            std::uint8_t c[4];
+            for (int i = 0; i < 4; ++i) {
+                const float v = std::min(std::max(in[i], 0.0f), 1.0f);
+                if (gamma_correct && i < 3) {
+                    c[i] = tables.to_srgb[static_cast<int>(v * 4095.0f + 0.5f)];
+                }
+                else {
+                    c[i] = static_cast<std::uint8_t>(v * 255.0f + 0.5f);
+                }
+            }
+            p = pixel_t{c[0], c[1], c[2], c[3]};
+            in += 4;
+        }
+        return Image(level.width, level.height, std::move(pixels));
+    }
+
+    inline std::uint8_t average4(const unsigned a, const unsigned b,
+            const unsigned c, const unsigned d)
+    {
+        return static_cast<std::uint8_t>((a + b + c + d + 2) >> 2);
+    }
+
+    // Exact 2x2 average of a level of even width and height, two output
+    // texels at a time with SSE2.
+    Image halve_even(const Image& src)
+    {
+        const unsigned src_width = src.get_width();
+        const unsigned width = src_width / 2;
+        const unsigned height = src.get_height() / 2;
+        const pixel_t* const in = src.get_pixels().data();
+        pixel_vector_t out(std::size_t(width) * height);
+
+        for (unsigned y = 0; y < height; ++y) {
+            const pixel_t* const row0 = in + std::size_t(2 * y) * src_width;
+            const pixel_t* const row1 = row0 + src_width;
+            pixel_t* const dst = out.data() + std::size_t(y) * width;
+            unsigned x = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i two = _mm_set1_epi16(2);
+            for (; x + 2 <= width; x += 2) {
+                const __m128i a = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(row0 + 2 * x));
+                const __m128i b = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(row1 + 2 * x));
+                // Vertical sums of texels 0, 1 and 2, 3, then of the pairs.
+                const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                        _mm_unpacklo_epi8(b, zero));
+                const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                        _mm_unpackhi_epi8(b, zero));
+                const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                        _mm_unpackhi_epi64(lo, hi));
+                const __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x),
+                        _mm_packus_epi16(avg, zero));
+            }
+#endif
+            for (; x < width; ++x) {
+                const pixel_t& a = row0[2 * x];
+                const pixel_t& b = row0[2 * x + 1];
+                const pixel_t& c = row1[2 * x];
+                const pixel_t& d = row1[2 * x + 1];
+                dst[x].red = average4(a.red, b.red, c.red, d.red);
+                dst[x].green = average4(a.green, b.green, c.green, d.green);
+                dst[x].blue = average4(a.blue, b.blue, c.blue, d.blue);
+                dst[x].alpha = average4(a.alpha, b.alpha, c.alpha, d.alpha);
+            }
+        }
+        return Image(width, height, std::move(out));
+    }
+}
+
+void set_mip_options(const MipOptions& options)
+{
+    g_mip_options = options;
+}
+
+const MipOptions& get_mip_options()
+{
+    return g_mip_options;
+}
+
+mip_chain_t build_mip_chain(const unsigned width, const unsigned height,
+        const std::uint8_t* pixels)
+{
+    return build_mip_chain(width, height, pixels, g_mip_options);
+}
+
+mip_chain_t build_mip_chain(const unsigned width, const unsigned height,
+        const std::uint8_t* pixels, const MipOptions& options)
+{
+    return build_mip_chain(Image(width, height, pixels), options);
+}
+
+mip_chain_t build_mip_chain(Image image)
+{
+    return build_mip_chain(std::move(image), g_mip_options);
+}
+
+// Floating-point levels are filtered from the floating-point level above,
+// not from its rounded pixels.
+mip_chain_t build_mip_chain(Image image, const MipOptions& options)
+{
+    PROFILE_SPAN(span, "build_mipmaps");
+    PROFILE_SPAN_ARG(span, "bytes",
+            image.get_width() * image.get_height() * 4);
+    mip_chain_t levels;
+    levels.push_back(std::move(image));
+    const bool exact_box = options.filter == MIP_FILTER_BOX &&
+        !options.gamma_correct;
+    FloatLevel level;
+    bool have_float = false;
+    while (levels.back().get_width() > 1 || levels.back().get_height() > 1) {
+        const Image& last = levels.back();
+        if (exact_box && last.get_width() % 2 == 0 &&
+                last.get_height() % 2 == 0) {
+            levels.push_back(halve_even(last));
+            have_float = false;
+            continue;
+        }
+        if (!have_float) {
+            level = to_float(last, options.gamma_correct);
+            have_float = true;
+        }
+        level = downsample(level, options.filter);
+        levels.push_back(to_image(level, options.gamma_correct));
+    }
+    return levels;
+}
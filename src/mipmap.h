@@ -0,0 +1,43 @@
+#ifndef Q3BSP__MIPMAP_H
+#define Q3BSP__MIPMAP_H
+
+#include <vector>
+#include <cstdint>
+
+#include "src/image.h"
+
+// The levels of detail of an RGBA texture, level 0 first, each half the
+// size of the one before, rounded down, down to 1x1. Sizes need not be
+// powers of two.
+using mip_chain_t = std::vector<Image>;
+
+enum MipFilter
+{
+    MIP_FILTER_BOX,     // Average of the texels a texel covers.
+    MIP_FILTER_KAISER   // Kaiser-windowed sinc, sharper, wraps around.
+};
+
+struct MipOptions
+{
+    MipFilter   filter = MIP_FILTER_BOX;
+    bool        gamma_correct = false;  // Average sRGB colors as linear.
+};
+
+// Options of the mip chains built without explicit ones; to be set before
+// any texture is loaded.
+extern void set_mip_options(const MipOptions&);
+extern const MipOptions& get_mip_options();
+
+// Takes the image as level 0, or a copy of the pixels, and filters each
+// level from the one above it. The box filter of even sizes is exact
+// integer averaging; odd sizes and the other options filter in floating
+// point, where a level of odd size weighs its three texels per output
+// texel by their overlap.
+extern mip_chain_t build_mip_chain(const unsigned, const unsigned,
+        const std::uint8_t*);
+extern mip_chain_t build_mip_chain(const unsigned, const unsigned,
+        const std::uint8_t*, const MipOptions&);
+extern mip_chain_t build_mip_chain(Image);
+extern mip_chain_t build_mip_chain(Image, const MipOptions&);
+
+#endif
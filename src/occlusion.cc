@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "src/occlusion.h"
+#include "src/thread_pool.h"
+#include "src/exception.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Rows of the depth buffer rasterized by one task.
+    const int band_rows = 16;
+
+    // A box is tested at the first pyramid level where it spans fewer
+    // texels than this across.
+    const int max_test_texels = 4;
+
+    inline float min3(const float v[3])
+    {
+        return std::min(v[0], std::min(v[1], v[2]));
+    }
+
+    inline float max3(const float v[3])
+    {
+        return std::max(v[0], std::max(v[1], v[2]));
+    }
+}
+
+OcclusionBuffer::OcclusionBuffer(const int width, const int height)
+    : m_width(width), m_height(height)
+{
+    if (width <= 0 || height <= 0 || width % 4 != 0) {
+        throwf("Occlusion buffer size %dx%d is invalid", width, height);
+    }
+    int w = width;
+    int h = height;
+    for (;;) {
+        const auto size = static_cast<std::size_t>(w * h);
+        m_levels.push_back(Level{w, h, std::vector<float>(size, 1.0f)});
+        if (w == 1 && h == 1) {
+            break;
+        }
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    std::fill(m_clip, m_clip + 16, 0.0f);
+}
+
+void OcclusionBuffer::begin(const float* clip)
+{
+    std::copy(clip, clip + 16, m_clip);
+    m_triangles.clear();
+}
+
+// Projects a world-space point to window coordinates. Fails for points
+// behind the near plane.
+inline bool OcclusionBuffer::project(const float* p, float* x, float* y,
+        float* z) const
+{
+    const float* const c = m_clip;
+    const float cw = c[3] * p[0] + c[7] * p[1] + c[11] * p[2] + c[15];
+    const float cz = c[2] * p[0] + c[6] * p[1] + c[10] * p[2] + c[14];
+    if (cw <= 0.0f || cz < -cw) {
+        return false;
+    }
+    const float cx = c[0] * p[0] + c[4] * p[1] + c[8] * p[2] + c[12];
+    const float cy = c[1] * p[0] + c[5] * p[1] + c[9] * p[2] + c[13];
+    const float inv_w = 1.0f / cw;
+    *x = (cx * inv_w * 0.5f + 0.5f) * m_width;
+    *y = (cy * inv_w * 0.5f + 0.5f) * m_height;
+    *z = cz * inv_w * 0.5f + 0.5f;
+    return true;
+}
+
+void OcclusionBuffer::add_triangle(const float* a, const float* b,
+        const float* c)
+{
+    Triangle t;
+    if (!project(a, &t.x[0], &t.y[0], &t.z[0]) ||
+            !project(b, &t.x[1], &t.y[1], &t.z[1]) ||
+            !project(c, &t.x[2], &t.y[2], &t.z[2])) {
+        return;
+    }
+    const float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) -
+        (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+    if (!(std::abs(area) > 0.0f)) {
+        return;
+    }
+    if (area < 0.0f) {
+        std::swap(t.x[1], t.x[2]);
+        std::swap(t.y[1], t.y[2]);
+        std::swap(t.z[1], t.z[2]);
+    }
+    if (max3(t.x) < 0.0f || min3(t.x) >= m_width) {
+        return;
+    }
+    t.min_y = static_cast<int>(std::max(min3(t.y), 0.0f));
+    t.max_y = static_cast<int>(std::min(max3(t.y), m_height - 1.0f));
+    if (t.min_y > t.max_y) {
+        return;
+    }
+    m_triangles.push_back(t);
+}
+
+void OcclusionBuffer::rasterize(ThreadPool* pool)
+{
+    PROFILE_SCOPE("rasterize_occluders");
+    const auto rasterize_band = [this](const std::size_t band) {
+        const int y0 = static_cast<int>(band) * band_rows;
+        const int y1 = std::min(m_height, y0 + band_rows) - 1;
+        float* const depth = m_levels[0].depth.data();
+        std::fill(depth + y0 * m_width, depth + (y1 + 1) * m_width, 1.0f);
+        for (auto&& t : m_triangles) {
+            if (t.max_y >= y0 && t.min_y <= y1) {
+                rasterize_rows(t, std::max(y0, t.min_y),
+                        std::min(y1, t.max_y));
+            }
+        }
+    };
+    const auto num_bands =
+        static_cast<std::size_t>((m_height + band_rows - 1) / band_rows);
+    if (pool) {
+        pool->parallel_for(0, num_bands, rasterize_band);
+    }
+    else {
+        for (std::size_t i = 0; i < num_bands; ++i) {
+            rasterize_band(i);
+        }
+    }
+    build_pyramid();
+}
+
+// Rasterizes rows y0 to y1 of the triangle, four pixels at a time. The edge
+// functions e[i](x, y) = a[i] * x + b[i] * y + c[i], of the edges opposite
+// each vertex, are all non-negative inside the triangle, and their ratio to
+// its area gives the barycentric weights for interpolating depth.
+void OcclusionBuffer::rasterize_rows(const Triangle& t, const int y0,
+        const int y1)
+{
+    float a[3], b[3], c[3];
+    for (int i = 0; i < 3; ++i) {
+        const int j = (i + 1) % 3;
+        const int k = (i + 2) % 3;
+        a[i] = t.y[j] - t.y[k];
+        b[i] = t.x[k] - t.x[j];
+        c[i] = -(a[i] * t.x[j] + b[i] * t.y[j]);
+    }
+    const float inv_area = 1.0f / (a[0] * t.x[0] + b[0] * t.y[0] + c[0]);
+    const float za = (a[0] * t.z[0] + a[1] * t.z[1] + a[2] * t.z[2]) *
+        inv_area;
+    const float zb = (b[0] * t.z[0] + b[1] * t.z[1] + b[2] * t.z[2]) *
+        inv_area;
+    const float zc = (c[0] * t.z[0] + c[1] * t.z[1] + c[2] * t.z[2]) *
+        inv_area;
+
+    const int min_x = static_cast<int>(std::max(min3(t.x), 0.0f)) & ~3;
+    const int max_x = static_cast<int>(std::min(max3(t.x), m_width - 1.0f));
+    float* const depth = m_levels[0].depth.data();
+
+    for (int y = y0; y <= y1; ++y) {
+        const float py = y + 0.5f;
+        float* const row = depth + y * m_width;
+#ifdef __SSE__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 step = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        const __m128 row_z = _mm_set1_ps(zb * py + zc);
+        __m128 row_e[3];
+        for (int i = 0; i < 3; ++i) {
+            row_e[i] = _mm_set1_ps(b[i] * py + c[i]);
+        }
+        for (int x = min_x; x <= max_x; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), step);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(
+                            _mm_set1_ps(a[0]), px), row_e[0]), zero);
+            for (int i = 1; i < 3; ++i) {
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(
+                                _mm_mul_ps(_mm_set1_ps(a[i]), px), row_e[i]),
+                            zero));
+            }
+            const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                    row_z);
+            const __m128 old_z = _mm_loadu_ps(row + x);
+            _mm_storeu_ps(row + x, _mm_or_ps(
+                        _mm_and_ps(inside, _mm_min_ps(old_z, z)),
+                        _mm_andnot_ps(inside, old_z)));
+        }
+#else
+        for (int x = min_x; x <= max_x; ++x) {
+            const float px = x + 0.5f;
+            if (a[0] * px + b[0] * py + c[0] >= 0.0f &&
+                    a[1] * px + b[1] * py + c[1] >= 0.0f &&
+                    a[2] * px + b[2] * py + c[2] >= 0.0f) {
+                row[x] = std::min(row[x], za * px + zb * py + zc);
+            }
+        }
+#endif
+    }
+}
+
+void OcclusionBuffer::build_pyramid()
+{
+    for (std::size_t l = 1; l < m_levels.size(); ++l) {
+        const Level& src = m_levels[l - 1];
+        Level& dst = m_levels[l];
+        for (int y = 0; y < dst.height; ++y) {
+            const float* const row0 = src.depth.data() + 2 * y * src.width;
+            const float* const row1 = src.depth.data() +
+                std::min(2 * y + 1, src.height - 1) * src.width;
+            float* const out = dst.depth.data() + y * dst.width;
+            for (int x = 0; x < dst.width; ++x) {
+                const int x0 = 2 * x;
+                const int x1 = std::min(2 * x + 1, src.width - 1);
+                out[x] = std::max(std::max(row0[x0], row0[x1]),
+                        std::max(row1[x0], row1[x1]));
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::is_aabb_visible(const vec3& mins,
+        const vec3& maxs) const
+{
+    float min_x = std::numeric_limits<float>::max();
+    float min_y = std::numeric_limits<float>::max();
+    float min_z = std::numeric_limits<float>::max();
+    float max_x = std::numeric_limits<float>::lowest();
+    float max_y = std::numeric_limits<float>::lowest();
+    for (int i = 0; i < 8; ++i) {
+        const float p[3] = {
+            i & 1 ? maxs.x : mins.x,
+            i & 2 ? maxs.y : mins.y,
+            i & 4 ? maxs.z : mins.z
+        };
+        float x, y, z;
+        if (!project(p, &x, &y, &z)) {
+            return true;
+        }
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        min_z = std::min(min_z, z);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+    }
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= m_width ||
+            min_y >= m_height) {
+        return true;
+    }
+
+    const int x0 = static_cast<int>(std::max(min_x - 1.0f, 0.0f));
+    const int y0 = static_cast<int>(std::max(min_y - 1.0f, 0.0f));
+    const int x1 = static_cast<int>(std::min(max_x + 1.0f, m_width - 1.0f));
+    const int y1 = static_cast<int>(std::min(max_y + 1.0f, m_height - 1.0f));
+    const int span = std::max(x1 - x0, y1 - y0);
+    std::size_t l = 0;
+    while (l + 1 < m_levels.size() && (span >> l) >= max_test_texels) {
+        ++l;
+    }
+
+    const Level& level = m_levels[l];
+    for (int y = y0 >> l; y <= y1 >> l; ++y) {
+        const float* const row = level.depth.data() + y * level.width;
+        for (int x = x0 >> l; x <= x1 >> l; ++x) {
+            if (row[x] >= min_z) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef Q3BSP__OCCLUSION_H
+#define Q3BSP__OCCLUSION_H
+
+#include <vector>
+
+#include "src/math/vector3.h"
+
+class ThreadPool;
+
+// Coarse software depth buffer for occlusion culling. Occluder triangles
+// are rasterized at a low resolution, then a pyramid is built in which each
+// texel holds the farthest depth of the texels below it, so a box is tested
+// against a handful of texels whatever its size on screen.
+//
+// Depth is the window-space z in [0, 1] of the GL projection. Coverage is
+// sampled at pixel centers and box tests are grown by one pixel to make up
+// for it, so the test is only as conservative as the resolution allows.
+class OcclusionBuffer
+{
+    public:
+        OcclusionBuffer(const int, const int);
+
+        OcclusionBuffer(const OcclusionBuffer&) = delete;
+        void operator=(const OcclusionBuffer&) = delete;
+
+        // Drops the occluders of the last frame. `clip` is a column-major
+        // projection times modelview matrix, as Frustum::get_clip_matrix().
+        void begin(const float*);
+
+        // Adds a world-space occluder triangle of either winding. Triangles
+        // crossing the near plane are left out.
+        void add_triangle(const float*, const float*, const float*);
+
+        // Rasterizes the occluders in bands of rows spread over `pool`, or
+        // on the calling thread when it is nullptr, and builds the pyramid.
+        void rasterize(ThreadPool*);
+
+        // False if the box is entirely behind the occluders.
+        bool is_aabb_visible(const vec3&, const vec3&) const;
+
+        std::size_t get_num_triangles() const
+        {
+            return m_triangles.size();
+        }
+
+    private:
+        // A triangle in window coordinates, oriented counter-clockwise.
+        struct Triangle
+        {
+            float   x[3];
+            float   y[3];
+            float   z[3];
+            int     min_y;
+            int     max_y;
+        };
+
+        struct Level
+        {
+            int                 width;
+            int                 height;
+            std::vector<float>  depth;
+        };
+
+        int                     m_width;
+        int                     m_height;
+        float                   m_clip[16];
+        std::vector<Triangle>   m_triangles;
+        std::vector<Level>      m_levels;   // Level 0 is the depth buffer.
+
+        bool project(const float*, float*, float*, float*) const;
+        void rasterize_rows(const Triangle&, const int, const int);
+        void build_pyramid();
+};
+
+#endif
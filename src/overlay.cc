@@ -0,0 +1,174 @@
+#include <cctype>
+#include <cstdint>
+
+#include <array>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "src/overlay.h"
+
+namespace
+{
+    const int glyph_width = 5;
+    const int glyph_height = 7;
+
+    // glBitmap ignores glPixelZoom, so glyphs are scaled up once instead.
+    const int scale = 2;
+    const int scaled_width = glyph_width * scale;
+    const int scaled_height = glyph_height * scale;
+    const int glyph_advance = (glyph_width + 1) * scale;
+    const int line_advance = (glyph_height + 3) * scale;
+
+    // ASCII 32 to 95. Rows run from bottom to top, as glBitmap expects.
+    const std::uint8_t font[64][glyph_height] = {
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ' '
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '!'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '"'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '#'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '$'
+        {0x18, 0x98, 0x40, 0x20, 0x10, 0xc8, 0xc0},  // '%'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '&'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '''
+        {0x10, 0x20, 0x40, 0x40, 0x40, 0x20, 0x10},  // '('
+        {0x40, 0x20, 0x10, 0x10, 0x10, 0x20, 0x40},  // ')'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '*'
+        {0x00, 0x20, 0x20, 0xf8, 0x20, 0x20, 0x00},  // '+'
+        {0x40, 0x20, 0x60, 0x00, 0x00, 0x00, 0x00},  // ','
+        {0x00, 0x00, 0x00, 0xf8, 0x00, 0x00, 0x00},  // '-'
+        {0x60, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00},  // '.'
+        {0x00, 0x80, 0x40, 0x20, 0x10, 0x08, 0x00},  // '/'
+        {0x70, 0x88, 0xc8, 0xa8, 0x98, 0x88, 0x70},  // '0'
+        {0x70, 0x20, 0x20, 0x20, 0x20, 0x60, 0x20},  // '1'
+        {0xf8, 0x40, 0x20, 0x10, 0x08, 0x88, 0x70},  // '2'
+        {0x70, 0x88, 0x08, 0x10, 0x20, 0x10, 0xf8},  // '3'
+        {0x10, 0x10, 0xf8, 0x90, 0x50, 0x30, 0x10},  // '4'
+        {0x70, 0x88, 0x08, 0x08, 0xf0, 0x80, 0xf8},  // '5'
+        {0x70, 0x88, 0x88, 0xf0, 0x80, 0x40, 0x30},  // '6'
+        {0x40, 0x40, 0x40, 0x20, 0x10, 0x08, 0xf8},  // '7'
+        {0x70, 0x88, 0x88, 0x70, 0x88, 0x88, 0x70},  // '8'
+        {0x60, 0x10, 0x08, 0x78, 0x88, 0x88, 0x70},  // '9'
+        {0x00, 0x60, 0x60, 0x00, 0x60, 0x60, 0x00},  // ':'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ';'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '<'
+        {0x00, 0x00, 0xf8, 0x00, 0xf8, 0x00, 0x00},  // '='
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '>'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '?'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '@'
+        {0x88, 0x88, 0x88, 0xf8, 0x88, 0x88, 0x70},  // 'A'
+        {0xf0, 0x88, 0x88, 0xf0, 0x88, 0x88, 0xf0},  // 'B'
+        {0x70, 0x88, 0x80, 0x80, 0x80, 0x88, 0x70},  // 'C'
+        {0xe0, 0x90, 0x88, 0x88, 0x88, 0x90, 0xe0},  // 'D'
+        {0xf8, 0x80, 0x80, 0xf0, 0x80, 0x80, 0xf8},  // 'E'
+        {0x80, 0x80, 0x80, 0xf0, 0x80, 0x80, 0xf8},  // 'F'
+        {0x78, 0x88, 0x88, 0xb8, 0x80, 0x88, 0x70},  // 'G'
+        {0x88, 0x88, 0x88, 0xf8, 0x88, 0x88, 0x88},  // 'H'
+        {0x70, 0x20, 0x20, 0x20, 0x20, 0x20, 0x70},  // 'I'
+        {0x60, 0x90, 0x10, 0x10, 0x10, 0x10, 0x38},  // 'J'
+        {0x88, 0x90, 0xa0, 0xc0, 0xa0, 0x90, 0x88},  // 'K'
+        {0xf8, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},  // 'L'
+        {0x88, 0x88, 0x88, 0xa8, 0xa8, 0xd8, 0x88},  // 'M'
+        {0x88, 0x88, 0x98, 0xa8, 0xc8, 0x88, 0x88},  // 'N'
+        {0x70, 0x88, 0x88, 0x88, 0x88, 0x88, 0x70},  // 'O'
+        {0x80, 0x80, 0x80, 0xf0, 0x88, 0x88, 0xf0},  // 'P'
+        {0x68, 0x90, 0xa8, 0x88, 0x88, 0x88, 0x70},  // 'Q'
+        {0x88, 0x90, 0xa0, 0xf0, 0x88, 0x88, 0xf0},  // 'R'
+        {0xf0, 0x08, 0x08, 0x70, 0x80, 0x80, 0x78},  // 'S'
+        {0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0xf8},  // 'T'
+        {0x70, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88},  // 'U'
+        {0x20, 0x50, 0x88, 0x88, 0x88, 0x88, 0x88},  // 'V'
+        {0x50, 0xa8, 0xa8, 0xa8, 0x88, 0x88, 0x88},  // 'W'
+        {0x88, 0x88, 0x50, 0x20, 0x50, 0x88, 0x88},  // 'X'
+        {0x20, 0x20, 0x20, 0x20, 0x50, 0x88, 0x88},  // 'Y'
+        {0xf8, 0x80, 0x40, 0x20, 0x10, 0x08, 0xf8},  // 'Z'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '['
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '\\'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ']'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '^'
+        {0xf8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '_'
+    };
+
+    // Two bytes per row of a scaled glyph.
+    using scaled_glyph_t = std::array<std::uint8_t, scaled_height * 2>;
+
+    const scaled_glyph_t* scaled_font()
+    {
+        static scaled_glyph_t glyphs[64];
+        static bool initialized = false;
+        if (initialized) {
+            return glyphs;
+        }
+        for (int i = 0; i < 64; ++i) {
+            glyphs[i].fill(0);
+            for (int y = 0; y < scaled_height; ++y) {
+                const std::uint8_t row = font[i][y / scale];
+                for (int x = 0; x < scaled_width; ++x) {
+                    if (row & (0x80 >> (x / scale))) {
+                        glyphs[i][y * 2 + x / 8] |=
+                            static_cast<std::uint8_t>(0x80 >> (x % 8));
+                    }
+                }
+            }
+        }
+        initialized = true;
+        return glyphs;
+    }
+
+    void draw_string(const std::string& text)
+    {
+        const scaled_glyph_t* glyphs = scaled_font();
+        for (char c : text) {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            int index = 0;
+            if (c >= 32 && c < 96) {
+                index = c - 32;
+            }
+            glBitmap(scaled_width, scaled_height, 0.0f, 0.0f, glyph_advance,
+                    0.0f, glyphs[index].data());
+        }
+    }
+}
+
+void draw_text_overlay(const std::vector<std::string>& lines, const int width,
+        const int height)
+{
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+
+    glActiveTexture(GL_TEXTURE1_ARB);
+    glDisable(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE0_ARB);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, width, 0.0, height, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    int y = height - line_advance;
+    for (auto&& line : lines) {
+        glColor3f(0.0f, 0.0f, 0.0f);
+        glRasterPos2i(9, y - 1);
+        draw_string(line);
+
+        glColor3f(1.0f, 1.0f, 0.3f);
+        glRasterPos2i(8, y);
+        draw_string(line);
+
+        y -= line_advance;
+    }
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    glPopClientAttrib();
+    glPopAttrib();
+}
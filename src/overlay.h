@@ -0,0 +1,12 @@
+#ifndef Q3BSP__OVERLAY_H
+#define Q3BSP__OVERLAY_H
+
+#include <vector>
+#include <string>
+
+// Draws lines of text in the top left corner of the viewport using a
+// built-in 5x7 bitmap font. Lowercase letters are shown as uppercase.
+extern void draw_text_overlay(const std::vector<std::string>&, const int,
+        const int);
+
+#endif
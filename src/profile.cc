@@ -0,0 +1,213 @@
+#ifdef Q3BSP_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include "src/profile.h"
+
+namespace
+{
+    // Events per thread. Half of what it was before events carried a detail
+    // string, which made them 80 bytes, so that each ring, one per loading
+    // thread as well, stays at about 2.5 MB.
+    const std::size_t ring_capacity = 1 << 15;
+
+    class ProfileRing
+    {
+        public:
+            explicit ProfileRing(const int tid)
+                : m_tid(tid), m_name("thread " + std::to_string(tid)),
+                m_events(ring_capacity), m_count(0), m_first(0)
+            {}
+
+            ProfileRing(const ProfileRing&) = delete;
+            void operator=(const ProfileRing&) = delete;
+
+            // Called by the ring's own thread only, so the event is
+            // published with a release store rather than under the mutex.
+            void record(const ProfileEvent& event)
+            {
+                const std::uint64_t count =
+                    m_count.load(std::memory_order_relaxed);
+                m_events[count & (ring_capacity - 1)] = event;
+                m_count.store(count + 1, std::memory_order_release);
+            }
+
+            void set_name(const char* name)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_name = name;
+            }
+
+            // Leaves the count to the recording thread and skips the events
+            // before it instead.
+            void clear()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_first = m_count.load(std::memory_order_acquire);
+            }
+
+            void write_json(std::ostream& os, const std::int64_t epoch,
+                    bool* first) const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                write_separator(os, first);
+                os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1," <<
+                    "\"tid\":" << m_tid << ",\"args\":{\"name\":\"" << m_name <<
+                    "\"}}";
+
+                // The events are copied out first, since the recording
+                // thread may overwrite the oldest ones meanwhile; those it
+                // may have overwritten by the end of the copy, counting the
+                // one being written, are dropped. The copy races with those
+                // writes: slots are plain ProfileEvents, not atomics, and a
+                // torn copy is only detected by the count afterwards. That
+                // is tolerated, since only a full ring is overwritten, the
+                // torn copies are never written out, and a sequence number
+                // per slot would cost every event two more atomic stores.
+                const std::uint64_t count =
+                    m_count.load(std::memory_order_acquire);
+                const std::uint64_t start = std::max(m_first,
+                        count - std::min<std::uint64_t>(count, ring_capacity));
+                std::vector<ProfileEvent> events;
+                events.reserve(count - start);
+                for (std::uint64_t i = start; i < count; ++i) {
+                    events.push_back(m_events[i & (ring_capacity - 1)]);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const std::uint64_t end =
+                    m_count.load(std::memory_order_relaxed);
+                const std::uint64_t first_intact = end + 1 -
+                    std::min<std::uint64_t>(end + 1, ring_capacity);
+                const std::size_t num_overwritten = static_cast<std::size_t>(
+                        std::min<std::uint64_t>(events.size(),
+                            first_intact - std::min(first_intact, start)));
+
+                for (std::size_t i = num_overwritten; i < events.size(); ++i) {
+                    const ProfileEvent& event = events[i];
+                    write_separator(os, first);
+                    os << "{\"name\":\"" << event.name << "\",\"ph\":\"X\"," <<
+                        "\"pid\":1,\"tid\":" << m_tid <<
+                        ",\"ts\":" << to_usec(event.start - epoch) <<
+                        ",\"dur\":" << to_usec(event.end - event.start);
+                    if (event.arg_name || event.detail[0]) {
+                        write_args(os, event);
+                    }
+                    os << "}";
+                }
+            }
+
+        private:
+            const int                   m_tid;
+            std::string                 m_name;
+            std::vector<ProfileEvent>   m_events;
+            std::atomic<std::uint64_t>  m_count;    // Written by the owner.
+            std::uint64_t               m_first;    // First event not cleared.
+            mutable std::mutex          m_mutex;    // Export, clear, name.
+
+            static double to_usec(const std::int64_t ticks)
+            {
+                return ticks / double(TICKS_PER_SECOND / 1000000);
+            }
+
+            static void write_args(std::ostream& os, const ProfileEvent& event)
+            {
+                os << ",\"args\":{";
+                if (event.detail[0]) {
+                    os << "\"detail\":\"";
+                    for (const char* p = event.detail; *p; ++p) {
+                        if (*p == '"' || *p == '\\') {
+                            os << '\\';
+                        }
+                        os << *p;
+                    }
+                    os << "\"";
+                    if (event.arg_name) {
+                        os << ",";
+                    }
+                }
+                if (event.arg_name) {
+                    os << "\"" << event.arg_name << "\":" << event.arg_value;
+                }
+                os << "}";
+            }
+
+            static void write_separator(std::ostream& os, bool* first)
+            {
+                if (!*first) {
+                    os << ",\n";
+                }
+                *first = false;
+            }
+    };
+
+    using ring_sptr_t = std::shared_ptr<ProfileRing>;
+
+    // Rings are owned by the registry so that events of threads which have
+    // already exited can still be exported.
+    std::mutex g_registry_mutex;
+    std::vector<ring_sptr_t> g_registry;
+    const std::int64_t g_epoch = get_ticks();
+
+    ProfileRing& this_thread_ring()
+    {
+        thread_local ring_sptr_t ring;
+        if (!ring) {
+            std::lock_guard<std::mutex> lock(g_registry_mutex);
+            ring = std::make_shared<ProfileRing>(
+                    static_cast<int>(g_registry.size()) + 1);
+            g_registry.push_back(ring);
+        }
+        return *ring;
+    }
+}
+
+void profile_record(const ProfileEvent& event)
+{
+    this_thread_ring().record(event);
+}
+
+void profile_set_thread_name(const char* name)
+{
+    this_thread_ring().set_name(name);
+}
+
+bool profile_export_chrome_trace(const char* filename)
+{
+    std::ofstream os(filename);
+    if (!os) {
+        std::cerr << filename << ": Couldn't open trace file for writing" <<
+            std::endl;
+        return false;
+    }
+
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+        for (auto&& ring : g_registry) {
+            ring->write_json(os, g_epoch, &first);
+        }
+    }
+    os << "\n]}" << std::endl;
+    return bool(os);
+}
+
+void profile_clear()
+{
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    for (auto&& ring : g_registry) {
+        ring->clear();
+    }
+}
+
+#endif
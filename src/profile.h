@@ -0,0 +1,105 @@
+#ifndef Q3BSP__PROFILE_H
+#define Q3BSP__PROFILE_H
+
+#include <cstdint>
+
+// Scoped stage timers. Each thread records into its own fixed-size ring
+// buffer, so recording never allocates and only the newest events are kept.
+// The buffers can be exported at any time as Chrome trace-event JSON
+// (chrome://tracing, Perfetto).
+//
+// PROFILE_SPAN names the timer so that a short detail string (usually a
+// file name) and one numeric argument (usually a byte count) can be
+// attached; both show up as the event's "args" in the trace.
+//
+// Without Q3BSP_PROFILE the macros expand to nothing and the functions are
+// empty inline stubs.
+
+#ifdef Q3BSP_PROFILE
+
+#include <cstring>
+
+#include "src/time.h"
+
+struct ProfileEvent
+{
+    const char*     name;
+    std::int64_t    start;
+    std::int64_t    end;
+
+    const char*     arg_name;
+    std::int64_t    arg_value;
+    char            detail[40];
+};
+
+extern void profile_record(const ProfileEvent&);
+
+class ProfileScope
+{
+    public:
+        explicit ProfileScope(const char* name, const char* detail = nullptr)
+        {
+            m_event.name = name;
+            m_event.arg_name = nullptr;
+            m_event.arg_value = 0;
+            m_event.detail[0] = '\0';
+            if (detail) {
+                std::strncpy(m_event.detail, detail, sizeof(m_event.detail));
+                m_event.detail[sizeof(m_event.detail) - 1] = '\0';
+            }
+            m_event.start = get_ticks();
+        }
+
+        ~ProfileScope() noexcept
+        {
+            m_event.end = get_ticks();
+            profile_record(m_event);
+        }
+
+        ProfileScope(const ProfileScope&) = delete;
+        void operator=(const ProfileScope&) = delete;
+
+        void set_arg(const char* name, const std::int64_t value)
+        {
+            m_event.arg_name = name;
+            m_event.arg_value = value;
+        }
+
+    private:
+        ProfileEvent m_event;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_SPAN(var, name) ProfileScope var(name)
+#define PROFILE_SPAN_DETAIL(var, name, detail) ProfileScope var(name, detail)
+#define PROFILE_SPAN_ARG(var, arg_name, value) \
+    var.set_arg(arg_name, static_cast<std::int64_t>(value))
+
+extern void profile_set_thread_name(const char*);
+extern bool profile_export_chrome_trace(const char*);
+extern void profile_clear();
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_SPAN(var, name)
+#define PROFILE_SPAN_DETAIL(var, name, detail)
+#define PROFILE_SPAN_ARG(var, arg_name, value)
+
+inline void profile_set_thread_name(const char*)
+{}
+
+inline bool profile_export_chrome_trace(const char*)
+{
+    return false;
+}
+
+inline void profile_clear()
+{}
+
+#endif
+
+#endif
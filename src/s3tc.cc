@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "src/s3tc.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Power iterations for the principal axis of a block's colors.
+    const int axis_iterations = 4;
+
+    std::size_t get_block_bytes(const CompressedFormat format)
+    {
+        return format == COMPRESSED_BC1 ? 8 : 16;
+    }
+
+    std::size_t get_num_blocks(const unsigned width, const unsigned height)
+    {
+        return ((std::max(width, 1u) + 3) / 4) *
+            static_cast<std::size_t>((std::max(height, 1u) + 3) / 4);
+    }
+
+    void fetch_block(const Image& level, const unsigned bx,
+            const unsigned by, pixel_t block[16])
+    {
+        const pixel_t* const pixels = level.get_pixels().data();
+        for (unsigned y = 0; y < 4; ++y) {
+            const unsigned sy = std::min(by * 4 + y, level.get_height() - 1);
+            for (unsigned x = 0; x < 4; ++x) {
+                const unsigned sx =
+                    std::min(bx * 4 + x, level.get_width() - 1);
+                block[y * 4 + x] = pixels[sy * level.get_width() + sx];
+            }
+        }
+    }
+
+    std::uint16_t to_565(const float rgb[3])
+    {
+        const auto quantize = [](const float v, const float levels) {
+            const float q = std::round(v * levels / 255.0f);
+            return static_cast<unsigned>(std::min(std::max(q, 0.0f), levels));
+        };
+        return static_cast<std::uint16_t>(quantize(rgb[0], 31.0f) << 11 |
+                quantize(rgb[1], 63.0f) << 5 | quantize(rgb[2], 31.0f));
+    }
+
+    void from_565(const unsigned c, unsigned rgb[3])
+    {
+        const unsigned r = c >> 11 & 31;
+        const unsigned g = c >> 5 & 63;
+        const unsigned b = c & 31;
+        rgb[0] = r << 3 | r >> 2;
+        rgb[1] = g << 2 | g >> 4;
+        rgb[2] = b << 3 | b >> 2;
+    }
+
+    // The four colors of a block with c0 > c1, or three and black
+    // otherwise, as the decoder of BC1 sees them. BC3 always has four.
+    void make_palette(const unsigned c0, const unsigned c1,
+            const bool four_colors, unsigned palette[4][3])
+    {
+        from_565(c0, palette[0]);
+        from_565(c1, palette[1]);
+        for (int i = 0; i < 3; ++i) {
+            const unsigned a = palette[0][i];
+            const unsigned b = palette[1][i];
+            if (four_colors) {
+                palette[2][i] = (2 * a + b) / 3;
+                palette[3][i] = (a + 2 * b) / 3;
+            }
+            else {
+                palette[2][i] = (a + b) / 2;
+                palette[3][i] = 0;
+            }
+        }
+    }
+
+    void write_le(std::uint64_t v, const int bytes, std::uint8_t* out)
+    {
+        for (int i = 0; i < bytes; ++i, v >>= 8) {
+            out[i] = static_cast<std::uint8_t>(v);
+        }
+    }
+
+    std::uint64_t read_le(const std::uint8_t* in, const int bytes)
+    {
+        std::uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; --i) {
+            v = v << 8 | in[i];
+        }
+        return v;
+    }
+
+    // Fits the endpoints to the extent of the colors along their principal
+    // axis, then gives each texel the closest of the four colors.
+    void encode_color_block(const pixel_t block[16], std::uint8_t out[8])
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            mean[0] += block[i].red;
+            mean[1] += block[i].green;
+            mean[2] += block[i].blue;
+        }
+        for (auto&& m : mean) {
+            m /= 16.0f;
+        }
+
+        // Covariance: rr, rg, rb, gg, gb, bb.
+        float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            const float r = block[i].red - mean[0];
+            const float g = block[i].green - mean[1];
+            const float b = block[i].blue - mean[2];
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int k = 0; k < axis_iterations; ++k) {
+            const float x = cov[0] * axis[0] + cov[1] * axis[1] +
+                cov[2] * axis[2];
+            const float y = cov[1] * axis[0] + cov[3] * axis[1] +
+                cov[4] * axis[2];
+            const float z = cov[2] * axis[0] + cov[4] * axis[1] +
+                cov[5] * axis[2];
+            const float norm = std::max(std::abs(x),
+                    std::max(std::abs(y), std::abs(z)));
+            if (!(norm > 0.0f)) {
+                break;
+            }
+            axis[0] = x / norm;
+            axis[1] = y / norm;
+            axis[2] = z / norm;
+        }
+        const float length = std::sqrt(axis[0] * axis[0] +
+                axis[1] * axis[1] + axis[2] * axis[2]);
+        for (auto&& a : axis) {
+            a /= length;
+        }
+
+        float t_min = std::numeric_limits<float>::max();
+        float t_max = std::numeric_limits<float>::lowest();
+        for (int i = 0; i < 16; ++i) {
+            const float t = (block[i].red - mean[0]) * axis[0] +
+                (block[i].green - mean[1]) * axis[1] +
+                (block[i].blue - mean[2]) * axis[2];
+            t_min = std::min(t_min, t);
+            t_max = std::max(t_max, t);
+        }
+        float e0[3], e1[3];
+        for (int i = 0; i < 3; ++i) {
+            e0[i] = mean[i] + axis[i] * t_max;
+            e1[i] = mean[i] + axis[i] * t_min;
+        }
+        unsigned c0 = to_565(e0);
+        unsigned c1 = to_565(e1);
+        if (c0 < c1) {
+            std::swap(c0, c1);
+        }
+
+        // Equal endpoints leave every index at 0, which is c0 in either
+        // mode.
+        std::uint32_t indices = 0;
+        if (c0 != c1) {
+            unsigned palette[4][3];
+            make_palette(c0, c1, true, palette);
+            for (int i = 0; i < 16; ++i) {
+                const int rgb[3] = { block[i].red, block[i].green,
+                    block[i].blue };
+                unsigned best = 0;
+                int best_dist = std::numeric_limits<int>::max();
+                for (unsigned j = 0; j < 4; ++j) {
+                    int dist = 0;
+                    for (int k = 0; k < 3; ++k) {
+                        const int d = rgb[k] - static_cast<int>(palette[j][k]);
+                        dist += d * d;
+                    }
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        best = j;
+                    }
+                }
+                indices |= best << (2 * i);
+            }
+        }
+        write_le(c0, 2, out);
+        write_le(c1, 2, out + 2);
+        write_le(indices, 4, out + 4);
+    }
+
+    // Interpolates eight alphas between the extremes of the block.
+    void encode_alpha_block(const pixel_t block[16], std::uint8_t out[8])
+    {
+        unsigned a0 = 0;
+        unsigned a1 = 255;
+        for (int i = 0; i < 16; ++i) {
+            a0 = std::max<unsigned>(a0, block[i].alpha);
+            a1 = std::min<unsigned>(a1, block[i].alpha);
+        }
+        std::uint64_t indices = 0;
+        if (a0 > a1) {
+            unsigned palette[8] = { a0, a1 };
+            for (unsigned j = 2; j < 8; ++j) {
+                palette[j] = ((8 - j) * a0 + (j - 1) * a1) / 7;
+            }
+            for (int i = 0; i < 16; ++i) {
+                const int a = block[i].alpha;
+                std::uint64_t best = 0;
+                int best_dist = std::numeric_limits<int>::max();
+                for (unsigned j = 0; j < 8; ++j) {
+                    const int dist = std::abs(a - static_cast<int>(palette[j]));
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        best = j;
+                    }
+                }
+                indices |= best << (3 * i);
+            }
+        }
+        out[0] = static_cast<std::uint8_t>(a0);
+        out[1] = static_cast<std::uint8_t>(a1);
+        write_le(indices, 6, out + 2);
+    }
+
+    void decode_color_block(const std::uint8_t in[8], const bool bc3,
+            pixel_t block[16])
+    {
+        const auto c0 = static_cast<unsigned>(read_le(in, 2));
+        const auto c1 = static_cast<unsigned>(read_le(in + 2, 2));
+        const auto indices = read_le(in + 4, 4);
+        unsigned palette[4][3];
+        make_palette(c0, c1, bc3 || c0 > c1, palette);
+        for (int i = 0; i < 16; ++i) {
+            const unsigned* const c = palette[indices >> (2 * i) & 3];
+            block[i].red = static_cast<std::uint8_t>(c[0]);
+            block[i].green = static_cast<std::uint8_t>(c[1]);
+            block[i].blue = static_cast<std::uint8_t>(c[2]);
+            block[i].alpha = 255;
+        }
+    }
+
+    void decode_alpha_block(const std::uint8_t in[8], pixel_t block[16])
+    {
+        const unsigned a0 = in[0];
+        const unsigned a1 = in[1];
+        const auto indices = read_le(in + 2, 6);
+        unsigned palette[8] = { a0, a1 };
+        if (a0 > a1) {
+            for (unsigned j = 2; j < 8; ++j) {
+                palette[j] = ((8 - j) * a0 + (j - 1) * a1) / 7;
+            }
+        }
+        else {
+            for (unsigned j = 2; j < 6; ++j) {
+                palette[j] = ((6 - j) * a0 + (j - 1) * a1) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        for (int i = 0; i < 16; ++i) {
+            block[i].alpha =
+                static_cast<std::uint8_t>(palette[indices >> (3 * i) & 7]);
+        }
+    }
+
+    CompressedLevel compress_level(const CompressedFormat format,
+            const Image& level)
+    {
+        CompressedLevel out{level.get_width(), level.get_height(), {}};
+        const unsigned blocks_x = (level.get_width() + 3) / 4;
+        const unsigned blocks_y = (level.get_height() + 3) / 4;
+        const std::size_t block_bytes = get_block_bytes(format);
+        out.blocks.resize(get_num_blocks(out.width, out.height) *
+                block_bytes);
+        std::uint8_t* p = out.blocks.data();
+        pixel_t block[16];
+        for (unsigned by = 0; by < blocks_y; ++by) {
+            for (unsigned bx = 0; bx < blocks_x; ++bx, p += block_bytes) {
+                fetch_block(level, bx, by, block);
+                if (format == COMPRESSED_BC3) {
+                    encode_alpha_block(block, p);
+                    encode_color_block(block, p + 8);
+                }
+                else {
+                    encode_color_block(block, p);
+                }
+            }
+        }
+        return out;
+    }
+}
+
+std::size_t CompressedTexture::get_bytes() const
+{
+    std::size_t bytes = 0;
+    for (auto&& level : levels) {
+        bytes += level.blocks.size();
+    }
+    return bytes;
+}
+
+std::size_t CompressedTexture::get_uncompressed_bytes() const
+{
+    std::size_t bytes = 0;
+    for (auto&& level : levels) {
+        bytes += std::size_t(level.width) * level.height * sizeof(pixel_t);
+    }
+    return bytes;
+}
+
+CompressedTexture compress_mip_chain(const mip_chain_t& levels)
+{
+    PROFILE_SCOPE("compress_texture");
+    CompressedTexture texture;
+    if (levels.empty()) {
+        return texture;
+    }
+    const pixel_vector_t& pixels = levels[0].get_pixels();
+    const bool opaque = std::all_of(pixels.begin(), pixels.end(),
+            [](const pixel_t& p) { return p.alpha == 255; });
+    texture.format = opaque ? COMPRESSED_BC1 : COMPRESSED_BC3;
+    for (auto&& level : levels) {
+        texture.levels.push_back(compress_level(texture.format, level));
+    }
+    return texture;
+}
+
+Image decompress_level(const CompressedFormat format,
+        const CompressedLevel& level)
+{
+    const unsigned width = level.width;
+    const unsigned height = level.height;
+    pixel_vector_t pixels(std::size_t(width) * height);
+    const std::size_t block_bytes = get_block_bytes(format);
+    const std::uint8_t* p = level.blocks.data();
+    pixel_t block[16];
+    for (unsigned by = 0; by < (height + 3) / 4; ++by) {
+        for (unsigned bx = 0; bx < (width + 3) / 4; ++bx, p += block_bytes) {
+            if (format == COMPRESSED_BC3) {
+                decode_color_block(p + 8, true, block);
+                decode_alpha_block(p, block);
+            }
+            else {
+                decode_color_block(p, false, block);
+            }
+            for (unsigned y = 0; y < 4 && by * 4 + y < height; ++y) {
+                for (unsigned x = 0; x < 4 && bx * 4 + x < width; ++x) {
+                    pixels[(by * 4 + y) * width + bx * 4 + x] =
+                        block[y * 4 + x];
+                }
+            }
+        }
+    }
+    return Image(width, height, std::move(pixels));
+}
@@ -0,0 +1,44 @@
+#ifndef Q3BSP__S3TC_H
+#define Q3BSP__S3TC_H
+
+#include <vector>
+#include <cstdint>
+
+#include "src/image.h"
+#include "src/mipmap.h"
+
+// Block compression of 4x4 texels: BC1 (DXT1) stores the colors of a block
+// in 8 bytes, BC3 (DXT5) adds 8 bytes of alpha. Blocks past the edges of a
+// level repeat its last row and column.
+enum CompressedFormat
+{
+    COMPRESSED_BC1,
+    COMPRESSED_BC3
+};
+
+struct CompressedLevel
+{
+    unsigned                    width;
+    unsigned                    height;
+    std::vector<std::uint8_t>   blocks;
+};
+
+struct CompressedTexture
+{
+    CompressedFormat                format = COMPRESSED_BC1;
+    std::vector<CompressedLevel>    levels;
+
+    std::size_t get_bytes() const;
+
+    // Of the same levels as RGBA8.
+    std::size_t get_uncompressed_bytes() const;
+};
+
+// Compresses each level of the chain, to BC1 if every texel of level 0 is
+// opaque and to BC3 otherwise.
+extern CompressedTexture compress_mip_chain(const mip_chain_t&);
+
+// Decodes a level back to RGBA8, for GL implementations without S3TC.
+extern Image decompress_level(const CompressedFormat, const CompressedLevel&);
+
+#endif
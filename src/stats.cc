@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+
+#include "src/stats.h"
+
+namespace
+{
+    struct StatInfo
+    {
+        const char* metric;     // Prometheus metric name.
+        const char* label;      // Extra Prometheus label, or nullptr.
+        const char* help;
+        const char* overlay;    // Overlay row title.
+    };
+
+    const StatInfo stat_info[STAT_COUNT] = {
+        {"q3bsp_leaves_in_pvs", nullptr,
+            "Leaves in the potentially visible set", "LEAVES IN PVS"},
+        {"q3bsp_leaves_area_culled", nullptr,
+            "Leaves in areas not connected to the camera's", "AREA CULLED"},
+        {"q3bsp_leaves_culled", nullptr,
+            "Leaves rejected by the view frustum", "LEAVES CULLED"},
+        {"q3bsp_clusters_culled", nullptr,
+            "Clusters rejected by the view frustum", "CLUSTERS CULLED"},
+        {"q3bsp_occluders", nullptr,
+            "Faces rasterized for occlusion culling", "OCCLUDERS"},
+        {"q3bsp_leaves_occluded", nullptr,
+            "Leaves in the frustum rejected by occlusion culling",
+            "LEAVES OCCL."},
+        {"q3bsp_clusters_occluded", nullptr,
+            "Clusters in the frustum rejected by occlusion culling",
+            "CLUSTERS OCCL."},
+        {"q3bsp_occlusion_usec", nullptr,
+            "Microseconds spent rasterizing occluders", "OCCLUSION USEC"},
+        {"q3bsp_nodes_visited", nullptr,
+            "BSP nodes visited", "NODES VISITED"},
+        {"q3bsp_faces_culled", nullptr,
+            "Faces in visible leaves rejected by the view frustum",
+            "FACES CULLED"},
+        {"q3bsp_faces_backfacing", nullptr,
+            "Faces rejected as facing away from the camera", "BACKFACING"},
+        {"q3bsp_faces_drawn", "type=\"polygon\"",
+            "Faces drawn by face type", "POLYGONS"},
+        {"q3bsp_faces_drawn", "type=\"patch\"",
+            nullptr, "PATCHES"},
+        {"q3bsp_faces_drawn", "type=\"mesh\"",
+            nullptr, "MESHES"},
+        {"q3bsp_faces_skipped", "type=\"billboard\"",
+            "Faces reaching the draw but not drawn, by face type",
+            "BILLBOARDS SKIP."},
+        {"q3bsp_batches_drawn", nullptr,
+            "Static batches drawn", "BATCHES"},
+        {"q3bsp_batches_culled", nullptr,
+            "Static batches rejected by area, frustum or occlusion",
+            "BATCHES CULLED"},
+        {"q3bsp_vertices", nullptr,
+            "Vertices submitted", "VERTICES"},
+        {"q3bsp_indices", nullptr,
+            "Indices submitted", "INDICES"},
+        {"q3bsp_texture_binds", nullptr,
+            "glBindTexture calls", "TEXTURE BINDS"},
+        {"q3bsp_textures_streamed", nullptr,
+            "Textures streamed in and uploaded", "TEX STREAMED"},
+        {"q3bsp_texture_upload_bytes", nullptr,
+            "Bytes of texture data uploaded", "TEX UPLOAD BYTES"},
+        {"q3bsp_textures_pending", nullptr,
+            "Textures still to be streamed in", "TEX PENDING"},
+        {"q3bsp_textures_restored", nullptr,
+            "Lowered textures drawn again and restored to full size",
+            "TEX RESTORED"},
+        {"q3bsp_textures_lowered", nullptr,
+            "Textures with mip levels dropped to fit the memory limit",
+            "TEX LOWERED"},
+        {"q3bsp_texture_resident_kbytes", nullptr,
+            "Estimated texture memory in use, in KB", "TEX RESIDENT KB"},
+        {"q3bsp_draw_calls", nullptr,
+            "GL draw calls", "DRAW CALLS"},
+        {"q3bsp_samples_passed", nullptr,
+            "Samples of the map passing the depth test, one frame late",
+            "SAMPLES PASSED"}
+    };
+
+    void write_sample(std::ostream& os, const StatInfo& info,
+            const char* stat, const double value)
+    {
+        os << info.metric << "{";
+        if (info.label) {
+            os << info.label << ",";
+        }
+        os << "stat=\"" << stat << "\"} " << value << "\n";
+    }
+}
+
+RenderStats::RenderStats(const std::size_t window)
+    : m_window(std::max<std::size_t>(window, 1)), m_next(0), m_filled(0),
+    m_frames(0)
+{
+    m_sums.fill(0);
+}
+
+void RenderStats::add(const FrameStats& frame)
+{
+    FrameStats& slot = m_window[m_next];
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        const auto counter = static_cast<StatCounter>(i);
+        m_sums[i] += frame.get(counter);
+        if (m_filled == m_window.size()) {
+            m_sums[i] -= slot.get(counter);
+        }
+    }
+    slot = frame;
+
+    m_next = (m_next + 1) % m_window.size();
+    m_filled = std::min(m_filled + 1, m_window.size());
+    ++m_frames;
+}
+
+double RenderStats::get_average(const StatCounter counter) const
+{
+    return m_filled ? m_sums[counter] / double(m_filled) : 0.0;
+}
+
+std::uint64_t RenderStats::get_max(const StatCounter counter) const
+{
+    std::uint64_t m = 0;
+    for (std::size_t i = 0; i < m_filled; ++i) {
+        m = std::max(m, m_window[i].get(counter));
+    }
+    return m;
+}
+
+std::uint64_t RenderStats::get_last(const StatCounter counter) const
+{
+    if (m_filled == 0) {
+        return 0;
+    }
+    const auto last = (m_next + m_window.size() - 1) % m_window.size();
+    return m_window[last].get(counter);
+}
+
+std::vector<std::string> RenderStats::format_lines() const
+{
+    std::vector<std::string> lines;
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "%-14s %8s %8s %8s", "", "LAST", "AVG",
+            "MAX");
+    lines.push_back(buf);
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        const auto counter = static_cast<StatCounter>(i);
+        std::snprintf(buf, sizeof(buf), "%-14s %8llu %8.1f %8llu",
+                stat_info[i].overlay,
+                static_cast<unsigned long long>(get_last(counter)),
+                get_average(counter),
+                static_cast<unsigned long long>(get_max(counter)));
+        lines.push_back(buf);
+    }
+    return lines;
+}
+
+// The file is written next to its destination and renamed into place, so
+// a scraper never sees a partial file.
+bool RenderStats::write_prometheus(const char* filename) const
+{
+    const std::string tmp_filename = std::string(filename) + ".tmp";
+    {
+        std::ofstream os(tmp_filename);
+        if (!os) {
+            return false;
+        }
+        os << std::fixed << std::setprecision(2);
+        os << "# HELP q3bsp_frames_total Frames rendered.\n";
+        os << "# TYPE q3bsp_frames_total counter\n";
+        os << "q3bsp_frames_total " << m_frames << "\n";
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            const StatInfo& info = stat_info[i];
+            const auto counter = static_cast<StatCounter>(i);
+            if (info.help) {
+                os << "# HELP " << info.metric << " " << info.help <<
+                    " per frame over the last " << m_window.size() <<
+                    " frames.\n";
+                os << "# TYPE " << info.metric << " gauge\n";
+            }
+            write_sample(os, info, "last", get_last(counter));
+            write_sample(os, info, "avg", get_average(counter));
+            write_sample(os, info, "max", get_max(counter));
+        }
+        if (!os) {
+            return false;
+        }
+    }
+    return std::rename(tmp_filename.c_str(), filename) == 0;
+}
@@ -0,0 +1,101 @@
+#ifndef Q3BSP__STATS_H
+#define Q3BSP__STATS_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+enum StatCounter
+{
+    STAT_LEAVES_IN_PVS,
+    STAT_LEAVES_AREA_CULLED,
+    STAT_LEAVES_CULLED,
+    STAT_CLUSTERS_CULLED,
+    STAT_OCCLUDERS,
+    STAT_LEAVES_OCCLUDED,
+    STAT_CLUSTERS_OCCLUDED,
+    STAT_OCCLUSION_USEC,
+    STAT_NODES_VISITED,
+    STAT_FACES_CULLED,
+    STAT_FACES_BACKFACING,
+    STAT_FACES_POLYGON,
+    STAT_FACES_PATCH,
+    STAT_FACES_MESH,
+    STAT_FACES_BILLBOARD,
+    STAT_BATCHES,
+    STAT_BATCHES_CULLED,
+    STAT_VERTICES,
+    STAT_INDICES,
+    STAT_TEXTURE_BINDS,
+    STAT_TEXTURES_STREAMED,
+    STAT_TEXTURE_UPLOAD_BYTES,
+    STAT_TEXTURES_PENDING,
+    STAT_TEXTURES_RESTORED,
+    STAT_TEXTURES_LOWERED,
+    STAT_TEXTURE_RESIDENT_KB,
+    STAT_DRAW_CALLS,
+    STAT_SAMPLES_PASSED,
+
+    STAT_COUNT
+};
+
+// Counters of a single frame, filled in by the renderer.
+class FrameStats
+{
+    public:
+        FrameStats()
+        {
+            m_counters.fill(0);
+        }
+
+        void add(const StatCounter counter, const std::uint64_t n = 1)
+        {
+            m_counters[counter] += n;
+        }
+
+        void add(const FrameStats& other)
+        {
+            for (std::size_t i = 0; i < m_counters.size(); ++i) {
+                m_counters[i] += other.m_counters[i];
+            }
+        }
+
+        std::uint64_t get(const StatCounter counter) const
+        {
+            return m_counters[counter];
+        }
+
+    private:
+        std::array<std::uint64_t, STAT_COUNT> m_counters;
+};
+
+// Rolling average and maximum of each counter over the last frames.
+class RenderStats
+{
+    public:
+        explicit RenderStats(const std::size_t = 120);
+
+        void add(const FrameStats&);
+
+        std::uint64_t get_frames() const
+        {
+            return m_frames;
+        }
+
+        double get_average(const StatCounter) const;
+        std::uint64_t get_max(const StatCounter) const;
+        std::uint64_t get_last(const StatCounter) const;
+
+        std::vector<std::string> format_lines() const;
+        bool write_prometheus(const char*) const;
+
+    private:
+        std::vector<FrameStats>                 m_window;
+        std::size_t                             m_next;
+        std::size_t                             m_filled;
+        std::uint64_t                           m_frames;
+        std::array<std::uint64_t, STAT_COUNT>   m_sums;
+};
+
+#endif
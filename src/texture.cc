@@ -1,21 +1,230 @@
+#include <algorithm>
+#include <cstring>
+
 #include <boost/filesystem.hpp>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// AVX2 is compiled for separately and picked at run time.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define Q3BSP_LIGHTMAP_AVX2
+#include <immintrin.h>
+#endif
+
 #include <GL/gl.h>
-#include <GL/glu.h>
 
 #include "src/texture.h"
+#include "src/upload_ring.h"
 #include "src/archive.h"
 #include "src/exception.h"
+#include "src/profile.h"
 
-ImageTexture::ImageTexture(const char* filename, const PAK3Archive& pak)
+namespace
+{
+    std::size_t get_level_bytes(const GLenum format, const unsigned width,
+            const unsigned height)
+    {
+        if (format == GL_RGBA) {
+            return std::size_t(width) * height * sizeof(pixel_t);
+        }
+        return ((width + 3) / 4) * std::size_t((height + 3) / 4) *
+            (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16);
+    }
+
+    // Of a chain where each level halves the last, down to 1.
+    std::size_t get_chain_bytes(const GLenum format, unsigned width,
+            unsigned height, const unsigned num_levels)
+    {
+        std::size_t bytes = 0;
+        for (unsigned i = 0; i < num_levels; ++i) {
+            bytes += get_level_bytes(format, width, height);
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+        return bytes;
+    }
+
+    GLenum get_compressed_format(const CompressedFormat format)
+    {
+        return format == COMPRESSED_BC1 ?
+            GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+
+    // Largest shift for which the vector kernels are exact: c << 8 times a
+    // scale of at most 255 stays below 2^24, so it is exact as a float.
+    const unsigned max_vector_overbright_bits = 8;
+
+    void convert_lightmap_texel(const std::uint8_t* p, std::uint8_t* q,
+            const unsigned overbright_bits)
+    {
+        unsigned r = static_cast<unsigned>(p[0]) << overbright_bits;
+        unsigned g = static_cast<unsigned>(p[1]) << overbright_bits;
+        unsigned b = static_cast<unsigned>(p[2]) << overbright_bits;
+        unsigned cmax = std::max(std::max(r, g), b);
+        if (cmax > 255) {
+            cmax = (255 << 8) / cmax;
+            r = (r * cmax) >> 8;
+            g = (g * cmax) >> 8;
+            b = (b * cmax) >> 8;
+        }
+        q[0] = static_cast<std::uint8_t>(r);
+        q[1] = static_cast<std::uint8_t>(g);
+        q[2] = static_cast<std::uint8_t>(b);
+        q[3] = 255;
+    }
+
+    // The vector kernels take texels as 32-bit lanes of R | G << 8 | B << 16
+    // and compute in floats, which hold the shifted channels exactly. The
+    // scale 65280 / cmax is at least 1 / 65280 away from the next integer
+    // unless it is one, well beyond a float's error, so truncating the
+    // quotient gives the integer division. The scaled channels are shifted
+    // right by multiplying by 1 / 256, which is exact, and truncating.
+#ifdef __SSE2__
+    __m128 scale_channel_sse2(const __m128i texels, const int shift,
+            const __m128i count)
+    {
+        const __m128i c = _mm_and_si128(_mm_srli_epi32(texels, shift),
+                _mm_set1_epi32(0xff));
+        return _mm_cvtepi32_ps(_mm_sll_epi32(c, count));
+    }
+
+    __m128i convert_texels_sse2(const __m128i texels, const __m128i count)
+    {
+        const __m128 r = scale_channel_sse2(texels, 0, count);
+        const __m128 g = scale_channel_sse2(texels, 8, count);
+        const __m128 b = scale_channel_sse2(texels, 16, count);
+        const __m128 cmax = _mm_max_ps(_mm_max_ps(r, g), b);
+        const __m128 clip = _mm_cmpgt_ps(cmax, _mm_set1_ps(255.0f));
+        const __m128 scale = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(
+                        _mm_div_ps(_mm_set1_ps(65280.0f), cmax))),
+                _mm_set1_ps(1.0f / 256.0f));
+        const __m128 rgb[3] = {
+            _mm_or_ps(_mm_and_ps(clip, _mm_mul_ps(r, scale)),
+                    _mm_andnot_ps(clip, r)),
+            _mm_or_ps(_mm_and_ps(clip, _mm_mul_ps(g, scale)),
+                    _mm_andnot_ps(clip, g)),
+            _mm_or_ps(_mm_and_ps(clip, _mm_mul_ps(b, scale)),
+                    _mm_andnot_ps(clip, b))
+        };
+        return _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(rgb[0]),
+                    _mm_slli_epi32(_mm_cvttps_epi32(rgb[1]), 8)),
+                _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(rgb[2]), 16),
+                    _mm_set1_epi32(static_cast<int>(0xff000000u))));
+    }
+
+    // Four texels at a time, each read as 4 bytes, so the last few are left
+    // to the scalar loop. Returns the number of texels converted.
+    std::size_t convert_lightmap_sse2(const std::uint8_t* in,
+            std::uint8_t* out, const std::size_t n,
+            const unsigned overbright_bits)
+    {
+        const __m128i count =
+            _mm_cvtsi32_si128(static_cast<int>(overbright_bits));
+        std::size_t i = 0;
+        for (; i + 5 <= n; i += 4) {
+            std::int32_t t[4];
+            std::memcpy(&t[0], in + 3 * i, 4);
+            std::memcpy(&t[1], in + 3 * i + 3, 4);
+            std::memcpy(&t[2], in + 3 * i + 6, 4);
+            std::memcpy(&t[3], in + 3 * i + 9, 4);
+            const __m128i texels = _mm_setr_epi32(t[0], t[1], t[2], t[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i),
+                    convert_texels_sse2(texels, count));
+        }
+        return i;
+    }
+#endif
+
+#ifdef Q3BSP_LIGHTMAP_AVX2
+    __attribute__((target("avx2")))
+    __m256 scale_channel_avx2(const __m256i texels, const int shift,
+            const __m128i count)
+    {
+        const __m256i c = _mm256_and_si256(_mm256_srli_epi32(texels, shift),
+                _mm256_set1_epi32(0xff));
+        return _mm256_cvtepi32_ps(_mm256_sll_epi32(c, count));
+    }
+
+    // As the SSE2 kernel, eight texels at a time, spread into lanes by a
+    // byte shuffle of 12 bytes in each half. The second half is read 12
+    // bytes in, and 16 bytes long, so the last few texels are left to the
+    // scalar loop.
+    __attribute__((target("avx2")))
+    std::size_t convert_lightmap_avx2(const std::uint8_t* in,
+            std::uint8_t* out, const std::size_t n,
+            const unsigned overbright_bits)
+    {
+        const __m128i count =
+            _mm_cvtsi32_si128(static_cast<int>(overbright_bits));
+        const __m256i spread = _mm256_setr_epi8(
+                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m256 limit = _mm256_set1_ps(255.0f);
+        const __m256 numerator = _mm256_set1_ps(65280.0f);
+        const __m256 shift_right = _mm256_set1_ps(1.0f / 256.0f);
+        const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+        std::size_t i = 0;
+        for (; i + 10 <= n; i += 8) {
+            const __m128i lo = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(in + 3 * i));
+            const __m128i hi = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(in + 3 * i + 12));
+            const __m256i texels = _mm256_shuffle_epi8(
+                    _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1),
+                    spread);
+            const __m256 r = scale_channel_avx2(texels, 0, count);
+            const __m256 g = scale_channel_avx2(texels, 8, count);
+            const __m256 b = scale_channel_avx2(texels, 16, count);
+            const __m256 cmax = _mm256_max_ps(_mm256_max_ps(r, g), b);
+            const __m256 clip = _mm256_cmp_ps(cmax, limit, _CMP_GT_OQ);
+            const __m256 scale = _mm256_mul_ps(_mm256_cvtepi32_ps(
+                        _mm256_cvttps_epi32(_mm256_div_ps(numerator, cmax))),
+                    shift_right);
+            const __m256i rgb[3] = {
+                _mm256_cvttps_epi32(
+                        _mm256_blendv_ps(r, _mm256_mul_ps(r, scale), clip)),
+                _mm256_cvttps_epi32(
+                        _mm256_blendv_ps(g, _mm256_mul_ps(g, scale), clip)),
+                _mm256_cvttps_epi32(
+                        _mm256_blendv_ps(b, _mm256_mul_ps(b, scale), clip))
+            };
+            const __m256i rgba = _mm256_or_si256(
+                    _mm256_or_si256(rgb[0], _mm256_slli_epi32(rgb[1], 8)),
+                    _mm256_or_si256(_mm256_slli_epi32(rgb[2], 16), alpha));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), rgba);
+        }
+        return i;
+    }
+#endif
+
+    mip_chain_t decompress_levels(const CompressedTexture& texture)
+    {
+        mip_chain_t levels;
+        for (auto&& level : texture.levels) {
+            levels.push_back(decompress_level(texture.format, level));
+        }
+        return levels;
+    }
+}
+
+Image load_image(const char* filename, const PAK3Archive& pak)
 {
     auto maybe_data = pak.read_file(filename);
     if (!maybe_data) {
         throwf("%s: Couldn't open file from ZIP archive", filename);
     }
 
+    PROFILE_SPAN_DETAIL(span, "decode_image", filename);
+    PROFILE_SPAN_ARG(span, "bytes", maybe_data.value().size());
     boost::filesystem::path path(filename);
-    m_image = decode_by_extension(maybe_data.value(), path.extension().string());
+    return decode_by_extension(maybe_data.value(), path.extension().string());
+}
+
+ImageTexture::ImageTexture(const char* filename, const PAK3Archive& pak)
+    : m_image(load_image(filename, pak))
+{
 }
 
 unsigned ImageTexture::get_width() const
@@ -38,28 +247,8 @@ unsigned LightmapTexture::m_overbright_bits = 1;
 LightmapTexture::LightmapTexture(const DLightmap_t& lightmap)
     : m_width(128), m_height(128), m_pixels(m_width * m_height * 4)
 {
-    unsigned r, g, b, cmax;
-    const uint8_t* p = lightmap.map;
-    auto q = m_pixels.begin();
-
-    for (unsigned i = 0; i < m_height; ++i) {
-        for (unsigned j = 0; j < m_width; ++j, p += 3, q += 4) {
-            r = static_cast<unsigned>(p[0]) << m_overbright_bits;
-            g = static_cast<unsigned>(p[1]) << m_overbright_bits;
-            b = static_cast<unsigned>(p[2]) << m_overbright_bits;
-            cmax = std::max(std::max(r, g), b);
-            if (cmax > 255) {
-                cmax = (255 << 8) / cmax;
-                r = (r * cmax) >> 8;
-                g = (g * cmax) >> 8;
-                b = (b * cmax) >> 8;
-            }
-            q[0] = static_cast<std::uint8_t>(r);
-            q[1] = static_cast<std::uint8_t>(g);
-            q[2] = static_cast<std::uint8_t>(b);
-            q[3] = 255;
-        }
-    }
+    convert_lightmap_texels(lightmap.map, m_pixels.data(),
+            std::size_t(m_width) * m_height, m_overbright_bits);
 }
 
 unsigned LightmapTexture::get_width() const
@@ -82,11 +271,81 @@ void LightmapTexture::set_overbright_bits(const unsigned overbright_bits)
     m_overbright_bits = overbright_bits;
 }
 
-GLuint TextureManager::add(const Texture& tex)
+unsigned LightmapTexture::get_overbright_bits()
+{
+    return m_overbright_bits;
+}
+
+TextureManager::TextureManager(const std::size_t budget,
+        const std::size_t limit)
+    : m_budget(budget), m_limit(limit), m_upload_ring(nullptr), m_bytes(0),
+    m_full_bytes(0), m_unused_bytes(0), m_num_lowered(0), m_frame(1),
+    m_hits(0), m_misses(0), m_levels_dropped(0), m_restores(0),
+    m_over_limit(0), m_bytes_uploaded(0)
+{}
+
+TextureManager::~TextureManager() noexcept
+{
+    for (auto&& entry : m_entries) {
+        glDeleteTextures(1, &entry.first);
+    }
+}
+
+// Takes a reference to the texture under the key, if there is one.
+GLuint TextureManager::find(const std::string& key)
+{
+    const auto it = m_keys.find(key);
+    if (it == m_keys.end()) {
+        return 0;
+    }
+    Entry& entry = m_entries.at(it->second);
+    if (entry.refs++ == 0) {
+        m_unused.erase(entry.unused);
+        m_unused_bytes -= entry.bytes;
+    }
+    return it->second;
+}
+
+GLuint TextureManager::acquire(const std::string& key)
 {
+    const GLuint texture_id = find(key);
+    if (texture_id) {
+        ++m_hits;
+    }
+    else {
+        ++m_misses;
+    }
+    return texture_id;
+}
+
+GLuint TextureManager::add(const Texture& tex, const std::string& key)
+{
+    if (const GLuint texture_id = find(key)) {
+        return texture_id;
+    }
+    return add(build_mip_chain(tex.get_width(), tex.get_height(),
+                tex.get_pixels()), key);
+}
+
+// Room is made before the texture is created, and the texture is bound. A
+// texture that doesn't fit is created all the same, since its caller needs
+// it, and counted as over the limit.
+GLuint TextureManager::create_texture(const std::string& key,
+        const GLenum format, const unsigned width, const unsigned height,
+        const unsigned num_levels)
+{
+    if (!make_room(get_chain_bytes(format, width, height, num_levels))) {
+        ++m_over_limit;
+    }
+
     GLuint texture_id;
     glGenTextures(1, &texture_id);
-    m_texture_ids.push_back(texture_id);
+    Entry& entry = m_entries[texture_id];
+    entry = Entry{key, 0, 0, 1, format, 0, 0, 0, 0, 0, false,
+        m_unused.end(), m_bound.end()};
+    if (!key.empty()) {
+        m_keys[key] = texture_id;
+    }
 
     glBindTexture(GL_TEXTURE_2D, texture_id);
 
@@ -98,20 +357,482 @@ GLuint TextureManager::add(const Texture& tex)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-    gluBuild2DMipmaps(
-        GL_TEXTURE_2D,
-        GL_RGBA,
-        static_cast<GLsizei>(tex.get_width()),
-        static_cast<GLsizei>(tex.get_height()),
-        GL_RGBA,
-        GL_UNSIGNED_BYTE,
-        tex.get_pixels());
+    set_levels(texture_id, &entry, width, height, num_levels);
+    entry.full_bytes = entry.bytes;
+    m_full_bytes += entry.bytes;
+
+    return texture_id;
+}
+
+// To the bound texture.
+void TextureManager::upload_level(const GLenum format, const GLint level,
+        const unsigned width, const unsigned height, const void* data)
+{
+    const std::size_t bytes = get_level_bytes(format, width, height);
+    m_bytes_uploaded += bytes;
+    if (m_upload_ring && m_upload_ring->upload(format, level,
+                static_cast<GLsizei>(width), static_cast<GLsizei>(height),
+                data, bytes)) {
+        return;
+    }
+    if (format == GL_RGBA) {
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            level,
+            GL_RGBA,
+            static_cast<GLsizei>(width),
+            static_cast<GLsizei>(height),
+            0,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            data);
+    }
+    else {
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D,
+            level,
+            format,
+            static_cast<GLsizei>(width),
+            static_cast<GLsizei>(height),
+            0,
+            static_cast<GLsizei>(bytes),
+            data);
+    }
+}
+
+// Fences the levels uploaded through the ring since the last call.
+void TextureManager::finish_upload()
+{
+    if (m_upload_ring) {
+        m_upload_ring->fence();
+    }
+}
+
+// Accounts for the levels of the bound texture, which only the first
+// `num_levels` of are used from now on. Textures down to one level have
+// nothing left to drop and leave the list of those bound.
+void TextureManager::set_levels(const GLuint texture_id, Entry* entry,
+        const unsigned width, const unsigned height, const unsigned num_levels)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+            static_cast<GLint>(num_levels - 1));
+    const std::size_t bytes =
+        get_chain_bytes(entry->format, width, height, num_levels);
+    m_bytes += bytes - entry->bytes;
+    if (entry->refs == 0) {
+        m_unused_bytes += bytes - entry->bytes;
+    }
+    entry->bytes = bytes;
+    entry->width = width;
+    entry->height = height;
+    entry->num_levels = num_levels;
+
+    if (num_levels <= 1 && entry->bound != m_bound.end()) {
+        m_bound.erase(entry->bound);
+        entry->bound = m_bound.end();
+    }
+    else if (num_levels > 1 && entry->bound == m_bound.end()) {
+        m_bound.push_front(texture_id);
+        entry->bound = m_bound.begin();
+    }
+}
+
+// A texture loaded twice before it was added, e.g. by two slots of a map,
+// is only uploaded once.
+GLuint TextureManager::add(const mip_chain_t& levels, const std::string& key)
+{
+    if (levels.empty()) {
+        return 0;
+    }
+    if (const GLuint texture_id = find(key)) {
+        return texture_id;
+    }
+    const GLuint texture_id = create_texture(key, GL_RGBA,
+            levels[0].get_width(), levels[0].get_height(),
+            static_cast<unsigned>(levels.size()));
+
+    PROFILE_SPAN(span, "upload_texture");
+    PROFILE_SPAN_ARG(span, "bytes", m_entries.at(texture_id).bytes);
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        const Image& level = levels[i];
+        upload_level(GL_RGBA, static_cast<GLint>(i), level.get_width(),
+                level.get_height(), level.get_pixels().data());
+    }
+    finish_upload();
+
+    return texture_id;
+}
+
+GLuint TextureManager::add(const CompressedTexture& texture,
+        const std::string& key)
+{
+    if (texture.levels.empty()) {
+        return 0;
+    }
+    if (const GLuint texture_id = find(key)) {
+        return texture_id;
+    }
+    if (!supports_compression()) {
+        return add(decompress_levels(texture), key);
+    }
+
+    const GLenum format = get_compressed_format(texture.format);
+    const GLuint texture_id = create_texture(key, format,
+            texture.levels[0].width, texture.levels[0].height,
+            static_cast<unsigned>(texture.levels.size()));
+
+    PROFILE_SPAN(span, "upload_compressed_texture");
+    PROFILE_SPAN_ARG(span, "bytes", texture.get_bytes());
+    for (std::size_t i = 0; i < texture.levels.size(); ++i) {
+        const CompressedLevel& level = texture.levels[i];
+        upload_level(format, static_cast<GLint>(i), level.width,
+                level.height, level.blocks.data());
+    }
+    finish_upload();
 
     return texture_id;
 }
 
-void TextureManager::free(const GLuint texture_id)
+void TextureManager::release(const GLuint texture_id)
+{
+    const auto it = m_entries.find(texture_id);
+    if (it == m_entries.end()) {
+        return;
+    }
+    Entry& entry = it->second;
+    if (--entry.refs > 0) {
+        return;
+    }
+    if (entry.key.empty()) {
+        destroy(texture_id);
+        return;
+    }
+    m_unused.push_front(texture_id);
+    entry.unused = m_unused.begin();
+    m_unused_bytes += entry.bytes;
+    while (m_unused_bytes > m_budget) {
+        destroy(m_unused.back());
+    }
+}
+
+void TextureManager::bind(const GLuint texture_id)
+{
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    if (m_limit == 0) {
+        return;
+    }
+    const auto it = m_entries.find(texture_id);
+    if (it == m_entries.end() || it->second.bound_frame == m_frame) {
+        return;
+    }
+    Entry& entry = it->second;
+    entry.bound_frame = m_frame;
+    if (entry.bound != m_bound.end()) {
+        m_bound.splice(m_bound.begin(), m_bound, entry.bound);
+    }
+    if (entry.num_dropped > 0 && !entry.wanted) {
+        entry.wanted = true;
+        m_wanted.push_back(texture_id);
+    }
+}
+
+void TextureManager::end_frame()
+{
+    make_room(0);
+    ++m_frame;
+}
+
+void TextureManager::take_wanted(std::vector<GLuint>* texture_ids)
+{
+    texture_ids->clear();
+    for (auto texture_id : m_wanted) {
+        Entry* entry = find_lowered(texture_id);
+        if (entry && entry->wanted) {
+            entry->wanted = false;
+            texture_ids->push_back(texture_id);
+        }
+    }
+    m_wanted.clear();
+}
+
+// Nothing is lowered unless that makes enough room.
+bool TextureManager::reserve(const GLuint texture_id)
+{
+    const Entry* entry = find_lowered(texture_id);
+    if (!entry) {
+        return false;
+    }
+    const std::size_t bytes = entry->full_bytes - entry->bytes;
+    if (m_limit > 0 && m_bytes + bytes > m_limit + get_reclaimable_bytes()) {
+        return false;
+    }
+    return make_room(bytes);
+}
+
+// What make_room() could free: the textures without references, and all
+// but the last level of those not bound in the current frame.
+std::size_t TextureManager::get_reclaimable_bytes() const
+{
+    std::size_t bytes = m_unused_bytes;
+    for (auto it = m_bound.rbegin(); it != m_bound.rend(); ++it) {
+        const Entry& entry = m_entries.at(*it);
+        if (entry.bound_frame == m_frame) {
+            break;
+        }
+        if (entry.refs > 0) {
+            const unsigned shift = entry.num_levels - 1;
+            bytes += entry.bytes - get_level_bytes(entry.format,
+                    std::max(entry.width >> shift, 1u),
+                    std::max(entry.height >> shift, 1u));
+        }
+    }
+    return bytes;
+}
+
+bool TextureManager::restore(const GLuint texture_id,
+        const mip_chain_t& levels)
+{
+    Entry* entry = find_lowered(texture_id);
+    if (!entry || levels.empty()) {
+        return false;
+    }
+    const unsigned width = levels[0].get_width();
+    const unsigned height = levels[0].get_height();
+    const auto num_levels = static_cast<unsigned>(levels.size());
+    const std::size_t bytes =
+        get_chain_bytes(GL_RGBA, width, height, num_levels);
+    if (!make_room(bytes > entry->bytes ? bytes - entry->bytes : 0)) {
+        return false;
+    }
+
+    PROFILE_SPAN(span, "restore_texture");
+    PROFILE_SPAN_ARG(span, "bytes", bytes);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        const Image& level = levels[i];
+        upload_level(GL_RGBA, static_cast<GLint>(i), level.get_width(),
+                level.get_height(), level.get_pixels().data());
+    }
+    finish_upload();
+    entry->format = GL_RGBA;
+    set_levels(texture_id, entry, width, height, num_levels);
+    set_restored(entry);
+    return true;
+}
+
+bool TextureManager::restore(const GLuint texture_id,
+        const CompressedTexture& texture)
+{
+    if (!supports_compression()) {
+        return restore(texture_id, decompress_levels(texture));
+    }
+    Entry* entry = find_lowered(texture_id);
+    if (!entry || texture.levels.empty()) {
+        return false;
+    }
+    const GLenum format = get_compressed_format(texture.format);
+    const unsigned width = texture.levels[0].width;
+    const unsigned height = texture.levels[0].height;
+    const auto num_levels = static_cast<unsigned>(texture.levels.size());
+    const std::size_t bytes =
+        get_chain_bytes(format, width, height, num_levels);
+    if (!make_room(bytes > entry->bytes ? bytes - entry->bytes : 0)) {
+        return false;
+    }
+
+    PROFILE_SPAN(span, "restore_compressed_texture");
+    PROFILE_SPAN_ARG(span, "bytes", bytes);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    for (std::size_t i = 0; i < texture.levels.size(); ++i) {
+        const CompressedLevel& level = texture.levels[i];
+        upload_level(format, static_cast<GLint>(i), level.width,
+                level.height, level.blocks.data());
+    }
+    finish_upload();
+    entry->format = format;
+    set_levels(texture_id, entry, width, height, num_levels);
+    set_restored(entry);
+    return true;
+}
+
+void TextureManager::set_restored(Entry* entry)
+{
+    m_full_bytes += entry->bytes - entry->full_bytes;
+    entry->full_bytes = entry->bytes;
+    entry->num_dropped = 0;
+    --m_num_lowered;
+    ++m_restores;
+}
+
+// Frees the textures without references, least recently released first,
+// then drops levels of those least recently bound, until `bytes` more fit
+// under the limit. Returns false if they don't.
+bool TextureManager::make_room(const std::size_t bytes)
+{
+    if (m_limit == 0) {
+        return true;
+    }
+    while (m_bytes + bytes > m_limit) {
+        if (!m_unused.empty()) {
+            destroy(m_unused.back());
+            continue;
+        }
+        if (m_bound.empty()) {
+            return false;
+        }
+        const GLuint texture_id = m_bound.back();
+        Entry& entry = m_entries.at(texture_id);
+        if (entry.bound_frame == m_frame) {
+            return false;
+        }
+        drop_level(texture_id, &entry);
+    }
+    return true;
+}
+
+// The levels below the top one are read back and specified again one level
+// up. Reading back waits for the GPU, but is only done to textures that
+// haven't been drawn lately, and only while over the limit.
+void TextureManager::drop_level(const GLuint texture_id, Entry* entry)
+{
+    PROFILE_SPAN(span, "drop_texture_level");
+    PROFILE_SPAN_ARG(span, "bytes", entry->bytes);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    const unsigned width = std::max(entry->width / 2, 1u);
+    const unsigned height = std::max(entry->height / 2, 1u);
+    const unsigned num_levels = entry->num_levels - 1;
+    std::vector<std::uint8_t> pixels(
+            get_chain_bytes(entry->format, width, height, num_levels));
+
+    std::uint8_t* p = pixels.data();
+    unsigned w = width;
+    unsigned h = height;
+    for (unsigned i = 0; i < num_levels; ++i) {
+        if (entry->format == GL_RGBA) {
+            glGetTexImage(GL_TEXTURE_2D, static_cast<GLint>(i + 1), GL_RGBA,
+                    GL_UNSIGNED_BYTE, p);
+        }
+        else {
+            glGetCompressedTexImage(GL_TEXTURE_2D, static_cast<GLint>(i + 1),
+                    p);
+        }
+        p += get_level_bytes(entry->format, w, h);
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+
+    p = pixels.data();
+    w = width;
+    h = height;
+    for (unsigned i = 0; i < num_levels; ++i) {
+        upload_level(entry->format, static_cast<GLint>(i), w, h, p);
+        p += get_level_bytes(entry->format, w, h);
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+    finish_upload();
+
+    set_levels(texture_id, entry, width, height, num_levels);
+    if (entry->num_dropped++ == 0) {
+        ++m_num_lowered;
+    }
+    ++m_levels_dropped;
+}
+
+TextureManager::Entry* TextureManager::find_lowered(const GLuint texture_id)
 {
-    m_texture_ids.remove(texture_id);
+    const auto it = m_entries.find(texture_id);
+    if (it == m_entries.end() || it->second.num_dropped == 0) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void TextureManager::destroy(const GLuint texture_id)
+{
+    const auto it = m_entries.find(texture_id);
+    const Entry& entry = it->second;
+    if (!entry.key.empty()) {
+        if (entry.refs == 0) {
+            m_unused.erase(entry.unused);
+            m_unused_bytes -= entry.bytes;
+        }
+        m_keys.erase(entry.key);
+    }
+    if (entry.bound != m_bound.end()) {
+        m_bound.erase(entry.bound);
+    }
+    if (entry.num_dropped > 0) {
+        --m_num_lowered;
+    }
+    m_bytes -= entry.bytes;
+    m_full_bytes -= entry.full_bytes;
+    m_entries.erase(it);
     glDeleteTextures(1, &texture_id);
 }
+
+LightmapKernel get_lightmap_kernel()
+{
+#ifdef Q3BSP_LIGHTMAP_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        return LIGHTMAP_KERNEL_AVX2;
+    }
+#endif
+#ifdef __SSE2__
+    return LIGHTMAP_KERNEL_SSE2;
+#else
+    return LIGHTMAP_KERNEL_SCALAR;
+#endif
+}
+
+void convert_lightmap_texels(const std::uint8_t* in, std::uint8_t* out,
+        const std::size_t n, const unsigned overbright_bits,
+        const LightmapKernel kernel)
+{
+    std::size_t i = 0;
+    if (overbright_bits <= max_vector_overbright_bits) {
+        switch (kernel) {
+#ifdef Q3BSP_LIGHTMAP_AVX2
+            case LIGHTMAP_KERNEL_AVX2:
+                i = convert_lightmap_avx2(in, out, n, overbright_bits);
+                break;
+#endif
+#ifdef __SSE2__
+            case LIGHTMAP_KERNEL_SSE2:
+                i = convert_lightmap_sse2(in, out, n, overbright_bits);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    for (; i < n; ++i) {
+        convert_lightmap_texel(in + 3 * i, out + 4 * i, overbright_bits);
+    }
+}
+
+bool TextureManager::supports_compression()
+{
+    static const bool supported =
+        has_gl_extension("GL_EXT_texture_compression_s3tc");
+    return supported;
+}
+
+bool has_gl_extension(const char* name)
+{
+    const auto extensions = reinterpret_cast<const char*>(
+            glGetString(GL_EXTENSIONS));
+    if (extensions == nullptr) {
+        return false;
+    }
+    const std::size_t length = std::strlen(name);
+    for (const char* p = extensions; (p = std::strstr(p, name)) != nullptr;
+            p += length) {
+        if ((p == extensions || p[-1] == ' ') &&
+                (p[length] == ' ' || p[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
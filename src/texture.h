@@ -2,14 +2,23 @@
 #define TEX__H
 
 #include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <cstdint>
 
 #include <GL/gl.h>
 
 #include "src/ibsp46.h"
 #include "src/image.h"
+#include "src/mipmap.h"
+#include "src/s3tc.h"
 
 class PAK3Archive;
+class UploadRing;
+
+// Whether the current context lists the extension.
+extern bool has_gl_extension(const char*);
 
 class Texture
 {
@@ -23,6 +32,9 @@ class Texture
         virtual const std::uint8_t* get_pixels() const = 0;
 };
 
+// Decodes an image of the archive, by the extension of its name.
+extern Image load_image(const char*, const PAK3Archive&);
+
 class ImageTexture : public Texture
 {
     public:
@@ -40,6 +52,26 @@ class ImageTexture : public Texture
         Image m_image;
 };
 
+// Ways to convert lightmap texels, each faster than the last where the CPU
+// runs it. All give the same output.
+enum LightmapKernel
+{
+    LIGHTMAP_KERNEL_SCALAR,
+    LIGHTMAP_KERNEL_SSE2,
+    LIGHTMAP_KERNEL_AVX2
+};
+
+// The fastest kernel the build and the CPU support.
+extern LightmapKernel get_lightmap_kernel();
+
+// Converts `n` RGB texels to opaque RGBA, shifted left by `overbright_bits`
+// and, where that overflows, scaled down by their brightest channel, as
+// Quake 3 does. The kernel must be supported; overbright bits past 8 are
+// converted by the scalar one.
+extern void convert_lightmap_texels(const std::uint8_t*, std::uint8_t*,
+        const std::size_t, const unsigned,
+        const LightmapKernel = get_lightmap_kernel());
+
 class LightmapTexture : public Texture
 {
     public:
@@ -54,6 +86,7 @@ class LightmapTexture : public Texture
         const std::uint8_t* get_pixels() const;
 
         static void set_overbright_bits(const unsigned);
+        static unsigned get_overbright_bits();
 
     private:
         static unsigned             m_overbright_bits;
@@ -63,27 +96,204 @@ class LightmapTexture : public Texture
         std::vector<std::uint8_t>   m_pixels;
 };
 
+// Textures shared by the maps loaded one after another, keyed by what
+// identifies their contents, e.g. the pk3 entry and CRC of the image and
+// the options it was loaded with. Each add() or acquire() takes a
+// reference, which release() drops. Textures left without references stay
+// resident, so that the next map may acquire them again, until they take
+// more than the budget: then the least recently released go first.
+// Textures added without a key aren't shared and go with their reference.
+//
+// With a limit, all textures are kept under it: those without references
+// go first, then the least recently bound lose their top mip level, one
+// level at a time, down to their last. Textures bound in the current frame
+// are left alone. A lowered texture that is bound again is wanted back at
+// full size, which its owner restores from the source.
+//
+// Levels are uploaded from client memory, or through an UploadRing.
 class TextureManager
 {
     public:
-        TextureManager()
-        {}
+        // `budget` for textures without references, `limit` for all, or no
+        // limit for 0.
+        explicit TextureManager(const std::size_t budget = 0,
+                const std::size_t limit = 0);
+        ~TextureManager() noexcept;
+
+        TextureManager(const TextureManager&) = delete;
+        TextureManager& operator=(const TextureManager&) = delete;
+
+        // Returns the texture under the key, or 0 if there is none.
+        GLuint acquire(const std::string&);
+
+        // Builds the mipmaps of the texture and uploads it.
+        GLuint add(const Texture&, const std::string& = std::string());
+
+        // Uploads mipmaps built beforehand, e.g. on another thread. Returns
+        // 0 for an empty chain.
+        GLuint add(const mip_chain_t&, const std::string& = std::string());
+
+        // Uploads compressed mipmaps, or decompresses them first if the
+        // implementation lacks S3TC. Returns 0 if there are no levels.
+        GLuint add(const CompressedTexture&,
+                const std::string& = std::string());
+
+        void release(const GLuint);
 
-        ~TextureManager() noexcept
+        // Uploads through the ring from now on, or from client memory for
+        // nullptr. The ring must outlive its use by the manager.
+        void set_upload_ring(UploadRing* ring)
         {
-            for (auto&& id : m_texture_ids) {
-                glDeleteTextures(1, &id);
-            }
+            m_upload_ring = ring;
         }
 
-        TextureManager(const TextureManager&) = delete;
-        TextureManager& operator=(const TextureManager&) = delete;
+        // Binds the texture to GL_TEXTURE_2D of the active unit, noting it
+        // as used this frame.
+        void bind(const GLuint);
+
+        // Lowers textures until all fit under the limit, and starts a new
+        // frame. Called once a frame, after the textures wanted were
+        // restored.
+        void end_frame();
+
+        // Takes the lowered textures bound since the last call, in the order
+        // they were first bound.
+        void take_wanted(std::vector<GLuint>*);
 
-        GLuint add(const Texture&);
-        void free(const GLuint);
+        // Makes room for the texture at full size, lowering others. Returns
+        // false if it is not lowered or there isn't enough room.
+        bool reserve(const GLuint);
+
+        // Replaces the levels of a lowered texture with the full chain.
+        // Returns false if it is not lowered or doesn't fit.
+        bool restore(const GLuint, const mip_chain_t&);
+        bool restore(const GLuint, const CompressedTexture&);
+
+        // Lookups by acquire() that found the texture, and that didn't.
+        std::uint64_t get_hits() const
+        {
+            return m_hits;
+        }
+
+        std::uint64_t get_misses() const
+        {
+            return m_misses;
+        }
+
+        std::size_t get_num_textures() const
+        {
+            return m_entries.size();
+        }
+
+        // Estimated from the levels uploaded, of all textures and of those
+        // without references.
+        std::size_t get_bytes() const
+        {
+            return m_bytes;
+        }
+
+        std::size_t get_unused_bytes() const
+        {
+            return m_unused_bytes;
+        }
+
+        // Residency under the limit: the limit, what all textures would
+        // take at full size, the textures lowered now, and the number of
+        // levels dropped, of textures restored and of textures created
+        // without room under the limit so far.
+        std::size_t get_limit() const
+        {
+            return m_limit;
+        }
+
+        std::size_t get_full_bytes() const
+        {
+            return m_full_bytes;
+        }
+
+        std::size_t get_num_lowered() const
+        {
+            return m_num_lowered;
+        }
+
+        std::uint64_t get_levels_dropped() const
+        {
+            return m_levels_dropped;
+        }
+
+        std::uint64_t get_restores() const
+        {
+            return m_restores;
+        }
+
+        std::uint64_t get_over_limit() const
+        {
+            return m_over_limit;
+        }
+
+        // Bytes of levels specified so far, those of restored and lowered
+        // textures included.
+        std::uint64_t get_bytes_uploaded() const
+        {
+            return m_bytes_uploaded;
+        }
+
+        // Whether GL_EXT_texture_compression_s3tc is supported by the
+        // current context.
+        static bool supports_compression();
 
     private:
-        std::list<GLuint> m_texture_ids;
+        struct Entry
+        {
+            std::string                 key;
+            std::size_t                 bytes;
+            std::size_t                 full_bytes;
+            unsigned                    refs;
+            GLenum                      format;     // GL_RGBA or S3TC.
+            unsigned                    width;      // Of level 0.
+            unsigned                    height;
+            unsigned                    num_levels;
+            unsigned                    num_dropped;
+            std::uint64_t               bound_frame;    // 0 if never.
+            bool                        wanted;
+            std::list<GLuint>::iterator unused;     // If refs is 0.
+            std::list<GLuint>::iterator bound;      // Unless at one level.
+        };
+
+        std::size_t                         m_budget;
+        std::size_t                         m_limit;
+        UploadRing*                         m_upload_ring;
+        std::unordered_map<GLuint, Entry>   m_entries;
+        std::unordered_map<std::string, GLuint> m_keys;
+        std::list<GLuint>                   m_unused;   // Newest first.
+        std::list<GLuint>                   m_bound;    // Newest first.
+        std::vector<GLuint>                 m_wanted;
+        std::size_t                         m_bytes;
+        std::size_t                         m_full_bytes;
+        std::size_t                         m_unused_bytes;
+        std::size_t                         m_num_lowered;
+        std::uint64_t                       m_frame;
+        std::uint64_t                       m_hits;
+        std::uint64_t                       m_misses;
+        std::uint64_t                       m_levels_dropped;
+        std::uint64_t                       m_restores;
+        std::uint64_t                       m_over_limit;
+        std::uint64_t                       m_bytes_uploaded;
+
+        GLuint find(const std::string&);
+        GLuint create_texture(const std::string&, const GLenum,
+                const unsigned, const unsigned, const unsigned);
+        void upload_level(const GLenum, const GLint, const unsigned,
+                const unsigned, const void*);
+        void finish_upload();
+        void set_levels(const GLuint, Entry*, const unsigned, const unsigned,
+                const unsigned);
+        bool make_room(const std::size_t);
+        std::size_t get_reclaimable_bytes() const;
+        void drop_level(const GLuint, Entry*);
+        Entry* find_lowered(const GLuint);
+        void set_restored(Entry*);
+        void destroy(const GLuint);
 };
 
 #endif
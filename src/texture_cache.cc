@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+
+#include <boost/filesystem.hpp>
+
+#include "src/texture_cache.h"
+#include "src/profile.h"
+
+namespace
+{
+    const char cache_magic[4] = { 'Q', '3', 'B', 'C' };
+
+    // Changes whenever the encoder's output or the layout do.
+    const std::uint32_t cache_version = 1;
+
+    // Keeps corrupt files from asking for absurd allocations; levels are
+    // further bounded by the bytes left in the file.
+    const std::uint32_t max_levels = 32;
+    const std::uint32_t max_level_size = 1u << 16;
+
+    std::uint64_t fnv1a(const std::string& s)
+    {
+        std::uint64_t h = 14695981039346656037ull;
+        for (const char c : s) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    boost::filesystem::path get_cache_path(const std::string& dir,
+            const std::string& key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.q3bc",
+                static_cast<unsigned long long>(fnv1a(key)));
+        return boost::filesystem::path(dir) / name;
+    }
+
+    void write_u32(std::ostream& os, const std::uint32_t v)
+    {
+        os.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    bool read_u32(std::istream& is, std::uint32_t* v)
+    {
+        return static_cast<bool>(
+                is.read(reinterpret_cast<char*>(v), sizeof(*v)));
+    }
+
+    std::size_t get_level_bytes(const CompressedFormat format,
+            const unsigned width, const unsigned height)
+    {
+        return ((width + 3) / 4) * std::size_t((height + 3) / 4) *
+            (format == COMPRESSED_BC1 ? 8 : 16);
+    }
+}
+
+std::string make_texture_cache_key(const PAK3Archive::FileInfo& info,
+        const std::string& detail)
+{
+    char crc[32];
+    std::snprintf(crc, sizeof(crc), "%08x:%llu", info.crc,
+            static_cast<unsigned long long>(info.size));
+    const boost::filesystem::path archive(info.archive_filename);
+    return archive.filename().string() + ":" + detail + ":" + crc;
+}
+
+bool read_cached_texture(const std::string& dir, const std::string& key,
+        CompressedTexture* texture)
+{
+    PROFILE_SCOPE("read_cached_texture");
+    std::ifstream is(get_cache_path(dir, key).string(), std::ios::binary);
+    if (!is) {
+        return false;
+    }
+    char magic[sizeof(cache_magic)];
+    std::uint32_t version, key_length;
+    if (!is.read(magic, sizeof(magic)) ||
+            !std::equal(magic, magic + sizeof(magic), cache_magic) ||
+            !read_u32(is, &version) || version != cache_version ||
+            !read_u32(is, &key_length) || key_length != key.size()) {
+        return false;
+    }
+    std::string file_key(key_length, '\0');
+    if (!is.read(&file_key[0], key_length) || file_key != key) {
+        return false;
+    }
+
+    // Each level must be half the size of the one before, rounded down, as
+    // the texture manager assumes when it drops levels.
+    std::uint32_t format, num_levels;
+    if (!read_u32(is, &format) || format > COMPRESSED_BC3 ||
+            !read_u32(is, &num_levels) || num_levels == 0 ||
+            num_levels > max_levels) {
+        return false;
+    }
+    const std::streampos start = is.tellg();
+    if (!is.seekg(0, std::ios::end)) {
+        return false;
+    }
+    const std::streamoff file_end = is.tellg();
+    is.seekg(start);
+    CompressedTexture t;
+    t.format = static_cast<CompressedFormat>(format);
+    for (std::uint32_t i = 0; i < num_levels; ++i) {
+        CompressedLevel level;
+        std::uint32_t width, height;
+        if (!read_u32(is, &width) || !read_u32(is, &height) ||
+                width == 0 || height == 0 || width > max_level_size ||
+                height > max_level_size) {
+            return false;
+        }
+        if (i > 0 && (width != std::max(t.levels.back().width / 2, 1u) ||
+                    height != std::max(t.levels.back().height / 2, 1u))) {
+            return false;
+        }
+        const std::size_t bytes = get_level_bytes(t.format, width, height);
+        const std::streamoff pos = is.tellg();
+        if (pos < 0 || static_cast<std::size_t>(file_end - pos) < bytes) {
+            return false;
+        }
+        level.width = width;
+        level.height = height;
+        level.blocks.resize(bytes);
+        if (!is.read(reinterpret_cast<char*>(level.blocks.data()),
+                    static_cast<std::streamsize>(level.blocks.size()))) {
+            return false;
+        }
+        t.levels.push_back(std::move(level));
+    }
+    *texture = std::move(t);
+    return true;
+}
+
+// Written to a file of its own and renamed into place, so that readers
+// never see half a file.
+void write_cached_texture(const std::string& dir, const std::string& key,
+        const CompressedTexture& texture)
+{
+    PROFILE_SCOPE("write_cached_texture");
+    namespace fs = boost::filesystem;
+    boost::system::error_code error;
+    fs::create_directories(dir, error);
+    const fs::path path = get_cache_path(dir, key);
+    const fs::path temp_path = path.parent_path() /
+        fs::unique_path("%%%%-%%%%-%%%%.tmp", error);
+    {
+        std::ofstream os(temp_path.string(), std::ios::binary);
+        os.write(cache_magic, sizeof(cache_magic));
+        write_u32(os, cache_version);
+        write_u32(os, static_cast<std::uint32_t>(key.size()));
+        os.write(key.data(), static_cast<std::streamsize>(key.size()));
+        write_u32(os, texture.format);
+        write_u32(os, static_cast<std::uint32_t>(texture.levels.size()));
+        for (auto&& level : texture.levels) {
+            write_u32(os, level.width);
+            write_u32(os, level.height);
+            os.write(reinterpret_cast<const char*>(level.blocks.data()),
+                    static_cast<std::streamsize>(level.blocks.size()));
+        }
+        if (!os.flush()) {
+            error = boost::system::errc::make_error_code(
+                    boost::system::errc::io_error);
+        }
+    }
+    if (!error) {
+        fs::rename(temp_path, path, error);
+    }
+    if (error) {
+        fs::remove(temp_path, error);
+        std::cerr << "TextureCache: Couldn't write " + path.string() + "\n";
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef Q3BSP__TEXTURE_CACHE_H
+#define Q3BSP__TEXTURE_CACHE_H
+
+#include <string>
+
+#include "src/archive.h"
+#include "src/s3tc.h"
+
+// Compressed mip chains kept on disk between runs, one file per texture
+// named after a hash of its key. The key is stored in the file as well, so
+// that a colliding hash reads as a miss. Files are in the host's byte order
+// and may be written from several threads at once.
+
+// Identifies the contents of the pk3 entry `info` describes, along with
+// `detail`, e.g. the part of the entry and the options it was built with.
+extern std::string make_texture_cache_key(const PAK3Archive::FileInfo&,
+        const std::string&);
+
+// Returns false if the directory holds no texture under the key, or a file
+// that can't be read.
+extern bool read_cached_texture(const std::string&, const std::string&,
+        CompressedTexture*);
+
+// Failures are reported and otherwise ignored.
+extern void write_cached_texture(const std::string&, const std::string&,
+        const CompressedTexture&);
+
+#endif
@@ -0,0 +1,204 @@
+#include <thread>
+#include <exception>
+
+#include "src/texture_loader.h"
+#include "src/texture.h"
+#include "src/texture_cache.h"
+#include "src/archive.h"
+#include "src/bounded_queue.h"
+#include "src/thread_pool.h"
+#include "src/exception.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Decoded textures that may wait for upload, per decoding thread.
+    const std::size_t queued_per_thread = 2;
+
+    const char* const file_extensions[2] = { ".jpg", ".tga" };
+
+    TextureCompression g_compression;
+
+    struct DecodedTexture
+    {
+        std::size_t         index;
+        LoadedTexture       texture;
+        std::exception_ptr  error;
+    };
+
+    mip_chain_t build_texture_mip_chain(const char* filename,
+            const PAK3Archive& pak)
+    {
+        return build_mip_chain(load_image(filename, pak));
+    }
+}
+
+std::size_t LoadedTexture::get_bytes() const
+{
+    return is_compressed() ? compressed.get_bytes() : get_uncompressed_bytes();
+}
+
+std::size_t LoadedTexture::get_uncompressed_bytes() const
+{
+    if (is_compressed()) {
+        return compressed.get_uncompressed_bytes();
+    }
+    std::size_t bytes = 0;
+    for (auto&& level : levels) {
+        bytes += level.get_pixels().size() * sizeof(pixel_t);
+    }
+    return bytes;
+}
+
+void set_texture_compression(const TextureCompression& compression)
+{
+    g_compression = compression;
+}
+
+const TextureCompression& get_texture_compression()
+{
+    return g_compression;
+}
+
+bool decode_texture(const std::string& name, const PAK3Archive& pak,
+        mip_chain_t* levels)
+{
+    for (auto extension : file_extensions) {
+        const std::string filename = name + extension;
+        try {
+            *levels = build_texture_mip_chain(filename.c_str(), pak);
+            return true;
+        }
+        catch (const QException&) {
+        }
+    }
+    return false;
+}
+
+bool load_texture(const std::string& name, const PAK3Archive& pak,
+        LoadedTexture* texture)
+{
+    if (!g_compression.enabled) {
+        return decode_texture(name, pak, &texture->levels);
+    }
+    for (auto extension : file_extensions) {
+        const std::string filename = name + extension;
+        PAK3Archive::FileInfo info;
+        if (!pak.stat_file(filename.c_str(), &info)) {
+            continue;
+        }
+        try {
+            texture->cache_hit = load_compressed(
+                    make_texture_cache_key(info, filename),
+                    [&]() {
+                        return build_texture_mip_chain(filename.c_str(), pak);
+                    },
+                    &texture->compressed);
+            return true;
+        }
+        catch (const QException&) {
+        }
+    }
+    return false;
+}
+
+std::string resolve_texture_key(const std::string& name,
+        const PAK3Archive& pak)
+{
+    for (auto extension : file_extensions) {
+        const std::string filename = name + extension;
+        PAK3Archive::FileInfo info;
+        if (pak.stat_file(filename.c_str(), &info)) {
+            return make_texture_cache_key(info, filename) +
+                get_texture_options_key();
+        }
+    }
+    return std::string();
+}
+
+std::string get_texture_options_key()
+{
+    const MipOptions& options = get_mip_options();
+    return std::string(options.filter == MIP_FILTER_KAISER ?
+            ":kaiser" : ":box") + (options.gamma_correct ? ":srgb" : "") +
+        (g_compression.enabled ? ":bc" : "");
+}
+
+bool load_compressed(const std::string& key,
+        const std::function<mip_chain_t()>& build,
+        CompressedTexture* compressed)
+{
+    const std::string& dir = g_compression.cache_dir;
+    std::string options_key;
+    if (!key.empty() && !dir.empty()) {
+        options_key = key + get_texture_options_key();
+        if (read_cached_texture(dir, options_key, compressed)) {
+            return true;
+        }
+    }
+    *compressed = compress_mip_chain(build());
+    if (!options_key.empty()) {
+        write_cached_texture(dir, options_key, *compressed);
+    }
+    return false;
+}
+
+void decode_textures(const std::vector<std::string>& names,
+        const PAK3Archive& pak, ThreadPool* pool,
+        const texture_upload_func_t& upload)
+{
+    PROFILE_SCOPE("decode_textures");
+    const unsigned num_threads = pool ? pool->get_num_threads() : 1;
+    BoundedQueue<DecodedTexture> queue(num_threads * queued_per_thread);
+
+    const auto decode = [&](const std::size_t i) {
+        DecodedTexture texture{i, LoadedTexture(), nullptr};
+        if (names[i].empty()) {
+            return;
+        }
+        try {
+            if (!load_texture(names[i], pak, &texture.texture)) {
+                return;
+            }
+        }
+        catch (...) {
+            texture.error = std::current_exception();
+        }
+        queue.push(std::move(texture));
+    };
+    std::thread decoder([&]() {
+        profile_set_thread_name("decoder");
+        if (pool) {
+            pool->parallel_for(0, names.size(), decode);
+        }
+        else {
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                decode(i);
+            }
+        }
+        queue.close();
+    });
+
+    // After an error the queue is still drained, so that no decoder is left
+    // blocked on it.
+    std::exception_ptr error;
+    DecodedTexture texture;
+    while (queue.pop(&texture)) {
+        if (!error) {
+            error = texture.error;
+        }
+        if (error) {
+            continue;
+        }
+        try {
+            upload(texture.index, texture.texture);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+    }
+    decoder.join();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
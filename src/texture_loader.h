@@ -0,0 +1,82 @@
+#ifndef Q3BSP__TEXTURE_LOADER_H
+#define Q3BSP__TEXTURE_LOADER_H
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "src/mipmap.h"
+#include "src/s3tc.h"
+
+class PAK3Archive;
+class ThreadPool;
+
+struct TextureCompression
+{
+    bool        enabled = false;
+    std::string cache_dir;  // No cache when empty.
+};
+
+// Whether textures are loaded compressed and where compressed textures are
+// cached; to be set before any texture is loaded.
+extern void set_texture_compression(const TextureCompression&);
+extern const TextureCompression& get_texture_compression();
+
+// A texture ready for upload: its mip chain, or the chain compressed when
+// compression is enabled.
+struct LoadedTexture
+{
+    mip_chain_t         levels;
+    CompressedTexture   compressed;
+    bool                cache_hit = false;
+
+    bool is_compressed() const
+    {
+        return !compressed.levels.empty();
+    }
+
+    // Of all levels, as uploaded and as RGBA8.
+    std::size_t get_bytes() const;
+    std::size_t get_uncompressed_bytes() const;
+};
+
+using texture_upload_func_t =
+    std::function<void(std::size_t, const LoadedTexture&)>;
+
+// Reads the texture `name` from the archive, as a JPEG or else as a TGA,
+// decodes it and builds its mipmaps. Returns false if there is no such
+// file that can be decoded.
+extern bool decode_texture(const std::string&, const PAK3Archive&,
+        mip_chain_t*);
+
+// As decode_texture(), but compresses the mip chain when compression is
+// enabled, or reads it from the cache when the pk3 entry's CRC matches.
+extern bool load_texture(const std::string&, const PAK3Archive&,
+        LoadedTexture*);
+
+// Identifies the texture load_texture() would load under `name`, with the
+// current options, as a key for the TextureManager. Empty if there is no
+// such file.
+extern std::string resolve_texture_key(const std::string&,
+        const PAK3Archive&);
+
+// Suffix for the keys of textures built with the current mip options and
+// compression.
+extern std::string get_texture_options_key();
+
+// Compresses the mip chain `build` returns, or reads it from the cache
+// under `key`, and the options, unless the key is empty. Returns true on a
+// cache hit.
+extern bool load_compressed(const std::string&,
+        const std::function<mip_chain_t()>&, CompressedTexture*);
+
+// Loads the textures on the threads of `pool`, or on one thread when it
+// is nullptr, while the calling thread, the one with the GL context,
+// uploads them: upload(i, texture) is called for each texture found, in the
+// order they are done. Empty names are skipped. Decoded textures wait in
+// a queue of a couple per thread. The first exception of a decoder or of
+// `upload` is rethrown once all threads are done.
+extern void decode_textures(const std::vector<std::string>&,
+        const PAK3Archive&, ThreadPool*, const texture_upload_func_t&);
+
+#endif
@@ -0,0 +1,230 @@
+#include <algorithm>
+
+#include "src/texture_streamer.h"
+#include "src/time.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Loaded textures that may wait for upload, per loading thread.
+    const std::size_t loaded_per_thread = 2;
+
+    // Priorities hold the frame a texture was last seen in above the number
+    // of faces it was seen on.
+    const unsigned face_count_bits = 20;
+
+    TextureStreaming g_streaming;
+}
+
+void set_texture_streaming(const TextureStreaming& streaming)
+{
+    g_streaming = streaming;
+}
+
+const TextureStreaming& get_texture_streaming()
+{
+    return g_streaming;
+}
+
+TextureStreamer::TextureStreamer(std::vector<std::string> names,
+        const PAK3Archive& pak, const unsigned num_threads)
+    : m_names(std::move(names)), m_pak(pak), m_num_uploaded(0),
+    m_max_loaded(std::max(num_threads, 1u) * loaded_per_thread),
+    m_priorities(m_names.size(), 0), m_claimed(m_names.size(), 0),
+    m_num_unclaimed(m_names.size()), m_frame(0), m_done(false)
+{
+    for (std::size_t i = 0; i < m_names.size(); ++i) {
+        if (m_names[i].empty()) {
+            m_claimed[i] = 1;
+            --m_num_unclaimed;
+            ++m_num_uploaded;
+        }
+    }
+    for (unsigned i = 0; i < std::max(num_threads, 1u); ++i) {
+        m_threads.emplace_back([this]() { work(); });
+    }
+}
+
+TextureStreamer::~TextureStreamer() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_all();
+    for (auto&& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void TextureStreamer::set_visible(const std::vector<std::uint32_t>& counts)
+{
+    const std::uint32_t max_count = (1u << face_count_bits) - 1;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_frame;
+    const std::size_t n = std::min(counts.size(), m_priorities.size());
+    for (std::size_t i = 0; i < n; ++i) {
+        if (counts[i] > 0) {
+            m_priorities[i] = m_frame << face_count_bits |
+                std::min(counts[i], max_count);
+        }
+    }
+}
+
+void TextureStreamer::work()
+{
+    profile_set_thread_name("streamer");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this]() {
+                return m_done ||
+                    (m_num_unclaimed > 0 && m_loaded.size() < m_max_loaded);
+                });
+        if (m_done) {
+            return;
+        }
+        std::size_t best = m_names.size();
+        for (std::size_t i = 0; i < m_names.size(); ++i) {
+            if (!m_claimed[i] && (best == m_names.size() ||
+                        m_priorities[i] > m_priorities[best])) {
+                best = i;
+            }
+        }
+        m_claimed[best] = 1;
+        --m_num_unclaimed;
+        lock.unlock();
+
+        Loaded loaded{best, LoadedTexture(), nullptr};
+        try {
+            PROFILE_SPAN_DETAIL(span, "stream_texture", m_names[best].c_str());
+            if (!load_texture(m_names[best], m_pak, &loaded.texture)) {
+                loaded.texture = LoadedTexture();
+            }
+        }
+        catch (...) {
+            loaded.error = std::current_exception();
+        }
+
+        lock.lock();
+        m_loaded.push_back(std::move(loaded));
+    }
+}
+
+void TextureStreamer::upload(const TextureStreaming& budget,
+        const texture_upload_func_t& upload_func, std::size_t* num_textures,
+        std::size_t* num_bytes)
+{
+    PROFILE_SCOPE("stream_textures");
+    const std::int64_t start_ticks = get_ticks();
+    const auto budget_ticks = static_cast<std::int64_t>(
+            budget.budget_msec * (TICKS_PER_SECOND / 1000));
+    std::size_t bytes = 0;
+    for (std::size_t n = 0; ; ++n) {
+        Loaded loaded;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_loaded.empty()) {
+                break;
+            }
+            auto best = m_loaded.begin();
+            for (auto it = m_loaded.begin(); it != m_loaded.end(); ++it) {
+                if (m_priorities[it->index] > m_priorities[best->index]) {
+                    best = it;
+                }
+            }
+            if (n > 0 && budget.budget_bytes > 0 &&
+                    bytes + best->texture.get_bytes() > budget.budget_bytes) {
+                break;
+            }
+            std::swap(*best, m_loaded.back());
+            loaded = std::move(m_loaded.back());
+            m_loaded.pop_back();
+        }
+        m_wake.notify_one();
+        if (loaded.error) {
+            std::rethrow_exception(loaded.error);
+        }
+
+        upload_func(loaded.index, loaded.texture);
+        ++m_num_uploaded;
+        bytes += loaded.texture.get_bytes();
+        ++*num_textures;
+        if (get_ticks() - start_ticks >= budget_ticks) {
+            break;
+        }
+    }
+    *num_bytes += bytes;
+}
+
+TextureRestorer::TextureRestorer()
+    : m_done(false), m_thread([this]() { work(); })
+{}
+
+TextureRestorer::~TextureRestorer() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void TextureRestorer::request(const std::size_t id, build_func_t build)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_pending.insert(id).second) {
+            return;
+        }
+        m_jobs.push_back(Job{id, std::move(build)});
+    }
+    m_wake.notify_one();
+}
+
+bool TextureRestorer::take(std::size_t* id, LoadedTexture* texture)
+{
+    Built built;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_built.empty()) {
+            return false;
+        }
+        built = std::move(m_built.front());
+        m_built.pop_front();
+        m_pending.erase(built.id);
+    }
+    if (built.error) {
+        std::rethrow_exception(built.error);
+    }
+    *id = built.id;
+    *texture = std::move(built.texture);
+    return true;
+}
+
+void TextureRestorer::work()
+{
+    profile_set_thread_name("restorer");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this]() { return m_done || !m_jobs.empty(); });
+        if (m_done) {
+            return;
+        }
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        Built built{job.id, LoadedTexture(), nullptr};
+        try {
+            PROFILE_SCOPE("restore_texture");
+            built.texture = job.build();
+        }
+        catch (...) {
+            built.error = std::current_exception();
+        }
+
+        lock.lock();
+        m_built.push_back(std::move(built));
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef Q3BSP__TEXTURE_STREAMER_H
+#define Q3BSP__TEXTURE_STREAMER_H
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdint>
+
+#include "src/texture_loader.h"
+
+class PAK3Archive;
+
+struct TextureStreaming
+{
+    bool        enabled = false;
+    double      budget_msec = 2.0;  // Upload time per frame.
+    std::size_t budget_bytes = 0;   // Upload bytes per frame, or no limit.
+};
+
+// Whether maps load their textures in the background while drawing with a
+// placeholder, and how much uploading a frame may do; to be set before a
+// map is loaded.
+extern void set_texture_streaming(const TextureStreaming&);
+extern const TextureStreaming& get_texture_streaming();
+
+// Loads textures on threads of its own, as load_texture() does, most
+// wanted first, while the GL thread uploads those done a few per frame.
+// Textures are wanted in order of the frame they were last seen in, then
+// of the faces they were seen on; textures never seen come last, in order.
+// Empty names are skipped. The archive must outlive the streamer.
+class TextureStreamer
+{
+    public:
+        TextureStreamer(std::vector<std::string>, const PAK3Archive&,
+                const unsigned);
+        ~TextureStreamer() noexcept;
+
+        TextureStreamer(const TextureStreamer&) = delete;
+        void operator=(const TextureStreamer&) = delete;
+
+        // Marks the textures with a non-zero count as seen this frame, on
+        // that many faces.
+        void set_visible(const std::vector<std::uint32_t>&);
+
+        // Calls upload(i, texture) for the textures loaded so far, most
+        // wanted first, until the budget is spent, but for one texture at
+        // least. Textures that couldn't be found are passed empty. Adds
+        // the number of textures and bytes uploaded. Rethrows the first
+        // exception of a loading thread.
+        void upload(const TextureStreaming&, const texture_upload_func_t&,
+                std::size_t*, std::size_t*);
+
+        // Textures not uploaded yet.
+        std::size_t get_num_pending() const
+        {
+            return m_names.size() - m_num_uploaded;
+        }
+
+    private:
+        struct Loaded
+        {
+            std::size_t         index;
+            LoadedTexture       texture;
+            std::exception_ptr  error;
+        };
+
+        const std::vector<std::string>  m_names;
+        const PAK3Archive&              m_pak;
+        std::vector<std::thread>        m_threads;
+        std::size_t                     m_num_uploaded;     // GL thread.
+        std::size_t                     m_max_loaded;
+
+        // Guarded by m_mutex.
+        std::mutex                      m_mutex;
+        std::condition_variable         m_wake;
+        std::vector<std::uint64_t>      m_priorities;
+        std::vector<char>               m_claimed;
+        std::size_t                     m_num_unclaimed;
+        std::vector<Loaded>             m_loaded;
+        std::uint64_t                   m_frame;
+        bool                            m_done;
+
+        void work();
+};
+
+// Rebuilds textures on a thread of its own, in the order requested, for the
+// GL thread to upload, e.g. the textures a TextureManager lowered that are
+// drawn again, which are drawn at their lower size meanwhile. Textures are
+// identified by the caller's ids.
+class TextureRestorer
+{
+    public:
+        using build_func_t = std::function<LoadedTexture()>;
+
+        TextureRestorer();
+        ~TextureRestorer() noexcept;
+
+        TextureRestorer(const TextureRestorer&) = delete;
+        void operator=(const TextureRestorer&) = delete;
+
+        // Queues the texture unless it is already queued, or rebuilt and not
+        // taken yet.
+        void request(const std::size_t, build_func_t);
+
+        // Takes a rebuilt texture, oldest first. Returns false if none is
+        // done. Rethrows the exception of a build.
+        bool take(std::size_t*, LoadedTexture*);
+
+        // Textures requested and not taken yet.
+        std::size_t get_num_pending() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_pending.size();
+        }
+
+    private:
+        struct Job
+        {
+            std::size_t     id;
+            build_func_t    build;
+        };
+
+        struct Built
+        {
+            std::size_t         id;
+            LoadedTexture       texture;
+            std::exception_ptr  error;
+        };
+
+        mutable std::mutex              m_mutex;
+        std::condition_variable         m_wake;
+        std::deque<Job>                 m_jobs;
+        std::deque<Built>               m_built;
+        std::unordered_set<std::size_t> m_pending;
+        bool                            m_done;
+        std::thread                     m_thread;
+
+        void work();
+};
+
+#endif
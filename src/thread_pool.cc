@@ -0,0 +1,86 @@
+#include "src/thread_pool.h"
+#include "src/profile.h"
+
+ThreadPool::ThreadPool(const unsigned num_workers)
+    : m_fn(nullptr), m_next(0), m_end(0), m_generation(0), m_busy(0),
+    m_done(false)
+{
+    for (unsigned i = 0; i < num_workers; ++i) {
+        m_workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_all();
+    for (auto&& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(const std::size_t begin, const std::size_t end,
+        const std::function<void(std::size_t)>& fn)
+{
+    if (end <= begin) {
+        return;
+    }
+    if (m_workers.empty() || end - begin == 1) {
+        for (std::size_t i = begin; i < end; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> loop_lock(m_loop_mutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_next = begin;
+        m_end = end;
+        m_busy = static_cast<unsigned>(m_workers.size());
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    run_items();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_busy == 0; });
+    m_fn = nullptr;
+}
+
+void ThreadPool::run_items()
+{
+    for (;;) {
+        const std::size_t i = m_next.fetch_add(1);
+        if (i >= m_end) {
+            break;
+        }
+        (*m_fn)(i);
+    }
+}
+
+void ThreadPool::work()
+{
+    profile_set_thread_name("worker");
+    std::uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this, generation] {
+                return m_done || m_generation != generation; });
+        if (m_done) {
+            return;
+        }
+        generation = m_generation;
+        lock.unlock();
+        run_items();
+        lock.lock();
+        if (--m_busy == 0) {
+            m_idle.notify_one();
+        }
+    }
+}
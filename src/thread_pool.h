@@ -0,0 +1,55 @@
+#ifndef Q3BSP__THREAD_POOL_H
+#define Q3BSP__THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// takes part in every loop, so a pool without workers runs loops inline.
+class ThreadPool
+{
+    public:
+        explicit ThreadPool(const unsigned);
+        ~ThreadPool() noexcept;
+
+        ThreadPool(const ThreadPool&) = delete;
+        void operator=(const ThreadPool&) = delete;
+
+        // Workers plus the calling thread.
+        unsigned get_num_threads() const
+        {
+            return static_cast<unsigned>(m_workers.size()) + 1;
+        }
+
+        // Calls fn(i) for each i in [begin, end) on any of the threads and
+        // returns once all calls have returned. `fn` must not throw. Loops
+        // started from several threads run one after another.
+        void parallel_for(const std::size_t, const std::size_t,
+                const std::function<void(std::size_t)>&);
+
+    private:
+        std::vector<std::thread>    m_workers;
+
+        std::mutex                  m_loop_mutex;
+        std::mutex                  m_mutex;
+        std::condition_variable     m_wake;
+        std::condition_variable     m_idle;
+
+        // The current loop; guarded by m_mutex, except for m_next.
+        const std::function<void(std::size_t)>* m_fn;
+        std::atomic<std::size_t>    m_next;
+        std::size_t                 m_end;
+        std::uint64_t               m_generation;
+        unsigned                    m_busy;
+        bool                        m_done;
+
+        void work();
+        void run_items();
+};
+
+#endif
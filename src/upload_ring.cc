@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <cstring>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "src/upload_ring.h"
+#include "src/texture.h"
+#include "src/exception.h"
+#include "src/profile.h"
+
+namespace
+{
+    // Of each range, which keeps rows of any level 4-byte aligned.
+    const std::size_t range_alignment = 64;
+
+    const GLuint64 wait_timeout_nsec = 1000000000ull;
+}
+
+UploadRing::UploadRing(const std::size_t size)
+    : m_size(size), m_buffer(0), m_mapping(nullptr), m_head(0),
+    m_unfenced(0), m_bytes_uploaded(0), m_num_waits(0)
+{
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    if (has_gl_extension("GL_ARB_buffer_storage")) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER,
+                static_cast<GLsizeiptr>(m_size), nullptr, flags);
+        m_mapping = static_cast<std::uint8_t*>(glMapBufferRange(
+                    GL_PIXEL_UNPACK_BUFFER, 0,
+                    static_cast<GLsizeiptr>(m_size), flags));
+    }
+    else {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(m_size),
+                nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (glGetError() != GL_NO_ERROR) {
+        glDeleteBuffers(1, &m_buffer);
+        throwf("UploadRing: Couldn't create a buffer of %zu bytes", m_size);
+    }
+}
+
+UploadRing::~UploadRing() noexcept
+{
+    for (auto&& fence : m_fences) {
+        glDeleteSync(fence.sync);
+    }
+    if (m_mapping) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+}
+
+bool UploadRing::is_supported()
+{
+    static const bool supported = []() {
+        const auto version = reinterpret_cast<const char*>(
+                glGetString(GL_VERSION));
+        int major, minor;
+        if (version == nullptr ||
+                std::sscanf(version, "%d.%d", &major, &minor) != 2) {
+            return false;
+        }
+        return major > 3 || (major == 3 && minor >= 2) ||
+            (has_gl_extension("GL_ARB_pixel_buffer_object") &&
+             has_gl_extension("GL_ARB_map_buffer_range") &&
+             has_gl_extension("GL_ARB_sync"));
+    }();
+    return supported;
+}
+
+bool UploadRing::upload(const GLenum format, const GLint level,
+        const GLsizei width, const GLsizei height, const void* data,
+        const std::size_t bytes)
+{
+    if (bytes > m_size) {
+        return false;
+    }
+    const std::size_t offset = allocate(bytes);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    {
+        PROFILE_SPAN(span, "copy_to_upload_ring");
+        PROFILE_SPAN_ARG(span, "bytes", bytes);
+        if (m_mapping) {
+            std::memcpy(m_mapping + offset, data, bytes);
+        }
+        else {
+            void* p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                    static_cast<GLintptr>(offset),
+                    static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT |
+                    GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            std::memcpy(p, data, bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    const auto pixels = reinterpret_cast<const GLvoid*>(offset);
+    if (format == GL_RGBA) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA,
+                GL_UNSIGNED_BYTE, pixels);
+    }
+    else {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,
+                0, static_cast<GLsizei>(bytes), pixels);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_bytes_uploaded += bytes;
+    return true;
+}
+
+void UploadRing::fence()
+{
+    if (m_head == m_unfenced) {
+        return;
+    }
+    m_fences.push_back(Fence{m_unfenced, m_head,
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+    m_unfenced = m_head;
+}
+
+// Ranges are handed out in order, back to the start when the end of the
+// buffer is reached.
+std::size_t UploadRing::allocate(const std::size_t bytes)
+{
+    const std::size_t size =
+        (bytes + range_alignment - 1) / range_alignment * range_alignment;
+    if (m_head + size > m_size) {
+        fence();
+        m_head = 0;
+        m_unfenced = 0;
+    }
+    wait(m_head, m_head + size);
+    const std::size_t offset = m_head;
+    m_head += size;
+    return offset;
+}
+
+// Waits for the last fence over the range, which the older ones passed
+// before.
+void UploadRing::wait(const std::size_t begin, const std::size_t end)
+{
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < m_fences.size(); ++i) {
+        if (m_fences[i].begin < end && begin < m_fences[i].end) {
+            n = i + 1;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    GLsync sync = m_fences[n - 1].sync;
+    GLenum status = glClientWaitSync(sync, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        PROFILE_SCOPE("wait_upload_ring");
+        ++m_num_waits;
+        do {
+            status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+                    wait_timeout_nsec);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        glDeleteSync(m_fences.front().sync);
+        m_fences.pop_front();
+    }
+}
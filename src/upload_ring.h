@@ -0,0 +1,82 @@
+#ifndef Q3BSP__UPLOAD_RING_H
+#define Q3BSP__UPLOAD_RING_H
+
+#include <deque>
+#include <cstdint>
+
+#include <GL/gl.h>
+
+// A pixel unpack buffer used as a ring, that texture levels are copied into
+// and specified from. The copy is all the CPU does: glTexImage2D then reads
+// from the buffer, and the transfer runs while the GL thread goes on. Each
+// range is fenced once uploaded, and only written again once its fence has
+// passed. The buffer stays mapped where GL_ARB_buffer_storage allows it,
+// and is otherwise mapped unsynchronized for each copy.
+class UploadRing
+{
+    public:
+        explicit UploadRing(const std::size_t);
+        ~UploadRing() noexcept;
+
+        UploadRing(const UploadRing&) = delete;
+        void operator=(const UploadRing&) = delete;
+
+        // Whether the current context has pixel buffer objects, buffer
+        // range mapping and sync objects (GL 3.2).
+        static bool is_supported();
+
+        // Specifies a level of the texture bound to GL_TEXTURE_2D as
+        // glTexImage2D, or glCompressedTexImage2D for a compressed
+        // `format`, from a copy of the `bytes` at `data`. Returns false,
+        // doing nothing, for levels larger than the ring.
+        bool upload(const GLenum, const GLint, const GLsizei, const GLsizei,
+                const void*, const std::size_t);
+
+        // Fences the uploads since the last call, e.g. the levels of one
+        // texture.
+        void fence();
+
+        std::size_t get_size() const
+        {
+            return m_size;
+        }
+
+        bool is_persistent() const
+        {
+            return m_mapping != nullptr;
+        }
+
+        // Bytes copied into the ring, and times it waited for the GPU to be
+        // done with a range before writing it again.
+        std::uint64_t get_bytes_uploaded() const
+        {
+            return m_bytes_uploaded;
+        }
+
+        std::uint64_t get_num_waits() const
+        {
+            return m_num_waits;
+        }
+
+    private:
+        struct Fence
+        {
+            std::size_t begin;
+            std::size_t end;
+            GLsync      sync;
+        };
+
+        std::size_t         m_size;
+        GLuint              m_buffer;
+        std::uint8_t*       m_mapping;      // If persistent.
+        std::size_t         m_head;
+        std::size_t         m_unfenced;     // Start of the ranges not fenced.
+        std::deque<Fence>   m_fences;       // Oldest first.
+        std::uint64_t       m_bytes_uploaded;
+        std::uint64_t       m_num_waits;
+
+        std::size_t allocate(const std::size_t);
+        void wait(const std::size_t, const std::size_t);
+};
+
+#endif